@@ -6,7 +6,7 @@
 
 #pragma once
 
-#include <nori/mesh.h>
+#include <nori/instance.h>
 
 NORI_NAMESPACE_BEGIN
 
@@ -19,12 +19,15 @@ NORI_NAMESPACE_BEGIN
 class Accel {
 public:
     /**
-     * \brief Register a triangle mesh for inclusion in the acceleration
-     * data structure
+     * \brief Register a shape (e.g. a triangle mesh) for inclusion in the
+     * acceleration data structure
+     *
+     * Several shapes can be registered, and meshes may share their
+     * buffers (see \ref GeometryCache).
      *
      * This function can only be used before \ref build() is called
      */
-    void addMesh(Mesh *mesh);
+    void addShape(Shape *shape);
 
     /// Build the acceleration data structure (currently a no-op)
     void build();
@@ -54,8 +57,10 @@ public:
     bool rayIntersect(const Ray3f &ray, Intersection &its, bool shadowRay) const;
 
 private:
-    Mesh         *m_mesh = nullptr; ///< Mesh (only a single one for now)
-    BoundingBox3f m_bbox;           ///< Bounding box of the entire scene
+    std::vector<Mesh *> m_meshes; ///< Triangle meshes registered with the accelerator
+    std::vector<Instance *> m_instances; ///< Mesh instances registered with the accelerator
+    std::vector<Shape *> m_shapes; ///< Other shapes registered with the accelerator
+    BoundingBox3f m_bbox;         ///< Bounding box of the entire scene
 };
 
 NORI_NAMESPACE_END
@@ -19,6 +19,7 @@ NORI_NAMESPACE_BEGIN
 class Bitmap : public Eigen::Array<Color3f, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> {
 public:
     typedef Eigen::Array<Color3f, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> Base;
+    typedef Eigen::Array<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> Layer;
 
     /**
      * \brief Allocate a new bitmap of the specified size
@@ -29,14 +30,30 @@ public:
     Bitmap(const Vector2i &size = Vector2i(0, 0))
         : Base(size.y(), size.x()) { }
 
-    /// Load an OpenEXR file with the specified filename
+    /**
+     * \brief Load an OpenEXR file with the specified filename
+     *
+     * Channels other than the RGB color are loaded as layers
+     */
     Bitmap(const std::string &filename);
 
-    /// Save the bitmap as an EXR file with the specified filename
+    /**
+     * \brief Attach an additional single-channel layer (e.g. the number of
+     * samples per pixel), which is written to EXR files as channel \c name
+     */
+    void addLayer(const std::string &name, const Layer &layer);
+
+    /// Return the additional layers along with their names
+    const std::vector<std::pair<std::string, Layer>> &getLayers() const { return m_layers; }
+
+    /// Save the bitmap (and its layers) as an EXR file with the specified filename
     void saveEXR(const std::string &filename);
 
     /// Save the bitmap as a PNG file (with sRGB tonemapping) with the specified filename
     void savePNG(const std::string &filename);
+
+private:
+    std::vector<std::pair<std::string, Layer>> m_layers;
 };
 
 NORI_NAMESPACE_END
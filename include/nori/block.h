@@ -12,7 +12,8 @@
 
 #include <nori/color.h>
 #include <nori/vector.h>
-#include <tbb/mutex.h>
+#include <atomic>
+#include <memory>
 
 #define NORI_BLOCK_SIZE 32 /* Block size used for parallelization */
 
@@ -34,6 +35,8 @@ NORI_NAMESPACE_BEGIN
  */
 class ImageBlock : public Eigen::Array<Color4f, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> {
 public:
+    typedef Eigen::Array<Color4f, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> Base;
+
     /**
      * Create a new image block of the specified maximum size
      * \param size
@@ -70,6 +73,16 @@ public:
      */
     Bitmap *toBitmap() const;
 
+    /**
+     * \brief Turn the block into a bitmap of unnormalized pixels
+     *
+     * The bitmap stores the weighted sums of the samples, and the
+     * accumulated filter weights in the layer "weight". Such bitmaps
+     * of partial renders of an image can be summed and normalized
+     * afterwards. The border region is discarded.
+     */
+    Bitmap *toWeightedBitmap() const;
+
     /// Convert a bitmap into an image block
     void fromBitmap(const Bitmap &bitmap);
 
@@ -82,16 +95,10 @@ public:
     /**
      * \brief Merge another image block into this one
      *
-     * During the merge operation, this function locks 
-     * the destination block using a mutex.
+     * This function is not thread-safe. Use a \ref BlockAccumulator to
+     * merge blocks that are rendered in parallel.
      */
-    void put(ImageBlock &b);
-
-    /// Lock the image block (using an internal mutex)
-    inline void lock() const { m_mutex.lock(); }
-    
-    /// Unlock the image block
-    inline void unlock() const { m_mutex.unlock(); }
+    void put(const ImageBlock &b);
 
     /// Return a human-readable string summary
     std::string toString() const;
@@ -104,7 +111,6 @@ protected:
     float *m_weightsX = nullptr;
     float *m_weightsY = nullptr;
     float m_lookupFactor = 0;
-    mutable tbb::mutex m_mutex;
 };
 
 /**
@@ -114,6 +120,10 @@ protected:
  * rectangular blocks suitable for parallel rendering. The blocks
  * are ordered in spiraling pattern so that the center is
  * rendered first.
+ *
+ * A generator can also hand out only a shard of the blocks (every
+ * N-th block of the spiral), so that several independent processes
+ * can split the image between them.
  */
 class BlockGenerator {
 public:
@@ -123,32 +133,211 @@ public:
      *      Size of the image that should be split into blocks
      * \param blockSize
      *      Maximum size of the individual blocks
+     * \param shardIndex, shardCount
+     *      Only hand out the blocks whose position in the
+     *      spiral modulo \c shardCount equals \c shardIndex
      */
-    BlockGenerator(const Vector2i &size, int blockSize);
-    
+    BlockGenerator(const Vector2i &size, int blockSize,
+                   int shardIndex = 0, int shardCount = 1);
+
     /**
      * \brief Return the next block to be rendered
      *
-     * This function is thread-safe
+     * This function is thread-safe and lock-free
      *
      * \return \c false if there were no more blocks
      */
     bool next(ImageBlock &block);
 
+    /**
+     * \brief Start handing out the blocks again from the given index
+     *
+     * This is used to render the image in several passes, or to resume
+     * an interrupted pass. This function must not be called while other
+     * threads are calling \ref next().
+     */
+    void reset(int index = 0) { m_nextBlock.store(index, std::memory_order_relaxed); }
+
     /// Return the total number of blocks
-    int getBlockCount() const { return m_blocksLeft; }
+    int getBlockCount() const { return (int) m_blocks.size(); }
+
+    /// Return the offset of the i-th block handed out by \ref next()
+    const Point2i &getBlockOffset(int index) const { return m_blocks[index]; }
+
+    /// Return the maximum size of the blocks
+    int getBlockSize() const { return m_blockSize; }
 protected:
     enum EDirection { ERight = 0, EDown, ELeft, EUp };
 
-    Point2i m_block;
-    Vector2i m_numBlocks;
+    std::vector<Point2i> m_blocks; ///< Block offsets in the order in which they are handed out
     Vector2i m_size;
     int m_blockSize;
-    int m_numSteps;
-    int m_blocksLeft;
-    int m_stepsLeft;
-    int m_direction;
-    tbb::mutex m_mutex;
+    std::atomic<int> m_nextBlock;  ///< Index of the next block in \ref m_blocks
+};
+
+/**
+ * \brief Lock-free accumulation of rendered blocks into the full image
+ *
+ * Rendered blocks overlap in their border regions, hence merging them
+ * directly into the image requires synchronization. Instead, this class
+ * keeps every finished block until the tiles (block interiors) that it
+ * overlaps are resolved. A tile is resolved by the thread that finishes
+ * the last block overlapping it. That thread sums the overlapping blocks
+ * into the image in the order of the \ref BlockGenerator. Every pixel is
+ * thus written by a single thread, and the result is bit-identical to
+ * merging the blocks one after another in that order.
+ *
+ * The generator may hand out only a shard of the blocks. Tiles are then
+ * resolved once the blocks of the shard that overlap them are finished.
+ *
+ * The image may be rendered in several passes, whose blocks are summed
+ * into the image as well. A reader (e.g. the preview window) can copy a
+ * tile at any time using \ref readTile(), which detects concurrent writes.
+ */
+class BlockAccumulator {
+public:
+    /**
+     * \brief Prepare the accumulation of the blocks of a block generator
+     *
+     * \param image
+     *      Destination image (must be cleared, and must have the same
+     *      reconstruction filter as the rendered blocks)
+     * \param generator
+     *      Block generator that hands out the blocks to be rendered
+     */
+    BlockAccumulator(ImageBlock &image, const BlockGenerator &generator);
+
+    /**
+     * \brief Store a rendered block and resolve all tiles that it completes
+     *
+     * This function is thread-safe and lock-free
+     */
+    void put(const ImageBlock &block);
+
+    /// Return the destination image
+    const ImageBlock &getImage() const { return m_image; }
+
+    /// Return the number of tiles (one per block of the whole image)
+    int getTileCount() const { return m_tileCount.x() * m_tileCount.y(); }
+
+    /// Is the block of a tile handed out by the generator?
+    bool isRendered(int tile) const { return m_order[tile] >= 0; }
+
+    /// Return the offset of a tile within the image
+    Point2i getTileOffset(int tile) const {
+        return Point2i(tile % m_tileCount.x(), tile / m_tileCount.x()) * m_blockSize;
+    }
+
+    /// Return the size of a tile
+    Vector2i getTileSize(int tile) const {
+        return (m_image.getSize() - getTileOffset(tile)).cwiseMin(Vector2i::Constant(m_blockSize));
+    }
+
+    /**
+     * \brief Prepare the accumulation of another rendering pass
+     *
+     * Must only be called once all blocks of the current pass have
+     * been stored, and before the first block of the next pass is.
+     */
+    void nextPass();
+
+    /// Return the number of rendering passes that were summed into a tile
+    int getResolvedPasses(int tile) const {
+        return m_versions[tile].load(std::memory_order_acquire) / 2;
+    }
+
+    /**
+     * \brief Copy the pixels of a tile (without border) from the image
+     *
+     * This function is thread-safe and lock-free
+     *
+     * \return \c false if the tile was being written at the same time.
+     *     Otherwise, \c passes is set to the number of passes that
+     *     were summed into the copied pixels.
+     */
+    bool readTile(int tile, ImageBlock::Base &pixels, int &passes) const;
+
+    /**
+     * \brief Write the image, the progress of all tiles, and the stored
+     * blocks to a stream
+     *
+     * Must only be called while no blocks are being stored.
+     */
+    void write(std::ostream &os) const;
+
+    /// Restore the state written by \ref write()
+    void read(std::istream &is);
+
+protected:
+    /// Return the range of tiles in the vicinity of a tile that overlap it with their borders
+    void getNeighborhood(int tile, Point2i &min, Point2i &max) const;
+
+    /// Sum the overlapping blocks into a tile of the image, and release blocks that are no longer needed
+    void resolve(int tile);
+
+    ImageBlock &m_image;
+    Vector2i m_tileCount;
+    int m_blockSize;
+    int m_reach;                     ///< Number of neighboring tiles that a border can reach
+    std::vector<int> m_order;        ///< Position of each tile in the order of the generator (or -1)
+    std::vector<std::unique_ptr<ImageBlock::Base>> m_blocks; ///< Finished blocks (including borders)
+    std::unique_ptr<std::atomic<int>[]> m_pending; ///< Unfinished blocks overlapping each tile
+    std::unique_ptr<std::atomic<int>[]> m_users;   ///< Unresolved tiles that need each block
+    /// Twice the number of passes summed into each tile, plus one while the tile is being written
+    std::unique_ptr<std::atomic<int>[]> m_versions;
+};
+
+/**
+ * \brief Per-pixel sample statistics for adaptive sampling
+ *
+ * Records the number of samples taken in each pixel along with the running
+ * mean and variance of their luminance (using Welford's algorithm). Since
+ * the samples of a pixel are all taken by the thread rendering the block
+ * that contains it, no synchronization is needed within a pass.
+ */
+class SampleStatistics {
+public:
+    typedef Eigen::Array<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> Layer;
+
+    /// Create empty statistics for an image of the given size
+    SampleStatistics(const Vector2i &size);
+
+    /// Record the luminance of a sample taken in the given pixel
+    void put(const Point2i &pixel, float value) {
+        float &count = m_count(pixel.y(), pixel.x());
+        float &mean = m_mean(pixel.y(), pixel.x());
+        float delta = value - mean;
+        count += 1;
+        mean += delta / count;
+        m_m2(pixel.y(), pixel.x()) += delta * (value - mean);
+    }
+
+    /**
+     * \brief Return the standard error of the mean luminance of a pixel
+     * relative to the mean
+     *
+     * Pixels with a mean luminance below 0.01 are compared against that
+     * value instead, so that dark pixels don't need an excessive number
+     * of samples. Returns infinity if fewer than two samples were taken.
+     */
+    float getRelativeError(const Point2i &pixel) const;
+
+    /// Return the number of pixels whose relative error is below the given threshold
+    size_t getConvergedCount(float threshold) const;
+
+    /// Return the number of samples taken in each pixel
+    const Layer &getSampleCounts() const { return m_count; }
+
+    /// Write the statistics to a stream
+    void write(std::ostream &os) const;
+
+    /// Restore the statistics written by \ref write()
+    void read(std::istream &is);
+
+protected:
+    Layer m_count;  ///< Number of samples (stored as float so it can be written as an EXR layer)
+    Layer m_mean;   ///< Mean luminance
+    Layer m_m2;     ///< Sum of squared deviations from the mean luminance
 };
 
 NORI_NAMESPACE_END
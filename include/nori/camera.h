@@ -7,6 +7,8 @@
 #pragma once
 
 #include <nori/object.h>
+#include <nori/bbox.h>
+#include <memory>
 
 NORI_NAMESPACE_BEGIN
 
@@ -45,11 +47,39 @@ public:
         const Point2f &samplePosition,
         const Point2f &apertureSample) const = 0;
 
+    /**
+     * \brief Estimate how large the given bounding box appears on the film
+     *
+     * Returns the (conservative) length of the projected diagonal in pixels,
+     * which is used to select the level of detail of meshes. Cameras that
+     * can't provide an estimate return infinity.
+     */
+    virtual float getProjectedSize(const BoundingBox3f &bbox) const {
+        return std::numeric_limits<float>::infinity();
+    }
+
+    /**
+     * \brief Create a copy of the camera with some of its properties
+     * replaced (e.g. "toWorld", "fov", "width", or "height")
+     *
+     * The points "origin" and "target" and the vector "up" move the
+     * camera like a \c lookat tag: they replace the lookat part of the
+     * camera's transformation and keep the transformations preceding it
+     * (e.g. a mirroring scale). Omitted ones default to the current view.
+     *
+     * This is used to render a loaded scene from another viewpoint. The
+     * copy shares the reconstruction filter of this camera. Cameras that
+     * don't support this throw an exception.
+     */
+    virtual Camera *clone(const PropertyList &overrides) const {
+        throw NoriException("Camera::clone(): not supported by this camera!");
+    }
+
     /// Return the size of the output image in pixels
     const Vector2i &getOutputSize() const { return m_outputSize; }
 
     /// Return the camera's reconstruction filter in image space
-    const ReconstructionFilter *getReconstructionFilter() const { return m_rfilter; }
+    const ReconstructionFilter *getReconstructionFilter() const { return m_rfilter.get(); }
 
     /**
      * \brief Return the type of object (i.e. Mesh/Camera/etc.) 
@@ -58,7 +88,7 @@ public:
     EClassType getClassType() const { return ECamera; }
 protected:
     Vector2i m_outputSize;
-    ReconstructionFilter *m_rfilter;
+    std::shared_ptr<ReconstructionFilter> m_rfilter; ///< Shared with copies (see \ref clone())
 };
 
 NORI_NAMESPACE_END
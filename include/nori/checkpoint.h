@@ -0,0 +1,74 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+*/
+
+#pragma once
+
+#include <nori/common.h>
+
+NORI_NAMESPACE_BEGIN
+
+class SampleStatistics;
+
+/**
+ * \brief Snapshot of an interrupted rendering job
+ *
+ * A checkpoint stores the render settings and progress along with the
+ * accumulated image (including the filter weights), the state of its
+ * tiles, the blocks that are waiting to be merged, and the statistics of
+ * adaptive sampling. The samplers are seeded from the block and pass
+ * index, so the progress also determines their state. Resuming from a
+ * checkpoint thus produces exactly the same image as an uninterrupted run.
+ */
+struct Checkpoint {
+    uint32_t sampleCount = 0;      ///< Samples per pixel of the whole render
+    uint32_t passSize = 0;         ///< Samples per pixel and pass
+    uint32_t pass = 0;             ///< Index of the pass in progress
+    uint32_t nextBlock = 0;        ///< Number of blocks of the pass that were rendered
+    uint32_t renderedSamples = 0;  ///< Samples per pixel of the completed passes
+    bool progressive = false;      ///< Is the image saved after every pass?
+    uint32_t shardIndex = 0;       ///< Shard of the blocks that is rendered (see \ref BlockGenerator)
+    uint32_t shardCount = 1;       ///< Number of shards of the blocks
+    uint32_t sppShardIndex = 0;    ///< Shard of the samples that is rendered
+    uint32_t sppShardCount = 1;    ///< Number of shards of the samples
+    float adaptiveThreshold = 0;   ///< Relative error of converged pixels (0: no adaptive sampling)
+    double elapsed = 0;            ///< Rendering time so far in seconds
+    uint64_t sceneHash = 0;        ///< Identifies the scene and render settings (see \ref hashScene())
+
+    /// Create an empty checkpoint
+    Checkpoint() { }
+
+    /// Read the settings and progress from a checkpoint file
+    Checkpoint(const std::string &filename);
+
+    /**
+     * \brief Hash a description of the rendered scene (e.g. the version of
+     * the scene file, the integrator and the sampler)
+     *
+     * A checkpoint must only be resumed with the scene that it was
+     * written for, which is detected by comparing these hashes.
+     */
+    static uint64_t hashScene(const std::string &description);
+
+    /**
+     * \brief Restore the image (and statistics) from the checkpoint file
+     * that this instance was read from
+     */
+    void restore(BlockAccumulator &accumulator, SampleStatistics *statistics) const;
+
+    /**
+     * \brief Write a checkpoint file
+     *
+     * The file is replaced atomically, so that an existing checkpoint
+     * survives if the process is killed while writing.
+     */
+    void write(const std::string &filename, const BlockAccumulator &accumulator,
+               const SampleStatistics *statistics) const;
+
+private:
+    std::string m_filename;
+};
+
+NORI_NAMESPACE_END
@@ -0,0 +1,170 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+*/
+
+#pragma once
+
+#include <nori/bbox.h>
+#include <memory>
+#include <atomic>
+
+NORI_NAMESPACE_BEGIN
+
+/// Positions and attributes of the three vertices of a triangle
+struct TriangleVertices {
+    Point3f p[3];
+    Normal3f n[3];
+    Point2f uv[3];
+};
+
+/**
+ * \brief Out-of-core storage for the triangles of a mesh
+ *
+ * The triangles are stored in a memory-mapped file that is split into
+ * fixed-size clusters of consecutive triangles. Each cluster is
+ * self-contained (it stores the vertex positions, normals and texture
+ * coordinates of its triangles), and the bounding boxes of all clusters
+ * stay in memory so that rays only touch clusters they can actually hit.
+ *
+ * Clusters are paged in on demand. All cluster files share a single
+ * memory budget, which is enforced using the CLOCK (second chance)
+ * approximation of LRU replacement: evicted clusters are released using
+ * <tt>madvise(MADV_DONTNEED)</tt> and transparently re-read from the file
+ * when they are used again. A cluster pointer therefore never dangles,
+ * and lookups of resident clusters don't need to take a lock.
+ *
+ * Memory mapping is currently only supported on POSIX systems.
+ */
+class ClusterFile {
+public:
+    /**
+     * \brief Write the triangles of a mesh into a cluster file
+     *
+     * \param filename
+     *    Destination path. The file is first written under a temporary
+     *    name and then renamed, so readers never observe partial files.
+     * \param key
+     *    Identifies the geometry (see \ref GeometryCache::makeKey()).
+     *    It is stored in the file and checked by \ref isUpToDate().
+     * \param mesh
+     *    The mesh (its buffers must still be in memory)
+     * \param clusterSize
+     *    Size of a cluster in bytes (rounded up to the page size)
+     */
+    static void write(const std::string &filename, const std::string &key,
+                      const Mesh *mesh, size_t clusterSize);
+
+    /**
+     * \brief Check whether a cluster file exists, was created with the
+     * given key, and is newer than the source file it was built from
+     */
+    static bool isUpToDate(const std::string &filename, const std::string &key,
+                           const std::string &source);
+
+    /// Map an existing cluster file into memory
+    ClusterFile(const std::string &filename);
+
+    /// Unmap the file and release its clusters
+    ~ClusterFile();
+
+    /// Return the total number of triangles
+    uint32_t getTriangleCount() const { return m_triangleCount; }
+
+    /// Return the number of clusters
+    uint32_t getClusterCount() const { return (uint32_t) m_clusterBBoxes.size(); }
+
+    /// Return the size of a cluster in bytes
+    size_t getClusterSize() const { return m_clusterSize; }
+
+    /// Does the file store per-vertex normals?
+    bool hasNormals() const { return m_hasNormals; }
+
+    /// Does the file store per-vertex texture coordinates?
+    bool hasTexCoords() const { return m_hasTexCoords; }
+
+    /// Return the bounding box of all triangles
+    const BoundingBox3f &getBoundingBox() const { return m_bbox; }
+
+    /// Return the bounding box of a cluster
+    const BoundingBox3f &getBoundingBox(uint32_t cluster) const {
+        return m_clusterBBoxes[cluster];
+    }
+
+    /// Return the data of a cluster, paging it in if necessary
+    const uint8_t *acquire(uint32_t cluster) const {
+        uint8_t state = m_state[cluster].load(std::memory_order_relaxed);
+        if (!(state & EResident))
+            pageIn(cluster);
+        else if (!(state & EReferenced))
+            m_state[cluster].fetch_or(EReferenced, std::memory_order_relaxed);
+        return m_data + (size_t) (cluster + 1) * m_clusterSize;
+    }
+
+    /// Look up the vertices of a triangle (pages in its cluster)
+    void getTriangle(uint32_t index, TriangleVertices &tri) const;
+
+    /**
+     * \brief Find the closest intersection with any triangle in the file
+     *
+     * \param ray
+     *    The ray segment to be used for the intersection query
+     * \param index
+     *    Upon success, contains the index of the triangle that was hit
+     * \param u, v, t
+     *    Upon success, contain the barycentric coordinates and the
+     *    distance of the intersection (see \ref Mesh::rayIntersect())
+     * \param shadowRay
+     *    If set, the search stops at the first intersection
+     * \return
+     *   \c true if an intersection has been detected
+     */
+    bool rayIntersect(const Ray3f &ray, uint32_t &index, float &u, float &v,
+                      float &t, bool shadowRay) const;
+
+    /// Set the memory budget (in bytes) shared by all cluster files
+    static void setMemoryBudget(size_t budget);
+
+    /// Is any cluster file currently mapped?
+    static bool isActive();
+
+    /// Reset the page-in statistics (and the clock used to compute rates)
+    static void resetStatistics();
+
+    /// Return a summary of the page-in statistics since the last reset
+    static std::string getStatistics();
+
+    /// Return a human-readable summary of this instance
+    std::string toString() const;
+
+protected:
+    /// Flags stored per cluster
+    enum EClusterState : uint8_t {
+        EResident   = 1,
+        EReferenced = 2
+    };
+
+    /// Mark a cluster as resident, evicting others to stay within the budget
+    void pageIn(uint32_t cluster) const;
+
+    /// Release a resident cluster
+    void evict(uint32_t cluster) const;
+
+    friend struct ClusterPager;
+
+private:
+    std::string m_filename;
+    const uint8_t *m_data = nullptr;     ///< Memory-mapped file contents
+    size_t m_fileSize = 0;
+    size_t m_clusterSize = 0;            ///< Size of a cluster in bytes
+    uint32_t m_triangleCount = 0;
+    uint32_t m_trianglesPerCluster = 0;
+    bool m_hasNormals = false;
+    bool m_hasTexCoords = false;
+    BoundingBox3f m_bbox;
+    std::vector<BoundingBox3f> m_clusterBBoxes;
+    std::unique_ptr<std::atomic<uint8_t>[]> m_state;
+};
+
+NORI_NAMESPACE_END
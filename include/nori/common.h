@@ -107,6 +107,7 @@ typedef TRay<Point3f, Vector3f> Ray3f;
 /// Some more forward declarations
 class BSDF;
 class Bitmap;
+class BlockAccumulator;
 class BlockGenerator;
 class Camera;
 class ImageBlock;
@@ -122,6 +123,7 @@ class PhaseFunction;
 class ReconstructionFilter;
 class Sampler;
 class Scene;
+class Shape;
 
 /// Import cout, cerr, endl for debugging purposes
 using std::cout;
@@ -130,6 +132,7 @@ using std::endl;
 
 typedef Eigen::Matrix<float,    Eigen::Dynamic, Eigen::Dynamic> MatrixXf;
 typedef Eigen::Matrix<uint32_t, Eigen::Dynamic, Eigen::Dynamic> MatrixXu;
+typedef Eigen::Matrix<uint16_t, Eigen::Dynamic, Eigen::Dynamic> MatrixXu16;
 
 /// Simple exception class, which stores a human-readable error description
 class NoriException : public std::runtime_error {
@@ -175,6 +178,14 @@ extern std::string timeString(double time, bool precise = false);
 /// Convert a memory amount in bytes into a human-readable string
 extern std::string memString(size_t size, bool precise = false);
 
+/**
+ * \brief Describe the version of a file by its size and modification
+ * time (in nanoseconds), formatted as <tt>size:mtime</tt>
+ *
+ * Returns <tt>-1:0</tt> if the file doesn't exist (and always on Windows).
+ */
+extern std::string fileVersion(const std::string &filename);
+
 /// Measures associated with probability distributions
 enum EMeasure {
     EUnknownMeasure = 0,
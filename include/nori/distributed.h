@@ -0,0 +1,97 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+*/
+
+/* =======================================================================
+     This file contains classes for distributing the blocks of an image
+     over several worker processes that communicate via sockets.
+ * ======================================================================= */
+
+#pragma once
+
+#include <nori/common.h>
+#include <functional>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Coordinator of a distributed rendering job
+ *
+ * The coordinator listens on a socket, hands out the blocks of every
+ * pass to the connected workers, and merges the rendered blocks (including
+ * their borders) into the image using a \ref BlockAccumulator. Blocks that
+ * were handed out to a worker that disconnects are handed out again. When
+ * all workers have disconnected before the image is finished, rendering
+ * fails instead of waiting for new ones.
+ *
+ * Addresses are either of the form <tt>unix:/path/to/socket</tt> for
+ * Unix-domain sockets, or <tt>host:port</tt> for TCP sockets. All
+ * processes must run on machines with the same byte order.
+ */
+class RenderCoordinator {
+public:
+    /// Called after every completed pass with the pass index
+    typedef std::function<void (uint32_t)> PassCallback;
+
+    /// Start listening on the given address
+    RenderCoordinator(const std::string &address);
+
+    /// Stop listening
+    ~RenderCoordinator();
+
+    /**
+     * \brief Render the image using the workers that connect
+     *
+     * \param generator
+     *    Block generator that determines the blocks and their order
+     * \param accumulator
+     *    Block accumulator that merges the rendered blocks into the image
+     * \param filter
+     *    Reconstruction filter of the camera
+     * \param sampleCount
+     *    Total number of samples per pixel
+     * \param passSize
+     *    Number of samples per pixel and pass
+     * \param callback
+     *    Function that is invoked after each pass
+     */
+    void render(const BlockGenerator &generator, BlockAccumulator &accumulator,
+                const ReconstructionFilter *filter, uint32_t sampleCount,
+                uint32_t passSize, const PassCallback &callback);
+
+private:
+    std::string m_address;
+    int m_socket = -1;
+};
+
+/**
+ * \brief Worker of a distributed rendering job
+ *
+ * The worker connects to a \ref RenderCoordinator once per thread, and
+ * renders the blocks it is handed out until the coordinator is done.
+ * All workers must load the same scene as the coordinator.
+ */
+class RenderWorker {
+public:
+    /// Render the pixels of a block for the given pass and number of samples per pixel
+    typedef std::function<void (ImageBlock &, Sampler *, uint32_t, uint32_t)> RenderFunction;
+
+    /**
+     * \brief Serve a coordinator until it has finished
+     *
+     * \param address
+     *    Address of the coordinator (see \ref RenderCoordinator)
+     * \param scene
+     *    The scene, which must match the scene of the coordinator
+     * \param threadCount
+     *    Number of connections that render blocks in parallel
+     * \param renderFunction
+     *    Function that renders a block
+     */
+    static void run(const std::string &address, const Scene *scene,
+                    int threadCount, const RenderFunction &renderFunction);
+};
+
+NORI_NAMESPACE_END
@@ -183,4 +183,231 @@ private:
     bool m_normalized;
 };
 
+/**
+ * \brief Discrete probability distribution based on the alias method
+ *
+ * Like \ref DiscretePDF, but samples are generated in constant time
+ * (Walker's alias method, using Vose's construction): each entry stores
+ * a probability and an "alias" entry, so that a sample only requires a
+ * single table lookup instead of a binary search over the CDF.
+ *
+ * \ingroup libcore
+ */
+struct DiscreteAliasTable {
+public:
+    /// Allocate memory for a distribution with the given number of entries
+    explicit DiscreteAliasTable(size_t nEntries = 0) {
+        reserve(nEntries);
+        clear();
+    }
+
+    /// Clear all entries
+    void clear() {
+        m_pdf.clear();
+        m_table.clear();
+        m_sum = m_normalization = 0.0f;
+        m_normalized = false;
+    }
+
+    /// Reserve memory for a certain number of entries
+    void reserve(size_t nEntries) {
+        m_pdf.reserve(nEntries);
+    }
+
+    /// Append an entry with the specified discrete probability
+    void append(float pdfValue) {
+        m_pdf.push_back(pdfValue);
+    }
+
+    /// Return the number of entries so far
+    size_t size() const {
+        return m_pdf.size();
+    }
+
+    /// Access an entry by its index
+    float operator[](size_t entry) const {
+        return m_pdf[entry];
+    }
+
+    /// Has the distribution been normalized?
+    bool isNormalized() const {
+        return m_normalized;
+    }
+
+    /**
+     * \brief Return the original (unnormalized) sum of all PDF entries
+     *
+     * This assumes that \ref normalize() has previously been called
+     */
+    float getSum() const {
+        return m_sum;
+    }
+
+    /**
+     * \brief Return the normalization factor (i.e. the inverse of \ref getSum())
+     *
+     * This assumes that \ref normalize() has previously been called
+     */
+    float getNormalization() const {
+        return m_normalization;
+    }
+
+    /**
+     * \brief Normalize the distribution and build the alias table
+     *
+     * \return Sum of the (previously unnormalized) entries
+     */
+    float normalize() {
+        size_t n = m_pdf.size();
+        double sum = 0;
+        for (float value : m_pdf)
+            sum += value;
+        m_sum = (float) sum;
+        m_table.clear();
+        if (!(sum > 0)) {
+            m_normalization = 0.0f;
+            return m_sum;
+        }
+
+        m_normalization = (float) (1.0 / sum);
+        m_table.resize(n);
+
+        /* Partition the entries (scaled so that their mean is 1) into
+           those below and above the mean */
+        std::vector<double> scaled(n);
+        std::vector<uint32_t> small, large;
+        for (size_t i=0; i<n; ++i) {
+            m_pdf[i] = (float) (m_pdf[i] / sum);
+            scaled[i] = m_pdf[i] * (double) n;
+            (scaled[i] < 1.0 ? small : large).push_back((uint32_t) i);
+        }
+
+        /* Fill up each small entry using the probability mass of a large one */
+        while (!small.empty() && !large.empty()) {
+            uint32_t s = small.back(), l = large.back();
+            small.pop_back();
+            m_table[s].prob = (float) scaled[s];
+            m_table[s].alias = l;
+            scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+            if (scaled[l] < 1.0) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+
+        /* The remaining entries are (up to roundoff) exactly at the mean */
+        for (uint32_t i : small)
+            m_table[i] = Entry { 1.0f, i };
+        for (uint32_t i : large)
+            m_table[i] = Entry { 1.0f, i };
+
+        m_normalized = true;
+        return m_sum;
+    }
+
+    /**
+     * \brief %Transform a uniformly distributed sample to the stored distribution
+     *
+     * \param[in] sampleValue
+     *     An uniformly distributed sample on [0,1]
+     * \return
+     *     The discrete index associated with the sample
+     */
+    size_t sample(float sampleValue) const {
+        return sampleReuse(sampleValue);
+    }
+
+    /**
+     * \brief %Transform a uniformly distributed sample to the stored distribution
+     *
+     * \param[in] sampleValue
+     *     An uniformly distributed sample on [0,1]
+     * \param[out] pdf
+     *     Probability value of the sample
+     * \return
+     *     The discrete index associated with the sample
+     */
+    size_t sample(float sampleValue, float &pdf) const {
+        size_t index = sample(sampleValue);
+        pdf = m_pdf[index];
+        return index;
+    }
+
+    /**
+     * \brief %Transform a uniformly distributed sample to the stored distribution
+     *
+     * The original sample is value adjusted so that it can be "reused".
+     *
+     * \param[in, out] sampleValue
+     *     An uniformly distributed sample on [0,1]
+     * \return
+     *     The discrete index associated with the sample
+     */
+    size_t sampleReuse(float &sampleValue) const {
+        size_t n = m_table.size();
+        if (n == 0)
+            throw NoriException("DiscreteAliasTable::sampleReuse(): the table is "
+                                "empty or has not been normalized!");
+        float scaled = sampleValue * n;
+        size_t index = std::min((size_t) scaled, n - 1);
+        float offset = std::min(scaled - index, 1.0f);
+
+        /* Entries without an alias (prob == 1) must not divide by 1 - prob */
+        const Entry &entry = m_table[index];
+        if (offset < entry.prob || entry.prob >= 1.0f) {
+            sampleValue = offset / entry.prob;
+            return index;
+        } else {
+            sampleValue = std::min((offset - entry.prob) / (1.0f - entry.prob),
+                                   1.0f - std::numeric_limits<float>::epsilon());
+            return entry.alias;
+        }
+    }
+
+    /**
+     * \brief %Transform a uniformly distributed sample.
+     *
+     * The original sample is value adjusted so that it can be "reused".
+     *
+     * \param[in,out]
+     *     An uniformly distributed sample on [0,1]
+     * \param[out] pdf
+     *     Probability value of the sample
+     * \return
+     *     The discrete index associated with the sample
+     */
+    size_t sampleReuse(float &sampleValue, float &pdf) const {
+        size_t index = sampleReuse(sampleValue);
+        pdf = m_pdf[index];
+        return index;
+    }
+
+    /**
+     * \brief Turn the underlying distribution into a
+     * human-readable string format
+     */
+    std::string toString() const {
+        std::string result = tfm::format("DiscreteAliasTable[sum=%f, "
+            "normalized=%s, pdf = {", m_sum, m_normalized ? "true" : "false");
+
+        for (size_t i=0; i<m_pdf.size(); ++i) {
+            result += std::to_string(operator[](i));
+            if (i != m_pdf.size()-1)
+                result += ", ";
+        }
+        return result + "}]";
+    }
+private:
+    /// Probability of keeping an entry, and the entry used otherwise
+    struct Entry {
+        float prob;
+        uint32_t alias;
+    };
+
+    std::vector<float> m_pdf;
+    std::vector<Entry> m_table;
+    float m_sum, m_normalization;
+    bool m_normalized;
+};
+
 NORI_NAMESPACE_END
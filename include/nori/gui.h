@@ -13,10 +13,19 @@ NORI_NAMESPACE_BEGIN
 
 class NoriScreen : public nanogui::Screen {
 public:
-    NoriScreen(const ImageBlock &block);
+    /**
+     * \brief Display an image block
+     *
+     * If an accumulator is given, the block is its destination image, and
+     * tiles are displayed as soon as they are resolved. Otherwise, the
+     * contents of the block must not change.
+     */
+    NoriScreen(const ImageBlock &block, const BlockAccumulator *accumulator = nullptr);
     void draw_contents() override;
 private:
     const ImageBlock &m_block;
+    const BlockAccumulator *m_accumulator;
+    std::vector<int> m_uploaded;   ///< Number of passes of each tile that were uploaded to the texture
     nanogui::ref<nanogui::Shader> m_shader;
     nanogui::ref<nanogui::Texture> m_texture;
     nanogui::ref<nanogui::RenderPass> m_renderPass;
@@ -0,0 +1,40 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+*/
+
+#pragma once
+
+#include <nori/common.h>
+#include <istream>
+#include <memory>
+
+NORI_NAMESPACE_BEGIN
+
+class GZipStreamBuffer;
+
+/**
+ * \brief Input stream that decompresses a gzip file on the fly
+ *
+ * Decompression runs on a separate thread, which hands blocks of
+ * decompressed data to the reader through a small bounded queue. This
+ * way, inflating the file and parsing its contents overlap, and nothing
+ * is ever written to disk. Concatenated gzip members are supported.
+ *
+ * The stream can't be rewound. Errors (e.g. corrupt data) are reported
+ * by throwing a \ref NoriException from the reading function.
+ */
+class GZipInputStream : public std::istream {
+public:
+    /// Open the given file and start decompressing it
+    GZipInputStream(const std::string &filename);
+
+    /// Stop the decompression thread and close the file
+    virtual ~GZipInputStream();
+
+private:
+    std::unique_ptr<GZipStreamBuffer> m_buffer;
+};
+
+NORI_NAMESPACE_END
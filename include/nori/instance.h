@@ -0,0 +1,75 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+*/
+
+#pragma once
+
+#include <nori/mesh.h>
+#include <nori/transform.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Transformed reference to a triangle mesh
+ *
+ * Instances let a mesh appear several times in a scene without
+ * duplicating its buffers. The mesh stays in object space; the
+ * acceleration data structure transforms rays into object space and
+ * intersects them against the mesh, and \ref setHitInformation()
+ * transforms the resulting intersection back into world space.
+ *
+ * The instanced mesh is not owned by the instance and must outlive it.
+ */
+class Instance : public Shape {
+public:
+    /// Create an instance of a mesh with the given object-to-world transformation
+    Instance(const Mesh *mesh, const Transform &toWorld);
+
+    /// Compute the bounding box and area distribution (the mesh must be activated first)
+    virtual void activate();
+
+    /// Return the instanced mesh
+    const Mesh *getMesh() const { return m_mesh; }
+
+    /// Return the object-to-world transformation
+    const Transform &getTransform() const { return m_toWorld; }
+
+    /// Return the world-to-object transformation
+    const Transform &getInverseTransform() const { return m_toObject; }
+
+    bool isInstance() const { return true; }
+
+    uint32_t getPrimitiveCount() const { return m_mesh->getTriangleCount(); }
+
+    BoundingBox3f getBoundingBox(uint32_t index) const;
+
+    using Shape::getBoundingBox;
+
+    Point3f getCentroid(uint32_t index) const {
+        return m_toWorld * m_mesh->getCentroid(index);
+    }
+
+    bool rayIntersect(uint32_t index, const Ray3f &ray,
+                      float &u, float &v, float &t) const {
+        return m_mesh->rayIntersect(index, m_toObject * ray, u, v, t);
+    }
+
+    void setHitInformation(uint32_t index, const Ray3f &ray, Intersection &its) const;
+
+    float getSurfaceArea() const { return m_areaTable.getSum(); }
+
+    void samplePosition(const Point2f &sample, Point3f &p, Normal3f &n, float &pdf) const;
+
+    /// Return a human-readable summary of this instance
+    std::string toString() const;
+
+protected:
+    const Mesh *m_mesh;
+    Transform m_toWorld;
+    Transform m_toObject;
+    DiscreteAliasTable m_areaTable;  ///< Areas of the transformed triangles
+};
+
+NORI_NAMESPACE_END
@@ -6,49 +6,71 @@
 
 #pragma once
 
-#include <nori/object.h>
-#include <nori/frame.h>
-#include <nori/bbox.h>
+#include <nori/shape.h>
+#include <nori/clusters.h>
+#include <nori/dpdf.h>
+#include <half.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
 
 NORI_NAMESPACE_BEGIN
 
 /**
- * \brief Intersection data structure
+ * \brief Read-only, reference-counted vertex or index buffer
  *
- * This data structure records local information about a ray-triangle intersection.
- * This includes the position, traveled ray distance, uv coordinates, as well
- * as well as two local coordinate frames (one that corresponds to the true
- * geometry, and one that is used for shading computations).
+ * This is an Eigen matrix view whose memory is kept alive by a shared
+ * owner. Copying a buffer is cheap and makes both copies refer to the same
+ * memory, which allows several meshes to share identical geometry. To change
+ * the contents of a buffer, assign a new matrix to it.
  */
-struct Intersection {
-    /// Position of the surface intersection
-    Point3f p;
-    /// Unoccluded distance along the ray
-    float t;
-    /// UV coordinates, if any
-    Point2f uv;
-    /// Shading frame (based on the shading normal)
-    Frame shFrame;
-    /// Geometric frame (based on the true geometry)
-    Frame geoFrame;
-    /// Pointer to the associated mesh
-    const Mesh *mesh;
-
-    /// Create an uninitialized intersection record
-    Intersection() : mesh(nullptr) { }
-
-    /// Transform a direction vector into the local shading frame
-    Vector3f toLocal(const Vector3f &d) const {
-        return shFrame.toLocal(d);
+template <typename Scalar> class MeshBuffer
+    : public Eigen::Map<const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>> {
+public:
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+    typedef Eigen::Map<const Matrix> Base;
+
+    /// Create an empty buffer
+    MeshBuffer() : Base(nullptr, 0, 0) { }
+
+    /// Create a buffer that takes over the contents of a matrix
+    MeshBuffer(Matrix &&matrix) : Base(nullptr, 0, 0) {
+        std::shared_ptr<Matrix> owner = std::make_shared<Matrix>(std::move(matrix));
+        reset(owner->data(), owner->rows(), owner->cols(), owner);
     }
 
-    /// Transform a direction vector from local to world coordinates
-    Vector3f toWorld(const Vector3f &d) const {
-        return shFrame.toWorld(d);
+    /// Create a buffer that references memory kept alive by \c owner
+    MeshBuffer(const Scalar *data, Eigen::Index rows, Eigen::Index cols,
+               const std::shared_ptr<const void> &owner) : Base(nullptr, 0, 0) {
+        reset(data, rows, cols, owner);
     }
 
-    /// Return a human-readable summary of the intersection record
-    std::string toString() const;
+    /// Create another reference to the memory of an existing buffer
+    MeshBuffer(const MeshBuffer &buffer) : Base(nullptr, 0, 0) {
+        reset(buffer.data(), buffer.rows(), buffer.cols(), buffer.m_owner);
+    }
+
+    /// Release the current memory and reference that of another buffer
+    MeshBuffer &operator=(const MeshBuffer &buffer) {
+        reset(buffer.data(), buffer.rows(), buffer.cols(), buffer.m_owner);
+        return *this;
+    }
+
+    /// Return the object that keeps the referenced memory alive
+    const std::shared_ptr<const void> &getOwner() const { return m_owner; }
+
+    /// Return the size of the buffer in bytes
+    size_t getByteSize() const { return sizeof(Scalar) * (size_t) this->size(); }
+
+private:
+    void reset(const Scalar *data, Eigen::Index rows, Eigen::Index cols,
+               const std::shared_ptr<const void> &owner) {
+        /* Eigen's recommended way of changing the array referenced by a map */
+        new (static_cast<Base *>(this)) Base(data, rows, cols);
+        m_owner = owner;
+    }
+
+    std::shared_ptr<const void> m_owner;
 };
 
 /**
@@ -59,7 +81,7 @@ struct Intersection {
  * the specifics of how to create its contents (e.g. by loading from an
  * external file)
  */
-class Mesh : public NoriObject {
+class Mesh : public Shape {
 public:
     /// Release all memory
     virtual ~Mesh();
@@ -67,17 +89,60 @@ public:
     /// Initialize internal data structures (called once by the XML parser)
     virtual void activate();
 
+    /**
+     * \brief Choose a level of detail based on the size of the mesh on
+     * the screen, and release all other levels
+     *
+     * Selects the coarsest level whose simplification error, projected
+     * onto the film of the given camera, stays below \ref m_lodThreshold
+     * pixels. Meshes without levels of detail are left unchanged.
+     * Called by the scene before the acceleration data structure is built.
+     * The level is chosen once per mesh, so \ref Instance objects that
+     * refer to it all share the same level.
+     */
+    void selectLevelOfDetail(const Camera *camera);
+
     /// Return the total number of triangles in this shape
-    uint32_t getTriangleCount() const { return (uint32_t) m_F.cols(); }
+    uint32_t getTriangleCount() const {
+        /* Only one of the two index buffers is ever used */
+        return m_clusters ? m_clusters->getTriangleCount()
+                          : (uint32_t) (m_F.cols() + m_F16.cols());
+    }
 
-    /// Return the total number of vertices in this shape
+    /// Return the number of primitives (i.e. triangles)
+    uint32_t getPrimitiveCount() const { return getTriangleCount(); }
+
+    /// Return the total number of vertices in this shape (zero if it is paged)
     uint32_t getVertexCount() const { return (uint32_t) m_V.cols(); }
 
     /// Return the surface area of the given triangle
     float surfaceArea(uint32_t index) const;
 
-    //// Return an axis-aligned bounding box of the entire mesh
-    const BoundingBox3f &getBoundingBox() const { return m_bbox; }
+    /// Return the total surface area of the mesh (builds the area distribution, see \ref samplePosition())
+    float getSurfaceArea() const { return getAreaTable().getSum(); }
+
+    /**
+     * \brief Uniformly sample a position on the surface of the mesh
+     *
+     * A triangle is chosen proportionally to its area in constant time
+     * using an alias table, and the remaining sample dimension is reused
+     * to pick a point on it. The table is only built on the first call,
+     * so that meshes which are never sampled (e.g. paged out ones) don't
+     * have to visit all of their triangles.
+     *
+     * \param sample
+     *    A uniformly distributed sample on \f$[0,1]^2\f$
+     * \param p
+     *    Upon return, contains the sampled position
+     * \param n
+     *    Upon return, contains the (interpolated, if available) surface normal
+     * \param pdf
+     *    Upon return, contains the probability density of the sample
+     *    with respect to surface area (i.e. the inverse surface area)
+     */
+    void samplePosition(const Point2f &sample, Point3f &p, Normal3f &n, float &pdf) const;
+
+    using Shape::getBoundingBox;
 
     //// Return an axis-aligned bounding box containing the given triangle
     BoundingBox3f getBoundingBox(uint32_t index) const;
@@ -112,35 +177,136 @@ public:
      */
     bool rayIntersect(uint32_t index, const Ray3f &ray, float &u, float &v, float &t) const;
 
+    /**
+     * \brief Compute the position, texture coordinates and frames of an
+     * intersection from its barycentric coordinates
+     */
+    void setHitInformation(uint32_t index, const Ray3f &ray, Intersection &its) const;
+
+    /// Coverage of a triangle by the opacity mask (see \ref classifyAlphaCoverage())
+    enum EAlphaCoverage : uint8_t {
+        EOpaque = 0,  ///< No texel under the triangle is cut out
+        ETransparent, ///< All texels under the triangle are cut out
+        EPartial      ///< The opacity mask must be evaluated per hit
+    };
+
+    /// Return the coverage of the given triangle by the opacity mask (if there is one)
+    EAlphaCoverage getAlphaCoverage(uint32_t index) const {
+        return (EAlphaCoverage) m_alphaCoverage[index];
+    }
+
+    /**
+     * \brief Any-hit filter: evaluate the opacity mask at the texture
+     * coordinates interpolated from the barycentric coordinates \c u and
+     * \c v, unless the triangle is entirely opaque or transparent
+     */
+    bool isTransparent(uint32_t index, float u, float v) const;
+
+    /**
+     * \brief Ray-triangle intersection test for a known index format
+     *
+     * Like the above, but without checking how the indices are stored.
+     * Callers that intersect many triangles of the same mesh should select
+     * the index type once (see \ref hasCompactIndices()) and use this
+     * version in their inner loop. Not applicable to paged meshes.
+     */
+    template <typename Index>
+    bool rayIntersect(uint32_t index, const Ray3f &ray, float &u, float &v, float &t) const {
+        const MeshBuffer<Index> &F = getIndices<Index>();
+        return rayIntersect(m_V.col(F(0, index)), m_V.col(F(1, index)),
+                            m_V.col(F(2, index)), ray, u, v, t);
+    }
+
+    /// Ray-triangle intersection test against explicitly specified vertices
+    static bool rayIntersect(const Point3f &p0, const Point3f &p1, const Point3f &p2,
+                             const Ray3f &ray, float &u, float &v, float &t);
+
+    /**
+     * \brief Look up the positions, normals and texture coordinates of
+     * the vertices of a triangle
+     *
+     * This works for all storage modes (full precision, compact, or
+     * paged). Normals and texture coordinates are left untouched when
+     * the mesh doesn't provide them.
+     */
+    void getTriangle(uint32_t index, TriangleVertices &tri) const;
+
+    /**
+     * \brief Return the out-of-core storage of this mesh, or \c nullptr
+     * if its buffers are kept in memory
+     *
+     * When the mesh is paged, the vertex and index buffers are empty.
+     */
+    const ClusterFile *getClusterFile() const { return m_clusters.get(); }
+
     /// Return a pointer to the vertex positions
-    const MatrixXf &getVertexPositions() const { return m_V; }
+    const MeshBuffer<float> &getVertexPositions() const { return m_V; }
+
+    /**
+     * \brief Return a pointer to the vertex normals (or \c nullptr if there are none)
+     *
+     * This matrix is empty when the mesh stores its normals in compact
+     * form. Use \ref getVertexNormal() to access them in either case.
+     */
+    const MeshBuffer<float> &getVertexNormals() const { return m_N; }
 
-    /// Return a pointer to the vertex normals (or \c nullptr if there are none)
-    const MatrixXf &getVertexNormals() const { return m_N; }
+    /**
+     * \brief Return a pointer to the texture coordinates (or \c nullptr if there are none)
+     *
+     * This matrix is empty when the mesh stores its texture coordinates
+     * in compact form. Use \ref getVertexTexCoord() to access them in
+     * either case.
+     */
+    const MeshBuffer<float> &getVertexTexCoords() const { return m_UV; }
 
-    /// Return a pointer to the texture coordinates (or \c nullptr if there are none)
-    const MatrixXf &getVertexTexCoords() const { return m_UV; }
+    /// Does the mesh provide per-vertex normals?
+    bool hasVertexNormals() const {
+        return m_N.size() > 0 || m_NOct.size() > 0 || (m_clusters && m_clusters->hasNormals());
+    }
 
-    /// Return a pointer to the triangle vertex index list
-    const MatrixXu &getIndices() const { return m_F; }
+    /// Does the mesh provide per-vertex texture coordinates?
+    bool hasVertexTexCoords() const {
+        return m_UV.size() > 0 || m_UVHalf.size() > 0 || (m_clusters && m_clusters->hasTexCoords());
+    }
 
-    /// Is this mesh an area emitter?
-    bool isEmitter() const { return m_emitter != nullptr; }
+    /// Return the normal of the given vertex (decoding it if necessary)
+    Normal3f getVertexNormal(uint32_t index) const {
+        if (m_NOct.size() > 0)
+            return decodeOctahedral(m_NOct(0, index));
+        return m_N.col(index);
+    }
 
-    /// Return a pointer to an attached area emitter instance
-    Emitter *getEmitter() { return m_emitter; }
+    /// Return the texture coordinates of the given vertex (decoding them if necessary)
+    Point2f getVertexTexCoord(uint32_t index) const {
+        if (m_UVHalf.size() > 0) {
+            half u, v;
+            u.setBits(m_UVHalf(0, index));
+            v.setBits(m_UVHalf(1, index));
+            return Point2f((float) u, (float) v);
+        }
+        return m_UV.col(index);
+    }
 
-    /// Return a pointer to an attached area emitter instance (const version)
-    const Emitter *getEmitter() const { return m_emitter; }
+    /// Are vertex normals and texture coordinates stored in compact form?
+    bool hasCompactAttributes() const { return m_NOct.size() > 0 || m_UVHalf.size() > 0; }
 
-    /// Return a pointer to the BSDF associated with this mesh
-    const BSDF *getBSDF() const { return m_bsdf; }
+    /**
+     * \brief Return the triangle vertex index list in the given format
+     *
+     * Meshes with at most 65536 vertices store their indices using 16
+     * bits. \c Index must therefore be \c uint16_t if \ref
+     * hasCompactIndices() is \c true, and \c uint32_t otherwise; the
+     * other buffer is empty. \ref getVertexIndex() works for both.
+     */
+    template <typename Index> const MeshBuffer<Index> &getIndices() const;
 
-    /// Register a child object (e.g. a BSDF) with the mesh
-    virtual void addChild(NoriObject *child);
+    /// Are the triangle vertex indices stored using 16 bits?
+    bool hasCompactIndices() const { return m_F16.size() > 0; }
 
-    /// Return the name of this mesh
-    const std::string &getName() const { return m_name; }
+    /// Return the index of vertex \c k (0..2) of the given triangle
+    uint32_t getVertexIndex(uint32_t index, int k) const {
+        return hasCompactIndices() ? (uint32_t) m_F16(k, index) : m_F(k, index);
+    }
 
     /// Return a human-readable summary of this instance
     std::string toString() const;
@@ -155,15 +321,218 @@ protected:
     /// Create an empty mesh
     Mesh();
 
+    /**
+     * \brief Convert the vertex normals and texture coordinates into
+     * their compact representation
+     *
+     * Normals are octahedral-encoded into 32 bits, and texture coordinates
+     * are converted to half precision. The full-precision buffers are
+     * released afterwards.
+     *
+     * \return The number of bytes that were saved
+     */
+    size_t compactAttributes();
+
+    /**
+     * \brief Improve the memory locality of the mesh
+     *
+     * Sorts the triangles along a Morton (Z-order) curve through their
+     * centroids, and renumbers the vertices in the order in which the
+     * sorted triangles first reference them. Unreferenced vertices are
+     * moved to the end.
+     */
+    void reorderTriangles();
+
+    /**
+     * \brief Remove redundant geometry
+     *
+     * Welds vertices that are at most \ref m_weldTolerance apart and have
+     * the same normal and texture coordinates, then removes degenerate
+     * triangles (repeated vertices or zero area) and triangles that repeat
+     * an earlier one. Vertices that are no longer referenced are released.
+     *
+     * \param welded
+     *    Upon return, contains the number of merged vertices
+     * \param degenerate
+     *    Upon return, contains the number of removed degenerate triangles
+     * \param duplicate
+     *    Upon return, contains the number of removed duplicate triangles
+     */
+    void cleanup(uint32_t &welded, uint32_t &degenerate, uint32_t &duplicate);
+
+    /**
+     * \brief Build a chain of up to \ref m_lodLevels levels of detail
+     *
+     * Every level has about half as many triangles as the previous one
+     * and is produced by simplifying the mesh with the quadric error
+     * metric (see \ref MeshSimplifier). The current buffers remain the
+     * finest level.
+     */
+    void buildLevelsOfDetail();
+
+    /**
+     * \brief Final preprocessing steps of \ref activate(): reorder and
+     * compact the buffers or page them out
+     */
+    void preprocess();
+
+    /// Return the triangle area distribution, which is built on first use (thread-safe)
+    const DiscreteAliasTable &getAreaTable() const;
+
+    /**
+     * \brief Determine which triangles are entirely opaque or transparent
+     * under the opacity mask, so that their hits don't need a lookup
+     *
+     * Scans the texels in the texture-space bounding box of every
+     * triangle. Triangles that cover many texels are assumed to be
+     * partially transparent.
+     */
+    void classifyAlphaCoverage();
+
+    /**
+     * \brief Convert the triangle indices to 16 bits if there are at
+     * most 65536 vertices
+     *
+     * \return The number of bytes that were saved
+     */
+    size_t compactIndices();
+
+    /**
+     * \brief Adopt the buffers of a previously loaded mesh with the same
+     * geometry key (see \ref GeometryCache)
+     *
+     * \return \c true upon success. In this case, the caller can skip
+     *    loading the mesh, and \ref activate() will not modify the buffers.
+     */
+    bool lookupGeometry(const std::string &key);
+
+    /**
+     * \brief Move the triangles into the cluster file \ref m_clusterFilename
+     * and release the in-memory buffers (see \ref ClusterFile)
+     */
+    void pageOut();
+
 protected:
-    std::string m_name;                  ///< Identifying name
-    MatrixXf      m_V;                   ///< Vertex positions
-    MatrixXf      m_N;                   ///< Vertex normals
-    MatrixXf      m_UV;                  ///< Vertex texture coordinates
-    MatrixXu      m_F;                   ///< Faces
-    BSDF         *m_bsdf = nullptr;      ///< BSDF of the surface
-    Emitter    *m_emitter = nullptr;     ///< Associated emitter, if any
-    BoundingBox3f m_bbox;                ///< Bounding box of the mesh
+    /// Simplified version of a mesh (see \ref buildLevelsOfDetail())
+    struct LevelOfDetail {
+        MeshBuffer<float> V, N, UV;
+        MeshBuffer<uint32_t> F;
+        float error;  ///< Largest RMS error of any collapse in world units (see \ref MeshSimplifier::getError())
+    };
+
+    MeshBuffer<float>    m_V;            ///< Vertex positions
+    MeshBuffer<float>    m_N;            ///< Vertex normals
+    MeshBuffer<float>    m_UV;           ///< Vertex texture coordinates
+    MeshBuffer<uint32_t> m_NOct;         ///< Octahedral-encoded vertex normals (compact form)
+    MeshBuffer<uint16_t> m_UVHalf;       ///< Half precision texture coordinates (compact form)
+    MeshBuffer<uint32_t> m_F;            ///< Faces
+    MeshBuffer<uint16_t> m_F16;          ///< Faces with 16-bit indices (replaces \ref m_F if set)
+    bool          m_compact = false;     ///< Convert attributes to compact form in \ref activate()?
+    bool          m_reorder = false;     ///< Sort triangles and vertices in \ref activate()?
+    bool          m_cleanup = false;     ///< Weld vertices and remove redundant triangles in \ref activate()?
+    float         m_weldTolerance = 0.0f; ///< Maximum distance of welded vertices (see \ref cleanup())
+    int           m_lodLevels = 1;       ///< Number of levels of detail to build in \ref activate()
+    float         m_lodThreshold = 1.0f; ///< Largest simplification error on the screen (in pixels)
+    std::vector<LevelOfDetail> m_levels; ///< Coarser levels awaiting \ref selectLevelOfDetail()
+    std::string   m_geometryKey;         ///< Key of this mesh in the \ref GeometryCache (if any)
+    bool          m_sharedGeometry = false; ///< Were the buffers adopted from another mesh?
+    bool          m_mappedGeometry = false; ///< Do the buffers point into a memory-mapped file?
+    std::string   m_clusterFilename;     ///< Page the mesh out to this file in \ref activate() (if set)
+    size_t        m_clusterSize = 65536; ///< Cluster size used by \ref pageOut()
+    std::unique_ptr<ClusterFile> m_clusters; ///< Out-of-core storage (if any)
+    mutable DiscreteAliasTable m_areaTable; ///< Triangle area distribution (see \ref getAreaTable())
+    mutable std::atomic<bool> m_areaTableReady { false };
+    mutable std::mutex m_areaTableMutex;
+    std::vector<uint8_t> m_alphaCoverage; ///< Coverage of each triangle by the opacity mask (see \ref EAlphaCoverage)
+
+    friend class GeometryCache;
+};
+
+template <> inline const MeshBuffer<uint16_t> &Mesh::getIndices<uint16_t>() const { return m_F16; }
+template <> inline const MeshBuffer<uint32_t> &Mesh::getIndices<uint32_t>() const { return m_F; }
+
+/**
+ * \brief Process-wide cache of mesh geometry
+ *
+ * Meshes that are loaded from the same file with the same transformation
+ * (and the same load-time options) share their vertex and index buffers.
+ * Loaders compute a key using \ref makeKey(), and then call
+ * \ref Mesh::lookupGeometry() before parsing the file. The mesh publishes
+ * its buffers at the end of \ref Mesh::activate().
+ *
+ * The cache only holds weak references, hence geometry is released as soon
+ * as the last mesh using it is destroyed.
+ *
+ * Optionally, the cache also shares geometry with other processes on the
+ * same machine (see \ref setSharedDirectory()). The first process to
+ * finish a mesh writes its buffers into a file in a shared directory
+ * (e.g. <tt>/dev/shm</tt>), and all processes map that file read-only in
+ * place of their own buffers. The files outlive the processes, so that
+ * later renders attach to them right away. When a geometry file changes,
+ * the file of the new version replaces that of the old one, hence the
+ * directory holds at most one file per geometry file, transformation and
+ * set of loader options.
+ */
+class GeometryCache {
+public:
+    /**
+     * \brief Create a cache key from the resolved path of a geometry file,
+     * its object-to-world transformation, and any further loader options
+     * that affect the contents of the buffers
+     *
+     * The key ends with the version of the file (see \ref fileVersion()),
+     * so that changed files are loaded again.
+     */
+    static std::string makeKey(const filesystem::path &filename,
+                               const Transform &trafo,
+                               const std::string &options = "");
+
+    /**
+     * \brief Share geometry with other processes through files in the
+     * given directory, or stop sharing it (if \c directory is empty)
+     *
+     * A RAM-backed directory such as <tt>/dev/shm</tt> avoids disk I/O.
+     * Only supported on POSIX systems.
+     */
+    static void setSharedDirectory(const std::string &directory);
+
+    /**
+     * \brief Store the buffers of a mesh under the given key
+     *
+     * When sharing is enabled, the buffers are first published to other
+     * processes, and the mesh then refers to the shared copy.
+     */
+    static void put(const std::string &key, Mesh *mesh);
+
+    /**
+     * \brief Copy the buffers stored under the given key into \c mesh
+     *
+     * When sharing is enabled, geometry published by other processes is
+     * found as well.
+     *
+     * \return \c false if there is no entry or if it has expired
+     */
+    static bool get(const std::string &key, Mesh *mesh);
+
+private:
+    /// Store weak references to the buffers of a mesh under the given key
+    static void store(const std::string &key, const Mesh *mesh);
+
+    /**
+     * \brief Map the shared geometry file of the given key (if there is
+     * one) and make the buffers of \c mesh refer to it
+     */
+    static bool attachShared(const std::string &key, Mesh *mesh);
+
+    /**
+     * \brief Write the buffers of a mesh into its shared geometry file
+     *
+     * The file is first written under a temporary name and then linked
+     * into place, so that other processes never observe partial files.
+     * When another process published the same geometry in the meantime,
+     * its file is kept, while the file of a superseded version is replaced.
+     */
+    static void publishShared(const std::string &key, const Mesh *mesh);
 };
 
 NORI_NAMESPACE_END
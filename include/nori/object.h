@@ -21,6 +21,7 @@ public:
     enum EClassType {
         EScene = 0,
         EMesh,
+        EShape,
         EBSDF,
         EPhaseFunction,
         EEmitter,
@@ -80,6 +81,7 @@ public:
         switch (type) {
             case EScene:      return "scene";
             case EMesh:       return "mesh";
+            case EShape:      return "shape";
             case EBSDF:       return "bsdf";
             case EEmitter:    return "emitter";
             case ECamera:     return "camera";
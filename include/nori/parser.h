@@ -16,4 +16,14 @@ NORI_NAMESPACE_BEGIN
  */
 extern NoriObject *loadFromXML(const std::string &filename);
 
+/**
+ * \brief Return the resources (e.g. meshes or textures) referenced by a
+ * scene file
+ *
+ * These are the \c string properties that name existing files, which
+ * are looked up using the file resolver like the objects loading them
+ * do. This is used to detect changes to scenes that remain loaded.
+ */
+extern std::vector<std::string> findReferencedFiles(const std::string &filename);
+
 NORI_NAMESPACE_END
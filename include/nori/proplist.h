@@ -20,6 +20,9 @@ class PropertyList {
 public:
     PropertyList() { }
 
+    /// Check whether a property of any type exists
+    bool has(const std::string &name) const { return m_properties.find(name) != m_properties.end(); }
+
     /// Set a boolean property
     void setBoolean(const std::string &name, const bool &value);
     
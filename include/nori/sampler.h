@@ -62,8 +62,13 @@ public:
      * a new image block. This can be used to deterministically
      * initialize the sampler so that repeated program runs
      * always create the same image.
+     *
+     * \param pass
+     *      Index of the rendering pass. When rendering progressively,
+     *      every block is rendered once per pass, and each pass must
+     *      produce different samples.
      */
-    virtual void prepare(const ImageBlock &block) = 0;
+    virtual void prepare(const ImageBlock &block, uint32_t pass) = 0;
 
     /**
      * \brief Prepare to generate new samples
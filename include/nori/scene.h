@@ -37,6 +37,14 @@ public:
     /// Return a pointer to the scene's camera
     const Camera *getCamera() const { return m_camera; }
 
+    /**
+     * \brief Replace the scene's camera (e.g. by a copy with other
+     * properties, see \ref Camera::clone())
+     *
+     * \return The previous camera, which is now owned by the caller
+     */
+    Camera *setCamera(Camera *camera) { std::swap(camera, m_camera); return camera; }
+
     /// Return a pointer to the scene's sample generator (const version)
     const Sampler *getSampler() const { return m_sampler; }
 
@@ -46,6 +54,9 @@ public:
     /// Return a reference to an array containing all meshes
     const std::vector<Mesh *> &getMeshes() const { return m_meshes; }
 
+    /// Return a reference to an array containing all shapes (including meshes)
+    const std::vector<Shape *> &getShapes() const { return m_shapes; }
+
     /**
      * \brief Intersect a ray against all triangles stored in the scene
      * and return detailed intersection information
@@ -97,7 +108,7 @@ public:
      */
     void activate();
 
-    /// Add a child object to the scene (meshes, integrators etc.)
+    /// Add a child object to the scene (shapes, integrators etc.)
     void addChild(NoriObject *obj);
 
     /// Return a string summary of the scene (for debugging purposes)
@@ -105,7 +116,12 @@ public:
 
     EClassType getClassType() const { return EScene; }
 private:
+    /// Register a shape (or the elements of a compound shape) for rendering
+    void addShape(Shape *shape);
+
     std::vector<Mesh *> m_meshes;
+    std::vector<Shape *> m_shapes;
+    std::vector<Shape *> m_children; ///< Shapes owned by the scene (compound ones own their elements)
     Integrator *m_integrator = nullptr;
     Sampler *m_sampler = nullptr;
     Camera *m_camera = nullptr;
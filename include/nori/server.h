@@ -0,0 +1,83 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+*/
+
+/* =======================================================================
+     This file contains a render server, which receives render jobs from
+     clients over a Unix-domain socket and renders them one at a time.
+ * ======================================================================= */
+
+#pragma once
+
+#include <nori/proplist.h>
+#include <functional>
+
+NORI_NAMESPACE_BEGIN
+
+/// Render job submitted to a \ref RenderServer
+struct RenderJob {
+    uint32_t id = 0;              ///< Unique number of the job
+    std::string scene;            ///< Path of the scene file
+    std::string output;           ///< Name of the output files (empty: next to the scene)
+    uint32_t sampleCount = 0;     ///< Samples per pixel (0: use the sampler's count)
+    int priority = 0;             ///< Jobs with a higher priority are rendered first
+    bool overrideCamera = false;  ///< Render with a modified camera?
+    PropertyList camera;          ///< Overridden camera properties (see \ref Camera::clone())
+};
+
+/**
+ * \brief Server that renders the jobs submitted by its clients
+ *
+ * Clients connect to a Unix-domain socket and send requests, one per line:
+ *
+ * <tt>render scene=PATH [output=PATH] [spp=N] [priority=N] [width=N]
+ * [height=N] [fov=DEGREES] [origin=X,Y,Z] [target=X,Y,Z] [up=X,Y,Z]</tt>
+ *    Queue a render job. Paths must not contain spaces; relative paths
+ *    are resolved against the working directory of the server. The
+ *    camera can be moved using the parameters of the \c lookat tag of
+ *    scene files, which replace the lookat of the scene's camera while
+ *    keeping the transformations that precede it (see \ref Camera::clone()).
+ *
+ * <tt>status</tt>
+ *    Report the running job and the number of queued jobs.
+ *
+ * <tt>shutdown</tt>
+ *    Finish the running job, drop the queued ones, and exit.
+ *
+ * The server replies with lines of the form <tt>queued ID POSITION</tt>,
+ * <tt>started ID</tt>, <tt>progress ID PERCENT</tt>, <tt>done ID FILE
+ * SECONDS</tt>, <tt>failed ID MESSAGE</tt>, <tt>status RUNNING QUEUED</tt>,
+ * and <tt>error MESSAGE</tt> (for malformed requests). Replies about a job
+ * are sent to the connection that submitted it. Jobs are rendered in the
+ * order of their priority, and in the order of submission otherwise.
+ */
+class RenderServer {
+public:
+    /// Report the progress of the running job (between 0 and 1)
+    typedef std::function<void (float)> ProgressFunction;
+
+    /// Render a job and return the name of the written image
+    typedef std::function<std::string (const RenderJob &, const ProgressFunction &)> RenderFunction;
+
+    /// Start listening on the Unix-domain socket with the given path
+    RenderServer(const std::string &path);
+
+    /// Stop listening and remove the socket
+    ~RenderServer();
+
+    /**
+     * \brief Accept connections and render the submitted jobs one after
+     * another until a client requests a shutdown
+     *
+     * The jobs are rendered on the calling thread.
+     */
+    void run(const RenderFunction &renderFunction);
+
+private:
+    std::string m_path;
+    int m_socket = -1;
+};
+
+NORI_NAMESPACE_END
@@ -0,0 +1,226 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+*/
+
+#pragma once
+
+#include <nori/object.h>
+#include <nori/frame.h>
+#include <nori/bbox.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Intersection data structure
+ *
+ * This data structure records local information about a ray-surface intersection.
+ * This includes the position, traveled ray distance, uv coordinates, as well
+ * as well as two local coordinate frames (one that corresponds to the true
+ * geometry, and one that is used for shading computations).
+ */
+struct Intersection {
+    /// Position of the surface intersection
+    Point3f p;
+    /// Unoccluded distance along the ray
+    float t;
+    /// UV coordinates, if any
+    Point2f uv;
+    /// Shading frame (based on the shading normal)
+    Frame shFrame;
+    /// Geometric frame (based on the true geometry)
+    Frame geoFrame;
+    union {
+        /// Pointer to the associated shape
+        const Shape *shape;
+        /// Deprecated name of \ref shape (kept for existing integrators)
+        const Shape *mesh;
+    };
+
+    /// Create an uninitialized intersection record
+    Intersection() : shape(nullptr) { }
+
+    /// Transform a direction vector into the local shading frame
+    Vector3f toLocal(const Vector3f &d) const {
+        return shFrame.toLocal(d);
+    }
+
+    /// Transform a direction vector from local to world coordinates
+    Vector3f toWorld(const Vector3f &d) const {
+        return shFrame.toWorld(d);
+    }
+
+    /// Return a human-readable summary of the intersection record
+    std::string toString() const;
+};
+
+/**
+ * \brief Base class of all geometric primitives
+ *
+ * A shape consists of one or more primitives (e.g. the triangles of a
+ * \ref Mesh, or a single analytic sphere) that are registered with the
+ * acceleration data structure. Shapes also carry the BSDF and (optional)
+ * area emitter of the surface.
+ */
+class Shape : public NoriObject {
+public:
+    /// Release all memory
+    virtual ~Shape();
+
+    /// Initialize internal data structures (called once by the XML parser)
+    virtual void activate();
+
+    /// Return the number of primitives (e.g. triangles) of this shape
+    virtual uint32_t getPrimitiveCount() const = 0;
+
+    //// Return an axis-aligned bounding box of the entire shape
+    const BoundingBox3f &getBoundingBox() const { return m_bbox; }
+
+    //// Return an axis-aligned bounding box containing the given primitive
+    virtual BoundingBox3f getBoundingBox(uint32_t index) const = 0;
+
+    //// Return the centroid of the given primitive
+    virtual Point3f getCentroid(uint32_t index) const = 0;
+
+    /**
+     * \brief Ray-primitive intersection test
+     *
+     * \param index
+     *    Index of the primitive that should be intersected
+     * \param ray
+     *    The ray segment to be used for the intersection query
+     * \param u, v
+     *    Upon success, contain primitive-specific coordinates of the
+     *    intersection that are passed on to \ref setHitInformation()
+     * \param t
+     *    Upon success, \a t contains the distance from the ray origin to the
+     *    intersection point
+     * \return
+     *   \c true if an intersection has been detected
+     */
+    virtual bool rayIntersect(uint32_t index, const Ray3f &ray,
+                              float &u, float &v, float &t) const = 0;
+
+    /**
+     * \brief Compute the remaining properties of an intersection
+     *
+     * Called once for the closest intersection found along a ray. When it
+     * is invoked, <tt>its.t</tt> holds the distance, and <tt>its.uv</tt>
+     * holds the \c u and \c v values returned by \ref rayIntersect().
+     * Fills in the position, texture coordinates and frames.
+     */
+    virtual void setHitInformation(uint32_t index, const Ray3f &ray,
+                                   Intersection &its) const = 0;
+
+    /// Does the shape have an opacity mask that cuts out parts of its surface?
+    bool hasAlphaMask() const { return !m_alphaMask.empty(); }
+
+    /**
+     * \brief Any-hit filter: is a candidate intersection cut out by the
+     * opacity mask?
+     *
+     * Called by the acceleration data structure for every intersection
+     * found on a shape with an opacity mask (see \ref hasAlphaMask()),
+     * which continues its search past transparent hits. The \c u and \c v
+     * values are those returned by \ref rayIntersect(). The default
+     * implementation uses them as texture coordinates.
+     */
+    virtual bool isTransparent(uint32_t index, float u, float v) const {
+        return isCutout(Point2f(u, v));
+    }
+
+    /// Return the total surface area of the shape
+    virtual float getSurfaceArea() const = 0;
+
+    /**
+     * \brief Uniformly sample a position on the surface of the shape
+     *
+     * \param sample
+     *    A uniformly distributed sample on \f$[0,1]^2\f$
+     * \param p
+     *    Upon return, contains the sampled position
+     * \param n
+     *    Upon return, contains the surface normal at \c p
+     * \param pdf
+     *    Upon return, contains the probability density of the sample
+     *    with respect to surface area
+     */
+    virtual void samplePosition(const Point2f &sample, Point3f &p,
+                                Normal3f &n, float &pdf) const = 0;
+
+    /// Is this shape an area emitter?
+    bool isEmitter() const { return m_emitter != nullptr; }
+
+    /// Return a pointer to an attached area emitter instance
+    Emitter *getEmitter() { return m_emitter; }
+
+    /// Return a pointer to an attached area emitter instance (const version)
+    const Emitter *getEmitter() const { return m_emitter; }
+
+    /// Return a pointer to the BSDF associated with this shape
+    const BSDF *getBSDF() const { return m_bsdf; }
+
+    /// Register a child object (e.g. a BSDF) with the shape
+    virtual void addChild(NoriObject *child);
+
+    /**
+     * \brief Does this shape consist of several other shapes?
+     *
+     * Compound shapes (e.g. the contents of a scene file) aren't
+     * intersected themselves. Instead, the scene registers their
+     * elements, which are returned by \ref getElement().
+     */
+    virtual bool isCompound() const { return false; }
+
+    /// Return an element of a compound shape (or \c nullptr past the last one)
+    virtual Shape *getElement(size_t index) { return nullptr; }
+
+    /// Is this shape a transformed reference to a mesh (see \ref Instance)?
+    virtual bool isInstance() const { return false; }
+
+    /// Return the name of this shape
+    const std::string &getName() const { return m_name; }
+
+    /**
+     * \brief Return the type of object (i.e. Mesh/BSDF/etc.)
+     * provided by this instance
+     * */
+    EClassType getClassType() const { return EShape; }
+
+protected:
+    /**
+     * \brief Load the opacity mask specified by the \c alphaMask property
+     * (the filename of an OpenEXR image), if any
+     *
+     * Texels whose luminance is below the \c alphaThreshold property
+     * (0.5 by default) are cut out. Only the result of this comparison
+     * is kept.
+     */
+    void loadAlphaMask(const PropertyList &propList);
+
+    /// Is the opacity mask texel at the given texture coordinates cut out?
+    bool isCutout(const Point2f &uv) const {
+        return isCutout((int) std::floor(uv.x() * m_alphaMaskSize.x()),
+                        (int) std::floor((1.0f - uv.y()) * m_alphaMaskSize.y()));
+    }
+
+    /// Is the opacity mask texel in the given column and row cut out? (the mask repeats)
+    bool isCutout(int x, int y) const {
+        int w = m_alphaMaskSize.x(), h = m_alphaMaskSize.y();
+        x %= w; y %= h;
+        if (x < 0) x += w;
+        if (y < 0) y += h;
+        return m_alphaMask[(size_t) y * w + x] != 0;
+    }
+
+protected:
+    std::string   m_name;                ///< Identifying name
+    BSDF         *m_bsdf = nullptr;      ///< BSDF of the surface
+    Emitter      *m_emitter = nullptr;   ///< Associated emitter, if any
+    BoundingBox3f m_bbox;                ///< Bounding box of the shape
+    std::vector<uint8_t> m_alphaMask;    ///< Cut-out texels of the opacity mask (row-major)
+    Vector2i      m_alphaMaskSize;       ///< Resolution of the opacity mask
+};
+
+NORI_NAMESPACE_END
@@ -0,0 +1,100 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+*/
+
+#pragma once
+
+#include <nori/mesh.h>
+#include <array>
+#include <queue>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Triangle mesh simplification using the quadric error metric
+ *
+ * Implements the edge collapse algorithm by Garland and Heckbert
+ * ("Surface Simplification Using Quadric Error Metrics", SIGGRAPH 1997).
+ * Every vertex accumulates the planes of its adjacent triangles in a
+ * quadric, and the edge whose collapse moves the merged vertex the least
+ * with respect to these planes is collapsed first. Open boundaries
+ * (including the seams of split normals or texture coordinates) are
+ * preserved with additional perpendicular planes, and collapses that
+ * would flip a triangle or create non-manifold edges are rejected.
+ *
+ * Simplification can be resumed with successively smaller targets to
+ * produce a level-of-detail chain in a single pass.
+ */
+class MeshSimplifier {
+public:
+    /// Prepare the simplification of the given mesh (its buffers must be in memory)
+    MeshSimplifier(const Mesh *mesh);
+
+    /// Collapse edges until at most \c targetCount triangles remain
+    void simplify(uint32_t targetCount);
+
+    /// Return the number of remaining triangles
+    uint32_t getTriangleCount() const { return m_triangleCount; }
+
+    /**
+     * \brief Return the largest error of any collapse so far
+     *
+     * The error of a collapse is the RMS distance of the merged vertex to
+     * the planes of the original triangles around it (in world units).
+     */
+    float getError() const { return m_error; }
+
+    /// Copy the simplified mesh into compact vertex and index buffers
+    void extract(MatrixXf &V, MatrixXf &N, MatrixXf &UV, MatrixXu &F) const;
+
+private:
+    /// Symmetric 4x4 matrix storing a sum of squared plane distances
+    struct Quadric {
+        double a[10];    ///< Upper triangle of the matrix
+        double weight;   ///< Total weight of the planes
+
+        Quadric() { memset(this, 0, sizeof(Quadric)); }
+        Quadric(const Vector3d &n, double d, double weight);
+        Quadric &operator+=(const Quadric &q);
+        double evaluate(const Vector3d &p) const;
+    };
+
+    /// Proposed collapse of the edge between two vertices
+    struct Collapse {
+        double cost;
+        uint32_t v0, v1;
+        uint32_t stamp0, stamp1;  ///< Vertex versions (detect outdated entries)
+        Vector3d target;
+
+        bool operator<(const Collapse &c) const { return cost > c.cost; }
+    };
+
+    /// Compute the optimal collapse of an edge and queue it
+    void addCollapse(uint32_t v0, uint32_t v1);
+
+    /// Check whether a collapse keeps the mesh manifold and doesn't flip triangles
+    bool isValid(const Collapse &collapse) const;
+
+    /// Perform a collapse (merging \c v1 into \c v0)
+    void perform(const Collapse &collapse);
+
+    /// Append the neighbors of a vertex to \c result
+    void getNeighbors(uint32_t v, std::vector<uint32_t> &result) const;
+
+private:
+    std::vector<Vector3d> m_position;
+    std::vector<Normal3f> m_normal;
+    std::vector<Point2f> m_texcoord;
+    std::vector<Quadric> m_quadric;
+    std::vector<uint32_t> m_version;
+    std::vector<std::vector<uint32_t>> m_vertexFaces;
+    std::vector<std::array<uint32_t, 3>> m_faces;
+    std::vector<bool> m_faceRemoved;
+    std::priority_queue<Collapse> m_queue;
+    uint32_t m_triangleCount;
+    float m_error = 0.0f;
+};
+
+NORI_NAMESPACE_END
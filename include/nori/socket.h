@@ -0,0 +1,45 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+*/
+
+/* =======================================================================
+     This file contains helper functions for stream sockets, which are
+     used by the distributed renderer and the render server.
+ * ======================================================================= */
+
+#pragma once
+
+#include <nori/common.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Create a socket for the given address
+ *
+ * Addresses are either of the form <tt>unix:/path/to/socket</tt> for
+ * Unix-domain sockets, or <tt>host:port</tt> for TCP sockets.
+ *
+ * If \c server is \c true, the socket is bound to the address and
+ * listens (an existing Unix-domain socket file is replaced). Otherwise,
+ * it is connected to the address; -1 is returned if there is nobody
+ * listening (yet). Only supported on POSIX systems.
+ */
+extern int openSocket(const std::string &address, bool server);
+
+/**
+ * \brief Accept a connection on a listening socket
+ *
+ * Like \ref openSocket(), the connection doesn't raise \c SIGPIPE when
+ * the other side disconnects. Returns -1 upon failure.
+ */
+extern int acceptSocket(int fd);
+
+/// Send a buffer over a socket. Returns \c false if the connection was lost.
+extern bool sendAll(int fd, const void *data, size_t size);
+
+/// Receive a buffer from a socket. Returns \c false if the connection was lost.
+extern bool recvAll(int fd, void *data, size_t size);
+
+NORI_NAMESPACE_END
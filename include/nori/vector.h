@@ -154,4 +154,30 @@ public:
 /// Complete the set {a} to an orthonormal base
 extern void coordinateSystem(const Vector3f &a, Vector3f &b, Vector3f &c);
 
+/**
+ * \brief Encode a unit vector into 32 bits using an octahedral mapping
+ *
+ * The direction is projected onto the octahedron |x|+|y|+|z|=1, whose
+ * lower half is folded over the upper one. The two remaining coordinates
+ * are stored as 16-bit signed normalized integers.
+ */
+extern uint32_t encodeOctahedral(const Vector3f &v);
+
+/// Decode a unit vector that was previously encoded using \ref encodeOctahedral()
+inline Vector3f decodeOctahedral(uint32_t value) {
+    Vector3f v(
+        (int16_t) (value & 0xFFFF) * (1.0f / 32767.0f),
+        (int16_t) (value >> 16) * (1.0f / 32767.0f),
+        0.0f
+    );
+    v.z() = 1.0f - std::abs(v.x()) - std::abs(v.y());
+
+    /* Unfold the lower hemisphere */
+    float t = std::max(-v.z(), 0.0f);
+    v.x() += v.x() >= 0.0f ? -t : t;
+    v.y() += v.y() >= 0.0f ? -t : t;
+
+    return v.normalized();
+}
+
 NORI_NAMESPACE_END
@@ -0,0 +1,214 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+*/
+
+/* =======================================================================
+     This file contains the building blocks of wavefront integrators,
+     which process many paths at once in a sequence of separate stages.
+ * ======================================================================= */
+
+#pragma once
+
+#include <nori/integrator.h>
+#include <nori/color.h>
+#include <nori/ray.h>
+#include <pcg32.h>
+#include <atomic>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Structure-of-arrays queue of rays
+ *
+ * Each ray belongs to one of the paths of the current wave. The queue
+ * is filled concurrently by reserving contiguous ranges of entries.
+ */
+struct RayQueue {
+    std::vector<float> ox, oy, oz;   ///< Ray origins
+    std::vector<float> dx, dy, dz;   ///< Ray directions
+    std::vector<uint32_t> path;      ///< Index of the associated path state
+    std::atomic<uint32_t> size { 0 };
+
+    /// Allocate space for the given number of rays
+    void allocate(uint32_t capacity) {
+        for (auto *v : { &ox, &oy, &oz, &dx, &dy, &dz })
+            v->resize(capacity);
+        path.resize(capacity);
+    }
+
+    /// Reserve \c count consecutive entries and return the index of the first one
+    uint32_t reserve(uint32_t count) { return size.fetch_add(count, std::memory_order_relaxed); }
+
+    /// Store a ray in the given entry
+    void set(uint32_t i, const Ray3f &ray, uint32_t pathIndex) {
+        ox[i] = ray.o.x(); oy[i] = ray.o.y(); oz[i] = ray.o.z();
+        dx[i] = ray.d.x(); dy[i] = ray.d.y(); dz[i] = ray.d.z();
+        path[i] = pathIndex;
+    }
+
+    /// Exchange the contents with another queue (not thread-safe)
+    void swap(RayQueue &other) {
+        ox.swap(other.ox); oy.swap(other.oy); oz.swap(other.oz);
+        dx.swap(other.dx); dy.swap(other.dy); dz.swap(other.dz);
+        path.swap(other.path);
+        size = other.size.exchange(size);
+    }
+
+    /// Return the ray stored in the given entry
+    Ray3f getRay(uint32_t i) const {
+        return Ray3f(Point3f(ox[i], oy[i], oz[i]), Vector3f(dx[i], dy[i], dz[i]));
+    }
+};
+
+/**
+ * \brief Structure-of-arrays queue of shadow rays
+ *
+ * In addition to the ray, each entry stores the contribution that is
+ * added to the radiance of the path if the ray is unoccluded.
+ */
+struct ShadowQueue : public RayQueue {
+    std::vector<float> maxt;          ///< Maximum extent of the rays
+    std::vector<float> cr, cg, cb;    ///< Unoccluded contributions
+
+    /// Allocate space for the given number of rays
+    void allocate(uint32_t capacity) {
+        RayQueue::allocate(capacity);
+        for (auto *v : { &maxt, &cr, &cg, &cb })
+            v->resize(capacity);
+    }
+
+    /// Store a shadow ray and its contribution in the given entry
+    void set(uint32_t i, const Ray3f &ray, const Color3f &contrib, uint32_t pathIndex) {
+        RayQueue::set(i, ray, pathIndex);
+        maxt[i] = ray.maxt;
+        cr[i] = contrib.r(); cg[i] = contrib.g(); cb[i] = contrib.b();
+    }
+};
+
+/**
+ * \brief Closest-hit information of the rays of a \ref RayQueue
+ *
+ * Only the data needed for shading is kept: the hit position, the
+ * shading normal, and the shape (\c nullptr if the ray escaped).
+ */
+struct HitQueue {
+    std::vector<float> px, py, pz;   ///< Hit positions
+    std::vector<float> nx, ny, nz;   ///< Shading normals
+    std::vector<const Shape *> shape;
+
+    /// Allocate space for the given number of hits
+    void allocate(uint32_t capacity) {
+        for (auto *v : { &px, &py, &pz, &nx, &ny, &nz })
+            v->resize(capacity);
+        shape.resize(capacity);
+    }
+};
+
+/**
+ * \brief Structure-of-arrays state of the paths of a wave
+ *
+ * Every path corresponds to one pixel sample, and carries its own random
+ * number generator so that the result doesn't depend on the scheduling.
+ */
+struct PathStates {
+    std::vector<float> sx, sy;       ///< Position of the pixel sample
+    std::vector<float> tr, tg, tb;   ///< Throughput
+    std::vector<float> lr, lg, lb;   ///< Accumulated radiance
+    std::vector<uint16_t> depth;     ///< Number of scattering events so far
+    std::vector<uint8_t> specular;   ///< Was the last scattering event specular?
+    std::vector<pcg32> random;
+
+    /// Allocate space for the given number of paths
+    void allocate(uint32_t capacity) {
+        for (auto *v : { &sx, &sy, &tr, &tg, &tb, &lr, &lg, &lb })
+            v->resize(capacity);
+        depth.resize(capacity);
+        specular.resize(capacity);
+        random.resize(capacity);
+    }
+
+    Color3f getThroughput(uint32_t i) const { return Color3f(tr[i], tg[i], tb[i]); }
+
+    void setThroughput(uint32_t i, const Color3f &value) {
+        tr[i] = value.r(); tg[i] = value.g(); tb[i] = value.b();
+    }
+
+    void addRadiance(uint32_t i, const Color3f &value) {
+        lr[i] += value.r(); lg[i] += value.g(); lb[i] += value.b();
+    }
+};
+
+/// All queues that the stages of a wavefront integrator operate on
+struct Wavefront {
+    PathStates paths;
+    RayQueue rays;       ///< Rays to be traced in the current bounce
+    RayQueue nextRays;   ///< Continuation rays of the next bounce
+    HitQueue hits;       ///< Closest hits of \ref rays (same indices)
+    ShadowQueue shadowRays;
+};
+
+/**
+ * \brief Superclass of wavefront integrators
+ *
+ * Instead of computing the radiance of one ray at a time by recursion
+ * (\ref Integrator::Li()), a wavefront integrator renders a whole wave of
+ * pixel samples (up to "waveSize" paths, 2^20 by default) stage by stage:
+ *
+ * 1. Camera-ray generation for all pixel samples of the wave
+ * 2. Closest-hit queries for all rays in the queue
+ * 3. Shading, which pushes shadow rays and continuation rays (\ref shade())
+ * 4. Shadow-ray queries, which add unoccluded contributions to the paths
+ * 5. Accumulation of the finished paths into the image
+ *
+ * Stages 2-4 are repeated until no continuation rays remain. Each stage
+ * processes its structure-of-arrays queue in parallel. The blocks of a wave
+ * are handed out in the order of the \ref BlockGenerator and merged using
+ * the \ref BlockAccumulator, like the blocks of other integrators.
+ */
+class WavefrontIntegrator : public Integrator {
+public:
+    WavefrontIntegrator(const PropertyList &propList);
+
+    /// Wavefront integrators can't compute the radiance of individual rays
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const;
+
+    /**
+     * \brief Render blocks of one pass over the image
+     *
+     * \param generator
+     *    Block generator that determines the order of the blocks
+     * \param accumulator
+     *    Block accumulator that merges the blocks into the image
+     * \param pass
+     *    Index of the rendering pass
+     * \param sampleCount
+     *    Number of samples per pixel to be taken in this pass
+     * \param blockBegin, blockEnd
+     *    Range of blocks (in the order of the generator) to be rendered
+     */
+    void render(const Scene *scene, const BlockGenerator &generator,
+                BlockAccumulator &accumulator, uint32_t pass,
+                uint32_t sampleCount, int blockBegin, int blockEnd) const;
+
+protected:
+    /**
+     * \brief Shade the closest hits of \c wf.rays
+     *
+     * Implementations push unoccluded contributions to \c wf.shadowRays,
+     * continuation rays to \c wf.nextRays, and may directly add radiance
+     * (e.g. of escaped rays) to the path states.
+     */
+    virtual void shade(const Scene *scene, Wavefront &wf) const = 0;
+
+    /// Trace the rays of \c wf.rays and store their closest hits
+    void traceClosest(const Scene *scene, Wavefront &wf) const;
+
+    /// Trace the shadow rays of \c wf.shadowRays and add the unoccluded contributions
+    void traceShadow(const Scene *scene, Wavefront &wf) const;
+
+    uint32_t m_waveSize;
+};
+
+NORI_NAMESPACE_END
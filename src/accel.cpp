@@ -9,15 +9,92 @@
 
 NORI_NAMESPACE_BEGIN
 
-void Accel::addMesh(Mesh *mesh) {
-    if (m_mesh)
-        throw NoriException("Accel: only a single mesh is supported!");
-    m_mesh = mesh;
-    m_bbox = m_mesh->getBoundingBox();
+/**
+ * \brief Brute force search through all triangles of a mesh with the given
+ * index type, optionally filtering the hits with its opacity mask
+ */
+template <typename Index, bool Masked>
+static bool rayIntersectMesh(const Mesh *mesh, Ray3f &ray, Intersection &its,
+                             uint32_t &f, bool shadowRay) {
+    bool foundIntersection = false;
+
+    for (uint32_t idx = 0; idx < mesh->getTriangleCount(); ++idx) {
+        /* Entirely cut-out triangles can't be hit */
+        if (Masked && mesh->getAlphaCoverage(idx) == Mesh::ETransparent)
+            continue;
+
+        float u, v, t;
+        if (mesh->rayIntersect<Index>(idx, ray, u, v, t)) {
+            /* Continue the search past transparent hits */
+            if (Masked && mesh->isTransparent(idx, u, v))
+                continue;
+
+            /* An intersection was found! Can terminate
+               immediately if this is a shadow ray query */
+            if (shadowRay)
+                return true;
+            ray.maxt = its.t = t;
+            its.uv = Point2f(u, v);
+            its.shape = mesh;
+            f = idx;
+            foundIntersection = true;
+        }
+    }
+
+    return foundIntersection;
+}
+
+/// Brute force search through all triangles of a mesh (paged or in memory)
+static bool rayIntersectMesh(const Mesh *mesh, Ray3f &ray, Intersection &its,
+                             uint32_t &f, bool shadowRay) {
+    if (const ClusterFile *clusters = mesh->getClusterFile()) {
+        /* Out-of-core meshes cull entire clusters of triangles */
+        uint32_t idx;
+        float u, v, t;
+        if (!clusters->rayIntersect(ray, idx, u, v, t, shadowRay))
+            return false;
+        if (!shadowRay) {
+            ray.maxt = its.t = t;
+            its.uv = Point2f(u, v);
+            its.shape = mesh;
+            f = idx;
+        }
+        return true;
+    }
+
+    /* Select the index format and the hit filter once per mesh */
+    if (mesh->hasAlphaMask())
+        return mesh->hasCompactIndices()
+            ? rayIntersectMesh<uint16_t, true>(mesh, ray, its, f, shadowRay)
+            : rayIntersectMesh<uint32_t, true>(mesh, ray, its, f, shadowRay);
+    else
+        return mesh->hasCompactIndices()
+            ? rayIntersectMesh<uint16_t, false>(mesh, ray, its, f, shadowRay)
+            : rayIntersectMesh<uint32_t, false>(mesh, ray, its, f, shadowRay);
+}
+
+void Accel::addShape(Shape *shape) {
+    /* Triangle meshes and their instances are kept separately to use
+       specialized loops */
+    if (shape->getClassType() == NoriObject::EMesh)
+        m_meshes.push_back(static_cast<Mesh *>(shape));
+    else if (shape->isInstance())
+        m_instances.push_back(static_cast<Instance *>(shape));
+    else
+        m_shapes.push_back(shape);
+    m_bbox.expandBy(shape->getBoundingBox());
 }
 
 void Accel::build() {
-    /* Nothing to do here for now */
+    /* Shapes may have changed since they were added (e.g. when their
+       level of detail was chosen), so recompute the bounding box */
+    m_bbox.reset();
+    for (const Mesh *mesh : m_meshes)
+        m_bbox.expandBy(mesh->getBoundingBox());
+    for (const Instance *instance : m_instances)
+        m_bbox.expandBy(instance->getBoundingBox());
+    for (const Shape *shape : m_shapes)
+        m_bbox.expandBy(shape->getBoundingBox());
 }
 
 bool Accel::rayIntersect(const Ray3f &ray_, Intersection &its, bool shadowRay) const {
@@ -26,73 +103,55 @@ bool Accel::rayIntersect(const Ray3f &ray_, Intersection &its, bool shadowRay) c
 
     Ray3f ray(ray_); /// Make a copy of the ray (we will need to update its '.maxt' value)
 
-    /* Brute force search through all triangles */
-    for (uint32_t idx = 0; idx < m_mesh->getTriangleCount(); ++idx) {
-        float u, v, t;
-        if (m_mesh->rayIntersect(idx, ray, u, v, t)) {
-            /* An intersection was found! Can terminate
-               immediately if this is a shadow ray query */
+    /* Brute force search through all triangles of all meshes */
+    for (const Mesh *mesh : m_meshes) {
+        if (rayIntersectMesh(mesh, ray, its, f, shadowRay)) {
             if (shadowRay)
                 return true;
-            ray.maxt = its.t = t;
-            its.uv = Point2f(u, v);
-            its.mesh = m_mesh;
-            f = idx;
             foundIntersection = true;
         }
     }
 
+    /* Instances are intersected in the object space of their mesh. The ray
+       direction isn't normalized, hence distances are the same in both spaces. */
+    for (const Instance *instance : m_instances) {
+        Ray3f localRay = instance->getInverseTransform() * ray;
+        if (rayIntersectMesh(instance->getMesh(), localRay, its, f, shadowRay)) {
+            if (shadowRay)
+                return true;
+            ray.maxt = localRay.maxt;
+            its.shape = instance;
+            foundIntersection = true;
+        }
+    }
+
+    /* Other shapes are intersected through the generic primitive interface */
+    for (const Shape *shape : m_shapes) {
+        bool masked = shape->hasAlphaMask();
+        for (uint32_t idx = 0; idx < shape->getPrimitiveCount(); ++idx) {
+            float u, v, t;
+            if (shape->rayIntersect(idx, ray, u, v, t)) {
+                if (masked && shape->isTransparent(idx, u, v))
+                    continue;
+                if (shadowRay)
+                    return true;
+                ray.maxt = its.t = t;
+                its.uv = Point2f(u, v);
+                its.shape = shape;
+                f = idx;
+                foundIntersection = true;
+            }
+        }
+    }
+
     if (foundIntersection) {
         /* At this point, we now know that there is an intersection,
-           and we know the triangle index of the closest such intersection.
+           and we know the primitive index of the closest such intersection.
 
            The following computes a number of additional properties which
            characterize the intersection (normals, texture coordinates, etc..)
         */
-
-        /* Find the barycentric coordinates */
-        Vector3f bary;
-        bary << 1-its.uv.sum(), its.uv;
-
-        /* References to all relevant mesh buffers */
-        const Mesh *mesh   = its.mesh;
-        const MatrixXf &V  = mesh->getVertexPositions();
-        const MatrixXf &N  = mesh->getVertexNormals();
-        const MatrixXf &UV = mesh->getVertexTexCoords();
-        const MatrixXu &F  = mesh->getIndices();
-
-        /* Vertex indices of the triangle */
-        uint32_t idx0 = F(0, f), idx1 = F(1, f), idx2 = F(2, f);
-
-        Point3f p0 = V.col(idx0), p1 = V.col(idx1), p2 = V.col(idx2);
-
-        /* Compute the intersection positon accurately
-           using barycentric coordinates */
-        its.p = bary.x() * p0 + bary.y() * p1 + bary.z() * p2;
-
-        /* Compute proper texture coordinates if provided by the mesh */
-        if (UV.size() > 0)
-            its.uv = bary.x() * UV.col(idx0) +
-                bary.y() * UV.col(idx1) +
-                bary.z() * UV.col(idx2);
-
-        /* Compute the geometry frame */
-        its.geoFrame = Frame((p1-p0).cross(p2-p0).normalized());
-
-        if (N.size() > 0) {
-            /* Compute the shading frame. Note that for simplicity,
-               the current implementation doesn't attempt to provide
-               tangents that are continuous across the surface. That
-               means that this code will need to be modified to be able
-               use anisotropic BRDFs, which need tangent continuity */
-
-            its.shFrame = Frame(
-                (bary.x() * N.col(idx0) +
-                 bary.y() * N.col(idx1) +
-                 bary.z() * N.col(idx2)).normalized());
-        } else {
-            its.shFrame = its.geoFrame;
-        }
+        its.shape->setHitInformation(f, ray, its);
     }
 
     return foundIntersection;
@@ -29,6 +29,7 @@ Bitmap::Bitmap(const std::string &filename) {
          << filename << "\"" << endl;
 
     const char *ch_r = nullptr, *ch_g = nullptr, *ch_b = nullptr;
+    std::vector<const char *> ch_layers;
     for (Imf::ChannelList::ConstIterator it = channels.begin(); it != channels.end(); ++it) {
         std::string name = toLower(it.name());
 
@@ -46,6 +47,8 @@ Bitmap::Bitmap(const std::string &filename) {
         } else if (!ch_b && (name == "b" || name == "blue" ||
                 endsWith(name, ".b") || endsWith(name, ".blue"))) {
             ch_b = it.name();
+        } else {
+            ch_layers.push_back(it.name());
         }
     }
 
@@ -62,10 +65,24 @@ Bitmap::Bitmap(const std::string &filename) {
     frameBuffer.insert(ch_r, Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride)); ptr += compStride;
     frameBuffer.insert(ch_g, Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride)); ptr += compStride;
     frameBuffer.insert(ch_b, Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride));
+
+    /* Load the remaining channels as layers */
+    m_layers.reserve(ch_layers.size());
+    for (const char *name : ch_layers) {
+        m_layers.emplace_back(name, Layer(rows(), cols()));
+        frameBuffer.insert(name, Imf::Slice(Imf::FLOAT,
+            (char *) m_layers.back().second.data(), compStride, compStride * cols()));
+    }
     file.setFrameBuffer(frameBuffer);
     file.readPixels(dw.min.y, dw.max.y);
 }
 
+void Bitmap::addLayer(const std::string &name, const Layer &layer) {
+    if (layer.rows() != rows() || layer.cols() != cols())
+        throw NoriException("Bitmap::addLayer(): invalid dimensions of layer \"%s\"!", name);
+    m_layers.emplace_back(name, layer);
+}
+
 void Bitmap::saveEXR(const std::string &filename) {
     cout << "Writing a " << cols() << "x" << rows()
          << " OpenEXR file to \"" << filename << "\"" << endl;
@@ -79,6 +96,8 @@ void Bitmap::saveEXR(const std::string &filename) {
     channels.insert("R", Imf::Channel(Imf::FLOAT));
     channels.insert("G", Imf::Channel(Imf::FLOAT));
     channels.insert("B", Imf::Channel(Imf::FLOAT));
+    for (const auto &layer : m_layers)
+        channels.insert(layer.first.c_str(), Imf::Channel(Imf::FLOAT));
 
     Imf::FrameBuffer frameBuffer;
     size_t compStride = sizeof(float),
@@ -89,6 +108,9 @@ void Bitmap::saveEXR(const std::string &filename) {
     frameBuffer.insert("R", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride)); ptr += compStride;
     frameBuffer.insert("G", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride)); ptr += compStride;
     frameBuffer.insert("B", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride));
+    for (const auto &layer : m_layers)
+        frameBuffer.insert(layer.first.c_str(), Imf::Slice(Imf::FLOAT,
+            (char *) layer.second.data(), compStride, compStride * cols()));
 
     Imf::OutputFile file(path.c_str(), header);
     file.setFrameBuffer(frameBuffer);
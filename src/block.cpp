@@ -50,6 +50,20 @@ Bitmap *ImageBlock::toBitmap() const {
     return result;
 }
 
+Bitmap *ImageBlock::toWeightedBitmap() const {
+    Bitmap *result = new Bitmap(m_size);
+    Bitmap::Layer weight(m_size.y(), m_size.x());
+    for (int y=0; y<m_size.y(); ++y) {
+        for (int x=0; x<m_size.x(); ++x) {
+            const Color4f &value = coeff(y + m_borderSize, x + m_borderSize);
+            result->coeffRef(y, x) = value.head<3>();
+            weight(y, x) = value.w();
+        }
+    }
+    result->addLayer("weight", weight);
+    return result;
+}
+
 void ImageBlock::fromBitmap(const Bitmap &bitmap) {
     if (bitmap.cols() != cols() || bitmap.rows() != rows())
         throw NoriException("Invalid bitmap dimensions!");
@@ -90,13 +104,11 @@ void ImageBlock::put(const Point2f &_pos, const Color3f &value) {
             coeffRef(y, x) += Color4f(value) * m_weightsX[xr] * m_weightsY[yr];
 }
     
-void ImageBlock::put(ImageBlock &b) {
+void ImageBlock::put(const ImageBlock &b) {
     Vector2i offset = b.getOffset() - m_offset +
         Vector2i::Constant(m_borderSize - b.getBorderSize());
     Vector2i size   = b.getSize()   + Vector2i(2*b.getBorderSize());
 
-    tbb::mutex::scoped_lock lock(m_mutex);
-
     block(offset.y(), offset.x(), size.y(), size.x()) 
         += b.topLeftCorner(size.y(), size.x());
 }
@@ -106,49 +118,277 @@ std::string ImageBlock::toString() const {
         m_offset.toString(), m_size.toString());
 }
 
-BlockGenerator::BlockGenerator(const Vector2i &size, int blockSize)
-        : m_size(size), m_blockSize(blockSize) {
-    m_numBlocks = Vector2i(
+BlockGenerator::BlockGenerator(const Vector2i &size, int blockSize,
+                               int shardIndex, int shardCount)
+        : m_size(size), m_blockSize(blockSize), m_nextBlock(0) {
+    if (shardCount <= 0 || shardIndex < 0 || shardIndex >= shardCount)
+        throw NoriException("BlockGenerator: invalid shard %i/%i!", shardIndex, shardCount);
+
+    Vector2i numBlocks(
         (int) std::ceil(size.x() / (float) blockSize),
         (int) std::ceil(size.y() / (float) blockSize));
-    m_blocksLeft = m_numBlocks.x() * m_numBlocks.y();
-    m_direction = ERight;
-    m_block = Point2i(m_numBlocks / 2);
-    m_stepsLeft = 1;
-    m_numSteps = 1;
+    int blockCount = numBlocks.x() * numBlocks.y();
+    m_blocks.reserve((blockCount + shardCount - 1) / shardCount);
+
+    /* Walk along a spiral from the center of the image, skipping
+       positions outside of it, and record the order of the blocks */
+    Point2i block(numBlocks / 2);
+    int direction = ERight, numSteps = 1, stepsLeft = 1;
+    for (int index = 0; index < blockCount; ) {
+        if ((block.array() >= 0).all() && (block.array() < numBlocks.array()).all()) {
+            if (index % shardCount == shardIndex)
+                m_blocks.push_back(block * blockSize);
+            ++index;
+        }
+
+        switch (direction) {
+            case ERight: ++block.x(); break;
+            case EDown:  ++block.y(); break;
+            case ELeft:  --block.x(); break;
+            case EUp:    --block.y(); break;
+        }
+
+        if (--stepsLeft == 0) {
+            direction = (direction + 1) % 4;
+            if (direction == ELeft || direction == ERight)
+                ++numSteps;
+            stepsLeft = numSteps;
+        }
+    }
 }
 
 bool BlockGenerator::next(ImageBlock &block) {
-    tbb::mutex::scoped_lock lock(m_mutex);
-
-    if (m_blocksLeft == 0)
+    int index = m_nextBlock.fetch_add(1, std::memory_order_relaxed);
+    if (index >= (int) m_blocks.size())
         return false;
 
-    Point2i pos = m_block * m_blockSize;
+    const Point2i &pos = m_blocks[index];
     block.setOffset(pos);
     block.setSize((m_size - pos).cwiseMin(Vector2i::Constant(m_blockSize)));
+    return true;
+}
+
+BlockAccumulator::BlockAccumulator(ImageBlock &image, const BlockGenerator &generator)
+        : m_image(image), m_blockSize(generator.getBlockSize()) {
+    const Vector2i &size = image.getSize();
+    m_tileCount = Vector2i(
+        (size.x() + m_blockSize - 1) / m_blockSize,
+        (size.y() + m_blockSize - 1) / m_blockSize);
+    m_reach = (image.getBorderSize() + m_blockSize - 1) / m_blockSize;
+
+    int tileCount = getTileCount();
+    if (generator.getBlockCount() > tileCount)
+        throw NoriException("BlockAccumulator: the image doesn't match the block generator!");
+
+    m_order.assign(tileCount, -1);
+    for (int i=0; i<generator.getBlockCount(); ++i) {
+        Point2i tile = generator.getBlockOffset(i) / m_blockSize;
+        m_order[tile.y() * m_tileCount.x() + tile.x()] = i;
+    }
 
-    if (--m_blocksLeft == 0)
-        return true;
+    m_blocks.resize(tileCount);
+    m_pending.reset(new std::atomic<int>[tileCount]);
+    m_users.reset(new std::atomic<int>[tileCount]);
+    m_versions.reset(new std::atomic<int>[tileCount]);
+    for (int i=0; i<tileCount; ++i)
+        m_versions[i].store(0, std::memory_order_relaxed);
+    nextPass();
+}
+
+void BlockAccumulator::nextPass() {
+    /* The neighborhood relation is symmetric: a tile is overlapped by the
+       rendered blocks in its neighborhood, and a rendered block is needed
+       by all tiles in its neighborhood (which are resolved thanks to it) */
+    for (int i=0; i<getTileCount(); ++i) {
+        Point2i min, max;
+        getNeighborhood(i, min, max);
+        int count = 0;
+        for (int y=min.y(); y<=max.y(); ++y)
+            for (int x=min.x(); x<=max.x(); ++x)
+                count += isRendered(y * m_tileCount.x() + x) ? 1 : 0;
+        m_pending[i].store(count, std::memory_order_relaxed);
+        m_users[i].store((max.x() - min.x() + 1) * (max.y() - min.y() + 1),
+                         std::memory_order_relaxed);
+    }
+}
 
-    do {
-        switch (m_direction) {
-            case ERight: ++m_block.x(); break;
-            case EDown:  ++m_block.y(); break;
-            case ELeft:  --m_block.x(); break;
-            case EUp:    --m_block.y(); break;
+void BlockAccumulator::getNeighborhood(int tile, Point2i &min, Point2i &max) const {
+    Point2i pos(tile % m_tileCount.x(), tile / m_tileCount.x());
+    min = (pos - Point2i::Constant(m_reach)).cwiseMax(Point2i(0, 0));
+    max = (pos + Point2i::Constant(m_reach)).cwiseMin(Point2i(m_tileCount - Vector2i(1, 1)));
+}
+
+void BlockAccumulator::put(const ImageBlock &block) {
+    if (block.getBorderSize() != m_image.getBorderSize())
+        throw NoriException("BlockAccumulator: the block doesn't match the image!");
+
+    Point2i pos = block.getOffset() / m_blockSize;
+    int tile = pos.y() * m_tileCount.x() + pos.x();
+    if (!isRendered(tile))
+        throw NoriException("BlockAccumulator: the block isn't handed out by the generator!");
+    Vector2i size = block.getSize() + Vector2i(2 * block.getBorderSize());
+    m_blocks[tile].reset(new ImageBlock::Base(block.topLeftCorner(size.y(), size.x())));
+
+    /* The thread that finishes the last block overlapping a tile resolves it */
+    Point2i min, max;
+    getNeighborhood(tile, min, max);
+    for (int y=min.y(); y<=max.y(); ++y) {
+        for (int x=min.x(); x<=max.x(); ++x) {
+            int neighbor = y * m_tileCount.x() + x;
+            if (m_pending[neighbor].fetch_sub(1, std::memory_order_acq_rel) == 1)
+                resolve(neighbor);
         }
+    }
+}
 
-        if (--m_stepsLeft == 0) {
-            m_direction = (m_direction + 1) % 4;
-            if (m_direction == ELeft || m_direction == ERight) 
-                ++m_numSteps;
-            m_stepsLeft = m_numSteps;
+void BlockAccumulator::resolve(int tile) {
+    Point2i min, max;
+    getNeighborhood(tile, min, max);
+
+    /* Merge the blocks in the order in which they were handed out */
+    std::vector<int> neighbors;
+    for (int y=min.y(); y<=max.y(); ++y) {
+        for (int x=min.x(); x<=max.x(); ++x) {
+            int neighbor = y * m_tileCount.x() + x;
+            if (isRendered(neighbor))
+                neighbors.push_back(neighbor);
         }
-    } while ((m_block.array() < 0).any() ||
-             (m_block.array() >= m_numBlocks.array()).any());
+    }
+    std::sort(neighbors.begin(), neighbors.end(),
+        [&](int a, int b) { return m_order[a] < m_order[b]; });
 
+    /* Flag the tile as being written for the benefit of readers */
+    int version = m_versions[tile].load(std::memory_order_relaxed);
+    m_versions[tile].store(version + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    int border = m_image.getBorderSize();
+    Point2i tileMin = getTileOffset(tile),
+            tileMax = tileMin + getTileSize(tile);
+    for (int neighbor : neighbors) {
+        /* Image region covered by the block (including its border) */
+        const ImageBlock::Base &pixels = *m_blocks[neighbor];
+        Point2i blockMin = getTileOffset(neighbor) - Point2i::Constant(border);
+        Point2i overlapMin = blockMin.cwiseMax(tileMin),
+                overlapMax = (blockMin + Point2i((int) pixels.cols(), (int) pixels.rows())).cwiseMin(tileMax);
+        Vector2i overlap = overlapMax - overlapMin;
+        if ((overlap.array() <= 0).any())
+            continue;
+
+        m_image.block(overlapMin.y() + border, overlapMin.x() + border, overlap.y(), overlap.x())
+            += pixels.block(overlapMin.y() - blockMin.y(), overlapMin.x() - blockMin.x(),
+                            overlap.y(), overlap.x());
+    }
+
+    /* Release blocks whose tiles have all been resolved */
+    for (int neighbor : neighbors) {
+        if (m_users[neighbor].fetch_sub(1, std::memory_order_acq_rel) == 1)
+            m_blocks[neighbor].reset();
+    }
+
+    m_versions[tile].store(version + 2, std::memory_order_release);
+}
+
+bool BlockAccumulator::readTile(int tile, ImageBlock::Base &pixels, int &passes) const {
+    int version = m_versions[tile].load(std::memory_order_acquire);
+    if (version % 2 == 1)
+        return false;
+
+    int border = m_image.getBorderSize();
+    Point2i offset = getTileOffset(tile);
+    Vector2i size = getTileSize(tile);
+    pixels = m_image.block(offset.y() + border, offset.x() + border, size.y(), size.x());
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (m_versions[tile].load(std::memory_order_relaxed) != version)
+        return false;
+    passes = version / 2;
     return true;
 }
 
+void BlockAccumulator::write(std::ostream &os) const {
+    os.write((const char *) m_image.data(), sizeof(Color4f) * m_image.size());
+
+    for (int i=0; i<getTileCount(); ++i) {
+        int32_t state[3] = {
+            m_versions[i].load(std::memory_order_relaxed),
+            m_pending[i].load(std::memory_order_relaxed),
+            m_users[i].load(std::memory_order_relaxed)
+        };
+        os.write((const char *) state, sizeof(state));
+
+        /* Blocks that were stored, but are still needed by unresolved tiles */
+        int32_t size[2] = { 0, 0 };
+        if (m_blocks[i])
+            size[0] = (int32_t) m_blocks[i]->rows(), size[1] = (int32_t) m_blocks[i]->cols();
+        os.write((const char *) size, sizeof(size));
+        if (m_blocks[i])
+            os.write((const char *) m_blocks[i]->data(), sizeof(Color4f) * m_blocks[i]->size());
+    }
+}
+
+void BlockAccumulator::read(std::istream &is) {
+    if (!is.read((char *) m_image.data(), sizeof(Color4f) * m_image.size()))
+        throw NoriException("BlockAccumulator: the checkpoint data is truncated!");
+
+    int border = m_image.getBorderSize();
+    for (int i=0; i<getTileCount(); ++i) {
+        int32_t state[3], size[2];
+        if (!is.read((char *) state, sizeof(state)) || !is.read((char *) size, sizeof(size)))
+            throw NoriException("BlockAccumulator: the checkpoint data is truncated!");
+        if (state[0] < 0 || state[0] % 2 != 0 || state[1] < 0 || state[2] < 0)
+            throw NoriException("BlockAccumulator: invalid checkpoint data!");
+        m_versions[i].store(state[0], std::memory_order_relaxed);
+        m_pending[i].store(state[1], std::memory_order_relaxed);
+        m_users[i].store(state[2], std::memory_order_relaxed);
+
+        if (size[0] == 0 && size[1] == 0) {
+            m_blocks[i].reset();
+            continue;
+        }
+
+        /* Stored blocks cover their tile and its border */
+        Vector2i expected = getTileSize(i) + Vector2i::Constant(2 * border);
+        if (size[0] != expected.y() || size[1] != expected.x())
+            throw NoriException("BlockAccumulator: invalid block size %ix%i in the checkpoint "
+                                "data (expected %ix%i)!", size[1], size[0], expected.x(), expected.y());
+        m_blocks[i].reset(new ImageBlock::Base(size[0], size[1]));
+        if (!is.read((char *) m_blocks[i]->data(), sizeof(Color4f) * m_blocks[i]->size()))
+            throw NoriException("BlockAccumulator: the checkpoint data is truncated!");
+    }
+}
+
+SampleStatistics::SampleStatistics(const Vector2i &size)
+    : m_count(Layer::Zero(size.y(), size.x())), m_mean(Layer::Zero(size.y(), size.x())),
+      m_m2(Layer::Zero(size.y(), size.x())) { }
+
+float SampleStatistics::getRelativeError(const Point2i &pixel) const {
+    float count = m_count(pixel.y(), pixel.x());
+    if (count < 2)
+        return std::numeric_limits<float>::infinity();
+    float variance = m_m2(pixel.y(), pixel.x()) / (count - 1);
+    return std::sqrt(variance / count) / std::max(m_mean(pixel.y(), pixel.x()), 0.01f);
+}
+
+size_t SampleStatistics::getConvergedCount(float threshold) const {
+    size_t result = 0;
+    for (int y=0; y<m_count.rows(); ++y)
+        for (int x=0; x<m_count.cols(); ++x)
+            if (getRelativeError(Point2i(x, y)) < threshold)
+                ++result;
+    return result;
+}
+
+void SampleStatistics::write(std::ostream &os) const {
+    for (const Layer *layer : { &m_count, &m_mean, &m_m2 })
+        os.write((const char *) layer->data(), sizeof(float) * layer->size());
+}
+
+void SampleStatistics::read(std::istream &is) {
+    for (Layer *layer : { &m_count, &m_mean, &m_m2 })
+        is.read((char *) layer->data(), sizeof(float) * layer->size());
+    if (!is)
+        throw NoriException("SampleStatistics: invalid checkpoint data!");
+}
+
 NORI_NAMESPACE_END
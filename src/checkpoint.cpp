@@ -0,0 +1,152 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+*/
+
+#include <nori/checkpoint.h>
+#include <nori/block.h>
+#include <fstream>
+#include <cstdio>
+
+#if defined(_WIN32)
+#  define NOMINMAX
+#  include <windows.h>
+#endif
+
+NORI_NAMESPACE_BEGIN
+
+namespace {
+    /// Header at the beginning of a checkpoint file
+    struct CheckpointHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t width, height;
+        uint32_t borderSize;
+        uint32_t tileCount;
+        uint32_t sampleCount;
+        uint32_t passSize;
+        uint32_t pass;
+        uint32_t nextBlock;
+        uint32_t renderedSamples;
+        uint32_t progressive;
+        uint32_t shardIndex, shardCount;
+        uint32_t sppShardIndex, sppShardCount;
+        float adaptiveThreshold;
+        double elapsed;
+        uint64_t sceneHash;
+    };
+
+    const char *checkpointMagic = "NORICKP";
+    const uint32_t checkpointVersion = 3;
+
+    CheckpointHeader readHeader(std::istream &is, const std::string &filename) {
+        CheckpointHeader header;
+        if (!is.read((char *) &header, sizeof(CheckpointHeader)) ||
+            memcmp(header.magic, checkpointMagic, 8) != 0)
+            throw NoriException("\"%s\" is not a checkpoint file!", filename);
+        if (header.version != checkpointVersion)
+            throw NoriException("Checkpoint file \"%s\" has an unsupported version (%i)!",
+                                filename, header.version);
+        return header;
+    }
+};
+
+Checkpoint::Checkpoint(const std::string &filename) : m_filename(filename) {
+    std::ifstream is(filename, std::ios::binary);
+    if (is.fail())
+        throw NoriException("Unable to open checkpoint file \"%s\"!", filename);
+
+    CheckpointHeader header = readHeader(is, filename);
+    sampleCount = header.sampleCount;
+    passSize = header.passSize;
+    pass = header.pass;
+    nextBlock = header.nextBlock;
+    renderedSamples = header.renderedSamples;
+    progressive = header.progressive != 0;
+    shardIndex = header.shardIndex;
+    shardCount = header.shardCount;
+    sppShardIndex = header.sppShardIndex;
+    sppShardCount = header.sppShardCount;
+    adaptiveThreshold = header.adaptiveThreshold;
+    elapsed = header.elapsed;
+    sceneHash = header.sceneHash;
+}
+
+uint64_t Checkpoint::hashScene(const std::string &description) {
+    /* 64-bit FNV-1a hash */
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (char c : description)
+        hash = (hash ^ (uint8_t) c) * 0x100000001b3ull;
+    return hash;
+}
+
+void Checkpoint::restore(BlockAccumulator &accumulator, SampleStatistics *statistics) const {
+    std::ifstream is(m_filename, std::ios::binary);
+    if (is.fail())
+        throw NoriException("Unable to open checkpoint file \"%s\"!", m_filename);
+
+    CheckpointHeader header = readHeader(is, m_filename);
+    const ImageBlock &image = accumulator.getImage();
+    if (header.width != (uint32_t) image.getSize().x() ||
+        header.height != (uint32_t) image.getSize().y() ||
+        header.borderSize != (uint32_t) image.getBorderSize() ||
+        header.tileCount != (uint32_t) accumulator.getTileCount())
+        throw NoriException("Checkpoint file \"%s\" doesn't match the camera of the scene!", m_filename);
+    if ((header.adaptiveThreshold > 0) != (statistics != nullptr))
+        throw NoriException("Checkpoint file \"%s\" doesn't match the adaptive sampling settings!", m_filename);
+
+    accumulator.read(is);
+    if (statistics)
+        statistics->read(is);
+}
+
+void Checkpoint::write(const std::string &filename, const BlockAccumulator &accumulator,
+                       const SampleStatistics *statistics) const {
+    std::string tempName = filename + ".tmp";
+    std::ofstream os(tempName, std::ios::binary);
+    if (os.fail())
+        throw NoriException("Unable to create checkpoint file \"%s\"!", tempName);
+
+    const ImageBlock &image = accumulator.getImage();
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(CheckpointHeader));
+    memcpy(header.magic, checkpointMagic, 8);
+    header.version = checkpointVersion;
+    header.width = (uint32_t) image.getSize().x();
+    header.height = (uint32_t) image.getSize().y();
+    header.borderSize = (uint32_t) image.getBorderSize();
+    header.tileCount = (uint32_t) accumulator.getTileCount();
+    header.sampleCount = sampleCount;
+    header.passSize = passSize;
+    header.pass = pass;
+    header.nextBlock = nextBlock;
+    header.renderedSamples = renderedSamples;
+    header.progressive = progressive ? 1 : 0;
+    header.shardIndex = shardIndex;
+    header.shardCount = shardCount;
+    header.sppShardIndex = sppShardIndex;
+    header.sppShardCount = sppShardCount;
+    header.adaptiveThreshold = adaptiveThreshold;
+    header.elapsed = elapsed;
+    header.sceneHash = sceneHash;
+    os.write((const char *) &header, sizeof(CheckpointHeader));
+
+    accumulator.write(os);
+    if (statistics)
+        statistics->write(os);
+
+    os.close();
+    if (os.fail())
+        throw NoriException("Unable to write checkpoint file \"%s\"!", tempName);
+
+    /* Replace the previous checkpoint (which rename() refuses to do on Windows) */
+#if defined(_WIN32)
+    if (!MoveFileExA(tempName.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING))
+#else
+    if (std::rename(tempName.c_str(), filename.c_str()) != 0)
+#endif
+        throw NoriException("Unable to rename \"%s\" to \"%s\"!", tempName, filename);
+}
+
+NORI_NAMESPACE_END
@@ -0,0 +1,421 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+*/
+
+#include <nori/clusters.h>
+#include <nori/mesh.h>
+#include <nori/timer.h>
+#include <tbb/mutex.h>
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+
+#if !defined(_WIN32)
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+NORI_NAMESPACE_BEGIN
+
+namespace {
+    /// Header at the beginning of a cluster file
+    struct ClusterFileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t keyLength;
+        uint64_t clusterSize;
+        uint64_t clusterCount;
+        uint32_t triangleCount;
+        uint32_t trianglesPerCluster;
+        uint32_t hasNormals;
+        uint32_t hasTexCoords;
+        float bbox[6];
+    };
+
+    const char *clusterFileMagic = "NORICLU";
+    const uint32_t clusterFileVersion = 1;
+
+    /// Size of the data stored per triangle
+    size_t triangleStride(bool hasNormals, bool hasTexCoords) {
+        return sizeof(float) * (9 + (hasNormals ? 9 : 0) + (hasTexCoords ? 6 : 0));
+    }
+
+    size_t pageSize() {
+#if !defined(_WIN32)
+        return (size_t) sysconf(_SC_PAGESIZE);
+#else
+        return 4096;
+#endif
+    }
+};
+
+/**
+ * \brief Shared state of all cluster files: the memory budget, the
+ * CLOCK hand, and the page-in statistics
+ */
+struct ClusterPager {
+    tbb::mutex mutex;
+    std::vector<const ClusterFile *> files;
+    size_t budget = (size_t) 1024 * 1024 * 1024;
+    size_t resident = 0;
+    size_t handFile = 0;
+    uint32_t handCluster = 0;
+
+    std::atomic<uint64_t> pageIns, bytesPagedIn, evictions;
+    Timer timer;
+
+    ClusterPager() : pageIns(0), bytesPagedIn(0), evictions(0) { }
+
+    static ClusterPager &get() {
+        static ClusterPager *pager = new ClusterPager();
+        return *pager;
+    }
+
+    /// Advance the clock hand and evict one cluster (mutex must be held)
+    void evictOne() {
+        while (true) {
+            if (handFile >= files.size()) {
+                handFile = 0;
+                handCluster = 0;
+            }
+            const ClusterFile *file = files[handFile];
+            if (handCluster >= file->getClusterCount()) {
+                handFile++;
+                handCluster = 0;
+                continue;
+            }
+            uint32_t cluster = handCluster++;
+            std::atomic<uint8_t> &state = file->m_state[cluster];
+            uint8_t value = state.load(std::memory_order_relaxed);
+            if (!(value & ClusterFile::EResident))
+                continue;
+            if (value & ClusterFile::EReferenced) {
+                /* Give the cluster a second chance */
+                state.fetch_and((uint8_t) ~ClusterFile::EReferenced,
+                                std::memory_order_relaxed);
+                continue;
+            }
+            file->evict(cluster);
+            return;
+        }
+    }
+};
+
+void ClusterFile::write(const std::string &filename, const std::string &key,
+                        const Mesh *mesh, size_t clusterSize) {
+    size_t page = pageSize();
+    clusterSize = (clusterSize + page - 1) / page * page;
+
+    bool hasNormals = mesh->hasVertexNormals(),
+         hasTexCoords = mesh->hasVertexTexCoords();
+    size_t stride = triangleStride(hasNormals, hasTexCoords);
+    uint32_t triangleCount = mesh->getTriangleCount();
+    uint32_t trianglesPerCluster = (uint32_t) (clusterSize / stride);
+    uint32_t clusterCount = (triangleCount + trianglesPerCluster - 1) / trianglesPerCluster;
+
+    if (sizeof(ClusterFileHeader) + key.length() > clusterSize)
+        throw NoriException("ClusterFile: the cluster size is too small!");
+
+    std::string tempName = filename + ".tmp";
+    std::ofstream os(tempName, std::ios::binary);
+    if (os.fail())
+        throw NoriException("Unable to create cluster file \"%s\"!", tempName);
+
+    ClusterFileHeader header;
+    memset(&header, 0, sizeof(ClusterFileHeader));
+    memcpy(header.magic, clusterFileMagic, 8);
+    header.version = clusterFileVersion;
+    header.keyLength = (uint32_t) key.length();
+    header.clusterSize = clusterSize;
+    header.clusterCount = clusterCount;
+    header.triangleCount = triangleCount;
+    header.trianglesPerCluster = trianglesPerCluster;
+    header.hasNormals = hasNormals ? 1 : 0;
+    header.hasTexCoords = hasTexCoords ? 1 : 0;
+    const BoundingBox3f &bbox = mesh->getBoundingBox();
+    for (int i=0; i<3; ++i) {
+        header.bbox[i] = bbox.min[i];
+        header.bbox[i+3] = bbox.max[i];
+    }
+
+    std::vector<uint8_t> buffer(clusterSize, 0);
+    memcpy(buffer.data(), &header, sizeof(ClusterFileHeader));
+    memcpy(buffer.data() + sizeof(ClusterFileHeader), key.data(), key.length());
+    os.write((const char *) buffer.data(), clusterSize);
+
+    /* Each cluster stores the positions of all of its triangles, followed
+       by their normals and texture coordinates (if present) */
+    std::vector<float> bboxes(6 * (size_t) clusterCount);
+    TriangleVertices tri;
+    for (uint32_t cluster = 0; cluster < clusterCount; ++cluster) {
+        std::fill(buffer.begin(), buffer.end(), 0);
+        float *positions = (float *) buffer.data();
+        float *normals = positions + 9 * trianglesPerCluster;
+        float *texcoords = normals + (hasNormals ? 9 * trianglesPerCluster : 0);
+
+        BoundingBox3f clusterBBox;
+        uint32_t start = cluster * trianglesPerCluster,
+                 end = std::min(start + trianglesPerCluster, triangleCount);
+        for (uint32_t index = start; index < end; ++index) {
+            mesh->getTriangle(index, tri);
+            uint32_t i = index - start;
+            for (int k=0; k<3; ++k) {
+                clusterBBox.expandBy(tri.p[k]);
+                memcpy(positions + 9*i + 3*k, tri.p[k].data(), 3 * sizeof(float));
+                if (hasNormals)
+                    memcpy(normals + 9*i + 3*k, tri.n[k].data(), 3 * sizeof(float));
+                if (hasTexCoords)
+                    memcpy(texcoords + 6*i + 2*k, tri.uv[k].data(), 2 * sizeof(float));
+            }
+        }
+        for (int i=0; i<3; ++i) {
+            bboxes[6*cluster + i] = clusterBBox.min[i];
+            bboxes[6*cluster + i + 3] = clusterBBox.max[i];
+        }
+        os.write((const char *) buffer.data(), clusterSize);
+    }
+
+    /* The cluster bounding boxes are stored at the end */
+    os.write((const char *) bboxes.data(), sizeof(float) * bboxes.size());
+    os.close();
+    if (os.fail())
+        throw NoriException("Unable to write cluster file \"%s\"!", tempName);
+
+    if (std::rename(tempName.c_str(), filename.c_str()) != 0)
+        throw NoriException("Unable to rename \"%s\" to \"%s\"!", tempName, filename);
+}
+
+bool ClusterFile::isUpToDate(const std::string &filename, const std::string &key,
+                             const std::string &source) {
+#if !defined(_WIN32)
+    struct stat fileStat, sourceStat;
+    if (stat(filename.c_str(), &fileStat) != 0 ||
+        stat(source.c_str(), &sourceStat) != 0 ||
+        fileStat.st_mtime < sourceStat.st_mtime)
+        return false;
+#endif
+
+    std::ifstream is(filename, std::ios::binary);
+    ClusterFileHeader header;
+    if (!is.read((char *) &header, sizeof(ClusterFileHeader)) ||
+        memcmp(header.magic, clusterFileMagic, 8) != 0 ||
+        header.version != clusterFileVersion ||
+        header.keyLength != key.length())
+        return false;
+
+    std::string fileKey(header.keyLength, '\0');
+    if (!is.read(&fileKey[0], header.keyLength))
+        return false;
+    return fileKey == key;
+}
+
+ClusterFile::ClusterFile(const std::string &filename) : m_filename(filename) {
+#if defined(_WIN32)
+    throw NoriException("ClusterFile: memory-mapped geometry is not supported on Windows!");
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+        throw NoriException("Unable to open cluster file \"%s\"!", filename);
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0) {
+        close(fd);
+        throw NoriException("Unable to query the size of \"%s\"!", filename);
+    }
+    m_fileSize = (size_t) fileStat.st_size;
+
+    void *ptr = m_fileSize >= sizeof(ClusterFileHeader)
+        ? mmap(nullptr, m_fileSize, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (ptr == MAP_FAILED)
+        throw NoriException("Unable to map cluster file \"%s\"!", filename);
+    m_data = (const uint8_t *) ptr;
+
+    ClusterFileHeader header;
+    memcpy(&header, m_data, sizeof(ClusterFileHeader));
+    size_t bboxOffset = (size_t) (header.clusterCount + 1) * header.clusterSize;
+    if (memcmp(header.magic, clusterFileMagic, 8) != 0 ||
+        header.version != clusterFileVersion ||
+        header.clusterSize % pageSize() != 0 ||
+        bboxOffset + sizeof(float) * 6 * header.clusterCount != m_fileSize) {
+        munmap((void *) m_data, m_fileSize);
+        throw NoriException("\"%s\" is not a valid cluster file!", filename);
+    }
+
+    m_clusterSize = (size_t) header.clusterSize;
+    m_triangleCount = header.triangleCount;
+    m_trianglesPerCluster = header.trianglesPerCluster;
+    m_hasNormals = header.hasNormals != 0;
+    m_hasTexCoords = header.hasTexCoords != 0;
+    m_bbox = BoundingBox3f(
+        Point3f(header.bbox[0], header.bbox[1], header.bbox[2]),
+        Point3f(header.bbox[3], header.bbox[4], header.bbox[5]));
+
+    /* The cluster bounding boxes always remain in memory */
+    const float *bboxes = (const float *) (m_data + bboxOffset);
+    m_clusterBBoxes.resize(header.clusterCount);
+    for (size_t i=0; i<m_clusterBBoxes.size(); ++i)
+        m_clusterBBoxes[i] = BoundingBox3f(
+            Point3f(bboxes[6*i+0], bboxes[6*i+1], bboxes[6*i+2]),
+            Point3f(bboxes[6*i+3], bboxes[6*i+4], bboxes[6*i+5]));
+
+    m_state.reset(new std::atomic<uint8_t>[m_clusterBBoxes.size()]);
+    for (size_t i=0; i<m_clusterBBoxes.size(); ++i)
+        m_state[i].store(0, std::memory_order_relaxed);
+
+    /* Only the clusters themselves should be loaded on demand */
+    madvise((void *) m_data, m_fileSize, MADV_RANDOM);
+
+    ClusterPager &pager = ClusterPager::get();
+    tbb::mutex::scoped_lock lock(pager.mutex);
+    pager.files.push_back(this);
+#endif
+}
+
+ClusterFile::~ClusterFile() {
+#if !defined(_WIN32)
+    ClusterPager &pager = ClusterPager::get();
+    tbb::mutex::scoped_lock lock(pager.mutex);
+    for (uint32_t i=0; i<getClusterCount(); ++i) {
+        if (m_state[i].load(std::memory_order_relaxed) & EResident)
+            pager.resident -= m_clusterSize;
+    }
+    pager.files.erase(std::remove(pager.files.begin(), pager.files.end(), this),
+                      pager.files.end());
+    pager.handFile = 0;
+    pager.handCluster = 0;
+    munmap((void *) m_data, m_fileSize);
+#endif
+}
+
+void ClusterFile::pageIn(uint32_t cluster) const {
+#if !defined(_WIN32)
+    ClusterPager &pager = ClusterPager::get();
+    tbb::mutex::scoped_lock lock(pager.mutex);
+    if (m_state[cluster].load(std::memory_order_relaxed) & EResident)
+        return; /* Another thread was faster */
+
+    const uint8_t *data = m_data + (size_t) (cluster + 1) * m_clusterSize;
+    madvise((void *) data, m_clusterSize, MADV_WILLNEED);
+    m_state[cluster].store(EResident | EReferenced, std::memory_order_relaxed);
+    pager.resident += m_clusterSize;
+    pager.pageIns++;
+    pager.bytesPagedIn += m_clusterSize;
+
+    while (pager.resident > pager.budget)
+        pager.evictOne();
+#endif
+}
+
+void ClusterFile::evict(uint32_t cluster) const {
+#if !defined(_WIN32)
+    /* Threads that still hold a pointer to the cluster just fault
+       the pages back in from the file */
+    const uint8_t *data = m_data + (size_t) (cluster + 1) * m_clusterSize;
+    madvise((void *) data, m_clusterSize, MADV_DONTNEED);
+    m_state[cluster].store(0, std::memory_order_relaxed);
+    ClusterPager &pager = ClusterPager::get();
+    pager.resident -= m_clusterSize;
+    pager.evictions++;
+#endif
+}
+
+void ClusterFile::getTriangle(uint32_t index, TriangleVertices &tri) const {
+    uint32_t cluster = index / m_trianglesPerCluster,
+             i = index % m_trianglesPerCluster;
+    const float *positions = (const float *) acquire(cluster);
+    const float *normals = positions + 9 * m_trianglesPerCluster;
+    const float *texcoords = normals + (m_hasNormals ? 9 * m_trianglesPerCluster : 0);
+
+    for (int k=0; k<3; ++k) {
+        const float *p = positions + 9*i + 3*k;
+        tri.p[k] = Point3f(p[0], p[1], p[2]);
+        if (m_hasNormals) {
+            const float *n = normals + 9*i + 3*k;
+            tri.n[k] = Normal3f(n[0], n[1], n[2]);
+        }
+        if (m_hasTexCoords) {
+            const float *uv = texcoords + 6*i + 2*k;
+            tri.uv[k] = Point2f(uv[0], uv[1]);
+        }
+    }
+}
+
+bool ClusterFile::rayIntersect(const Ray3f &ray_, uint32_t &index, float &u,
+                               float &v, float &t, bool shadowRay) const {
+    Ray3f ray(ray_);
+    bool foundIntersection = false;
+
+    for (uint32_t cluster = 0; cluster < getClusterCount(); ++cluster) {
+        if (!m_clusterBBoxes[cluster].rayIntersect(ray))
+            continue;
+
+        const float *positions = (const float *) acquire(cluster);
+        uint32_t start = cluster * m_trianglesPerCluster,
+                 count = std::min(m_trianglesPerCluster, m_triangleCount - start);
+
+        for (uint32_t i = 0; i < count; ++i) {
+            const float *p = positions + 9*i;
+            float u_, v_, t_;
+            if (Mesh::rayIntersect(Point3f(p[0], p[1], p[2]),
+                                   Point3f(p[3], p[4], p[5]),
+                                   Point3f(p[6], p[7], p[8]),
+                                   ray, u_, v_, t_)) {
+                if (shadowRay)
+                    return true;
+                ray.maxt = t = t_;
+                u = u_; v = v_;
+                index = start + i;
+                foundIntersection = true;
+            }
+        }
+    }
+
+    return foundIntersection;
+}
+
+void ClusterFile::setMemoryBudget(size_t budget) {
+    ClusterPager &pager = ClusterPager::get();
+    tbb::mutex::scoped_lock lock(pager.mutex);
+    pager.budget = budget;
+    while (pager.resident > pager.budget)
+        pager.evictOne();
+}
+
+bool ClusterFile::isActive() {
+    ClusterPager &pager = ClusterPager::get();
+    tbb::mutex::scoped_lock lock(pager.mutex);
+    return !pager.files.empty();
+}
+
+void ClusterFile::resetStatistics() {
+    ClusterPager &pager = ClusterPager::get();
+    tbb::mutex::scoped_lock lock(pager.mutex);
+    pager.pageIns = 0;
+    pager.bytesPagedIn = 0;
+    pager.evictions = 0;
+    pager.timer.reset();
+}
+
+std::string ClusterFile::getStatistics() {
+    ClusterPager &pager = ClusterPager::get();
+    tbb::mutex::scoped_lock lock(pager.mutex);
+    uint64_t pageIns = pager.pageIns, evictions = pager.evictions;
+    double seconds = std::max(pager.timer.elapsed() / 1000.0, 1e-3);
+    return tfm::format(
+        "%i page-ins (%.1f/s, %s), %i evictions, %s resident (budget: %s)",
+        pageIns, pageIns / seconds, memString((size_t) pager.bytesPagedIn),
+        evictions, memString(pager.resident), memString(pager.budget));
+}
+
+std::string ClusterFile::toString() const {
+    return tfm::format(
+        "ClusterFile[filename=\"%s\", triangles=%i, clusters=%i, clusterSize=%s]",
+        m_filename, m_triangleCount, getClusterCount(), memString(m_clusterSize));
+}
+
+NORI_NAMESPACE_END
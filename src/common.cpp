@@ -22,6 +22,10 @@
 #include <sys/sysctl.h>
 #endif
 
+#if !defined(_WIN32)
+#include <sys/stat.h>
+#endif
+
 NORI_NAMESPACE_BEGIN
 
 std::string indent(const std::string &string, int amount) {
@@ -158,6 +162,22 @@ std::string memString(size_t size, bool precise) {
     return os.str();
 }
 
+std::string fileVersion(const std::string &filename) {
+    int64_t size = -1, modified = 0;
+#if !defined(_WIN32)
+    struct stat st;
+    if (stat(filename.c_str(), &st) == 0) {
+        size = (int64_t) st.st_size;
+#  if defined(__APPLE__)
+        modified = (int64_t) st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#  else
+        modified = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#  endif
+    }
+#endif
+    return tfm::format("%i:%i", size, modified);
+}
+
 filesystem::resolver *getFileResolver() {
     static filesystem::resolver *resolver = new filesystem::resolver();
     return resolver;
@@ -256,6 +276,23 @@ void coordinateSystem(const Vector3f &a, Vector3f &b, Vector3f &c) {
     b = c.cross(a);
 }
 
+uint32_t encodeOctahedral(const Vector3f &v) {
+    float invL1 = 1.0f / (std::abs(v.x()) + std::abs(v.y()) + std::abs(v.z()));
+    float x = v.x() * invL1, y = v.y() * invL1;
+
+    /* Fold the lower hemisphere over the diagonals */
+    if (v.z() < 0.0f) {
+        float fx = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float fy = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = fx; y = fy;
+    }
+
+    int16_t qx = (int16_t) std::round(clamp(x, -1.0f, 1.0f) * 32767.0f);
+    int16_t qy = (int16_t) std::round(clamp(y, -1.0f, 1.0f) * 32767.0f);
+
+    return (uint32_t) (uint16_t) qx | ((uint32_t) (uint16_t) qy << 16);
+}
+
 float fresnel(float cosThetaI, float extIOR, float intIOR) {
     float etaI = extIOR, etaT = intIOR;
 
@@ -0,0 +1,357 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+*/
+
+#include <nori/shape.h>
+#include <nori/bsdf.h>
+#include <nori/emitter.h>
+#include <nori/timer.h>
+#include <filesystem/resolver.h>
+#include <Eigen/Geometry>
+#include <fstream>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Cubic Bézier curves rendered as flat ribbons (e.g. hair, fur or grass)
+ *
+ * The curves are loaded from a text file that lists one control point per
+ * line as <tt>x y z [width]</tt>. Empty lines separate strands, and every
+ * strand consists of <tt>3k+1</tt> control points that form \c k cubic
+ * Bézier segments sharing their end points. Lines starting with \c # are
+ * ignored. Control points without a width use the \c width property.
+ *
+ * An opacity mask (\c alphaMask) is looked up with the position along
+ * each segment and across the ribbon as texture coordinates.
+ *
+ * Each segment is a primitive of its own. Its storage consists of the
+ * index of its first control point, and control points store their
+ * position and width. Rays are intersected with a ribbon that always
+ * faces the ray, following the recursive subdivision approach of pbrt-v3.
+ * Since the ribbons have no fixed orientation, curves can't be area emitters.
+ *
+ * <pre>
+ * &lt;shape type="curves"&gt;
+ *     &lt;string name="filename" value="fur.txt"/&gt;
+ *     &lt;float name="width" value="0.001"/&gt;
+ *     &lt;transform name="toWorld"&gt; ... &lt;/transform&gt;
+ * &lt;/shape&gt;
+ * </pre>
+ */
+class Curves : public Shape {
+public:
+    Curves(const PropertyList &propList) {
+        filesystem::path filename =
+            getFileResolver()->resolve(propList.getString("filename"));
+        Transform trafo = propList.getTransform("toWorld", Transform());
+        float defaultWidth = propList.getFloat("width", 0.01f);
+        m_name = filename.str();
+        loadAlphaMask(propList);
+
+        std::ifstream is(filename.str());
+        if (is.fail())
+            throw NoriException("Unable to open curve file \"%s\"!", filename);
+
+        cout << "Loading \"" << filename << "\" .. ";
+        cout.flush();
+        Timer timer;
+
+        std::vector<Vector4f> points;
+        size_t strandStart = 0;
+        auto endStrand = [&]() {
+            size_t count = points.size() - strandStart;
+            if (count == 0)
+                return;
+            if (count < 4 || (count - 1) % 3 != 0)
+                throw NoriException("\"%s\": strands must consist of 3k+1 control "
+                                    "points (found %i)!", filename, count);
+            for (size_t i=strandStart; i+3<points.size(); i += 3)
+                m_segments.push_back((uint32_t) i);
+            strandStart = points.size();
+        };
+
+        std::string line;
+        while (std::getline(is, line)) {
+            size_t pos = line.find_first_not_of(" \t\r");
+            if (pos == std::string::npos) {
+                /* Empty line: end of strand */
+                endStrand();
+                continue;
+            } else if (line[pos] == '#') {
+                continue;
+            }
+
+            std::istringstream iss(line);
+            Point3f p;
+            float width = defaultWidth;
+            if (!(iss >> p.x() >> p.y() >> p.z()))
+                throw NoriException("\"%s\": invalid line \"%s\"!", filename, line);
+            iss >> width;
+            p = trafo * p;
+            points.push_back(Vector4f(p.x(), p.y(), p.z(), width));
+        }
+        endStrand();
+
+        m_points.resize(4, points.size());
+        for (size_t i=0; i<points.size(); ++i)
+            m_points.col(i) = points[i];
+
+        /* Compute the bounding box and the approximate surface area */
+        for (uint32_t i=0; i<getPrimitiveCount(); ++i) {
+            m_bbox.expandBy(getBoundingBox(i));
+            m_surfaceArea += segmentArea(i);
+        }
+
+        cout << "done. (" << m_segments.size() << " segments, took "
+             << timer.elapsedString() << " and "
+             << memString(m_points.size() * sizeof(float) + m_segments.size() * sizeof(uint32_t))
+             << ")" << endl;
+    }
+
+    uint32_t getPrimitiveCount() const { return (uint32_t) m_segments.size(); }
+
+    BoundingBox3f getBoundingBox(uint32_t index) const {
+        /* Bézier curves lie within the convex hull of their control points */
+        Point3f cp[4];
+        float w0, w1;
+        getSegment(index, cp, w0, w1);
+        BoundingBox3f result(cp[0]);
+        for (int i=1; i<4; ++i)
+            result.expandBy(cp[i]);
+        float r = 0.5f * std::max(w0, w1);
+        result.min -= Vector3f(r);
+        result.max += Vector3f(r);
+        return result;
+    }
+
+    Point3f getCentroid(uint32_t index) const {
+        Point3f cp[4];
+        float w0, w1;
+        getSegment(index, cp, w0, w1);
+        return evalBezier(cp, 0.5f);
+    }
+
+    bool rayIntersect(uint32_t index, const Ray3f &ray,
+                      float &u, float &v, float &t) const {
+        Point3f cpWorld[4];
+        float w0, w1;
+        getSegment(index, cpWorld, w0, w1);
+
+        /* Project the control points into a coordinate system where the
+           ray starts at the origin and points along +z. The y axis is
+           perpendicular to the chord, which keeps the y extent small. */
+        float rayLength = ray.d.norm();
+        Vector3f ez = ray.d / rayLength;
+        Vector3f ey = ray.d.cross(cpWorld[3] - cpWorld[0]);
+        Vector3f ex;
+        if (ey.squaredNorm() == 0)
+            coordinateSystem(ez, ex, ey);
+        else
+            ey.normalize();
+        ex = ey.cross(ez);
+
+        Vector3f cp[4];
+        for (int i=0; i<4; ++i) {
+            Vector3f d = cpWorld[i] - ray.o;
+            cp[i] = Vector3f(d.dot(ex), d.dot(ey), d.dot(ez));
+        }
+
+        float zMin = ray.mint * rayLength, zMax = ray.maxt * rayLength;
+        float maxWidth = std::max(w0, w1);
+        if (!overlaps(cp, maxWidth, zMin, zMax))
+            return false;
+
+        /* Choose the subdivision depth so that the linearized curve is
+           within 5% of the width of the true curve */
+        float L0 = 0;
+        for (int i=0; i<2; ++i)
+            L0 = std::max(L0, (cp[i] - 2 * cp[i+1] + cp[i+2]).cwiseAbs().maxCoeff());
+        float eps = maxWidth * 0.05f;
+        int maxDepth = 0;
+        if (eps > 0) {
+            float r0 = std::sqrt(2.0f) * 6.0f * L0 / (8.0f * eps);
+            if (r0 > 1)
+                maxDepth = std::min(10, (int) std::ceil(std::log2(r0) / 2));
+        }
+
+        bool hit = recursiveIntersect(cp, 0.0f, 1.0f, w0, w1, maxDepth, zMin, zMax, u, v);
+        if (hit)
+            t = zMax / rayLength;
+        return hit;
+    }
+
+    void setHitInformation(uint32_t index, const Ray3f &ray, Intersection &its) const {
+        Point3f cp[4];
+        float w0, w1;
+        getSegment(index, cp, w0, w1);
+
+        its.p = ray(its.t);
+
+        /* The ribbon faces the ray: use the direction towards the ray
+           origin, made perpendicular to the tangent */
+        Vector3f tangent;
+        evalBezier(cp, its.uv.x(), &tangent);
+        Vector3f n = -ray.d.normalized();
+        if (tangent.squaredNorm() > 0) {
+            tangent.normalize();
+            Vector3f perp = n - n.dot(tangent) * tangent;
+            if (perp.squaredNorm() > 0)
+                n = perp.normalized();
+        }
+        its.geoFrame = its.shFrame = Frame(n);
+    }
+
+    float getSurfaceArea() const { return m_surfaceArea; }
+
+    void addChild(NoriObject *obj) {
+        if (obj->getClassType() == EEmitter)
+            throw NoriException("Curves: \"%s\" cannot be an area emitter (the ribbons "
+                                "face each ray and have no fixed surface to sample)!", m_name);
+        Shape::addChild(obj);
+    }
+
+    void samplePosition(const Point2f &, Point3f &, Normal3f &, float &) const {
+        throw NoriException("Curves::samplePosition(): the ribbons of \"%s\" face each "
+                            "ray and have no fixed surface to sample!", m_name);
+    }
+
+    std::string toString() const {
+        return tfm::format(
+            "Curves[\n"
+            "  name = \"%s\",\n"
+            "  segmentCount = %i,\n"
+            "  bsdf = %s,\n"
+            "  emitter = %s\n"
+            "]",
+            m_name,
+            m_segments.size(),
+            m_bsdf ? indent(m_bsdf->toString()) : std::string("null"),
+            m_emitter ? indent(m_emitter->toString()) : std::string("null")
+        );
+    }
+
+private:
+    /// Look up the control points and end point widths of a segment
+    void getSegment(uint32_t index, Point3f cp[4], float &w0, float &w1) const {
+        uint32_t first = m_segments[index];
+        for (int i=0; i<4; ++i)
+            cp[i] = m_points.col(first + i).head<3>();
+        w0 = m_points(3, first);
+        w1 = m_points(3, first + 3);
+    }
+
+    /// Evaluate a cubic Bézier curve (and optionally its derivative)
+    template <typename PointType>
+    static PointType evalBezier(const PointType cp[4], float u, Vector3f *deriv = nullptr) {
+        PointType a = (1 - u) * cp[0] + u * cp[1],
+                  b = (1 - u) * cp[1] + u * cp[2],
+                  c = (1 - u) * cp[2] + u * cp[3];
+        PointType d = (1 - u) * a + u * b,
+                  e = (1 - u) * b + u * c;
+        if (deriv)
+            *deriv = 3 * Vector3f(e - d);
+        return (1 - u) * d + u * e;
+    }
+
+    /// Split a cubic Bézier curve at u=0.5 (the halves share cpSplit[3])
+    static void subdivideBezier(const Vector3f cp[4], Vector3f cpSplit[7]) {
+        cpSplit[0] = cp[0];
+        cpSplit[1] = (cp[0] + cp[1]) / 2;
+        cpSplit[2] = (cp[0] + 2 * cp[1] + cp[2]) / 4;
+        cpSplit[3] = (cp[0] + 3 * cp[1] + 3 * cp[2] + cp[3]) / 8;
+        cpSplit[4] = (cp[1] + 2 * cp[2] + cp[3]) / 4;
+        cpSplit[5] = (cp[2] + cp[3]) / 2;
+        cpSplit[6] = cp[3];
+    }
+
+    /// Check whether the bounds of ray-space control points contain the ray
+    static bool overlaps(const Vector3f cp[4], float width, float zMin, float zMax) {
+        Vector3f lo = cp[0], hi = cp[0];
+        for (int i=1; i<4; ++i) {
+            lo = lo.cwiseMin(cp[i]);
+            hi = hi.cwiseMax(cp[i]);
+        }
+        float r = 0.5f * width;
+        /* y first, since its extent is usually the smallest */
+        return lo.y() - r <= 0 && hi.y() + r >= 0 &&
+               lo.x() - r <= 0 && hi.x() + r >= 0 &&
+               hi.z() + r >= zMin && lo.z() - r <= zMax;
+    }
+
+    /**
+     * \brief Intersect a ray-space curve segment (covering [u0, u1] of the
+     * original segment) by recursive subdivision
+     *
+     * Upon success, \c zMax is reduced to the depth of the closest hit, and
+     * \c u, \c v receive its curve parameter and position across the ribbon.
+     */
+    bool recursiveIntersect(const Vector3f cp[4], float u0, float u1, float w0, float w1,
+                            int depth, float zMin, float &zMax, float &u, float &v) const {
+        if (depth > 0) {
+            Vector3f cpSplit[7];
+            subdivideBezier(cp, cpSplit);
+            float us[3] = { u0, 0.5f * (u0 + u1), u1 };
+            bool hit = false;
+            for (int seg=0; seg<2; ++seg) {
+                const Vector3f *cps = cpSplit + 3 * seg;
+                float width = std::max((1 - us[seg]) * w0 + us[seg] * w1,
+                                       (1 - us[seg+1]) * w0 + us[seg+1] * w1);
+                if (!overlaps(cps, width, zMin, zMax))
+                    continue;
+                hit |= recursiveIntersect(cps, us[seg], us[seg+1], w0, w1,
+                                          depth - 1, zMin, zMax, u, v);
+            }
+            return hit;
+        }
+
+        /* Test the origin against the perpendiculars of the tangents at the
+           end points, so that neighboring pieces don't both report a hit */
+        if ((cp[1].x() - cp[0].x()) * -cp[0].x() + (cp[1].y() - cp[0].y()) * -cp[0].y() < 0)
+            return false;
+        if ((cp[2].x() - cp[3].x()) * -cp[3].x() + (cp[2].y() - cp[3].y()) * -cp[3].y() < 0)
+            return false;
+
+        /* Closest point to the ray on the linearized piece */
+        Vector2f dir = cp[3].head<2>() - cp[0].head<2>();
+        float denom = dir.squaredNorm();
+        if (denom == 0)
+            return false;
+        float w = -cp[0].head<2>().dot(dir) / denom;
+        float uHit = clamp((1 - w) * u0 + w * u1, u0, u1);
+        float hitWidth = (1 - uHit) * w0 + uHit * w1;
+
+        Vector3f deriv;
+        Vector3f pc = evalBezier(cp, clamp(w, 0.0f, 1.0f), &deriv);
+        float dist2 = pc.x() * pc.x() + pc.y() * pc.y();
+        if (dist2 > 0.25f * hitWidth * hitWidth || pc.z() < zMin || pc.z() > zMax)
+            return false;
+
+        /* Which side of the center line was hit? */
+        float dist = std::sqrt(dist2);
+        float edge = deriv.x() * -pc.y() + pc.x() * deriv.y();
+        u = uHit;
+        v = hitWidth > 0 ? (edge > 0 ? 0.5f + dist / hitWidth : 0.5f - dist / hitWidth) : 0.5f;
+        zMax = pc.z();
+        return true;
+    }
+
+    /// Approximate area of a segment (average of chord and hull length times width)
+    float segmentArea(uint32_t index) const {
+        Point3f cp[4];
+        float w0, w1;
+        getSegment(index, cp, w0, w1);
+        float hull = (cp[1] - cp[0]).norm() + (cp[2] - cp[1]).norm() + (cp[3] - cp[2]).norm();
+        float chord = (cp[3] - cp[0]).norm();
+        return 0.5f * (hull + chord) * 0.5f * (w0 + w1);
+    }
+
+private:
+    MatrixXf m_points;                ///< Control points (4 x n: position and width)
+    std::vector<uint32_t> m_segments; ///< Index of the first control point of each segment
+    float m_surfaceArea = 0.0f;       ///< Approximate area of all segments
+};
+
+NORI_REGISTER_CLASS(Curves, "curves");
+NORI_NAMESPACE_END
@@ -0,0 +1,381 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+*/
+
+#include <nori/distributed.h>
+#include <nori/socket.h>
+#include <nori/block.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/sampler.h>
+#include <nori/timer.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#if !defined(_WIN32)
+#  include <sys/socket.h>
+#  include <poll.h>
+#  include <unistd.h>
+#endif
+
+NORI_NAMESPACE_BEGIN
+
+namespace {
+    /// Message sent by a worker after connecting
+    struct HelloMessage {
+        char magic[8];
+        uint32_t version;
+        int32_t width, height;
+        int32_t borderSize;
+        int32_t blockCount;
+    };
+
+    /// Message sent by the coordinator to request a block (or to finish)
+    struct JobMessage {
+        uint32_t type;
+        uint32_t pass;
+        uint32_t block;
+        uint32_t sampleCount;
+    };
+
+    /// Message sent by a worker before the pixels of a rendered block
+    struct ResultMessage {
+        uint32_t pass;
+        uint32_t block;
+        int32_t rows, cols;
+    };
+
+    enum EJobType {
+        ERenderBlock = 0,
+        EQuit
+    };
+
+    const char *protocolMagic = "NORIDST";
+    const uint32_t protocolVersion = 1;
+
+    /// A block of a pass that was handed out to a worker
+    struct Job {
+        uint32_t pass;
+        uint32_t block;
+        uint32_t sampleCount;
+    };
+
+    /**
+     * \brief Hands out the blocks of all passes to the connections
+     *
+     * A pass only starts once all blocks of the previous one were merged.
+     * The callback is invoked at that point with the index of the
+     * completed pass, and whether it was the last one. The scheduler
+     * gives up when all workers that connected have disconnected again.
+     */
+    class JobScheduler {
+    public:
+        typedef std::function<void (uint32_t, bool)> PassCallback;
+
+        JobScheduler(uint32_t blockCount, uint32_t sampleCount, uint32_t passSize,
+                     const PassCallback &callback)
+            : m_blockCount(blockCount), m_sampleCount(sampleCount),
+              m_passSize(passSize), m_callback(callback) {
+            startPass();
+        }
+
+        /// Wait for a job. Returns \c false when all passes are done (or aborted).
+        bool acquire(Job &job) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [&] { return m_done || m_aborted || !m_pending.empty(); });
+            if (m_done || m_aborted)
+                return false;
+            job.pass = m_pass;
+            job.block = m_pending.front();
+            job.sampleCount = m_passSamples;
+            m_pending.pop_front();
+            return true;
+        }
+
+        /// Mark a job as done after its block was merged into the image
+        void complete(const Job &) {
+            uint32_t pass;
+            bool last;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (++m_completed < m_blockCount)
+                    return;
+                m_renderedSamples += m_passSamples;
+                last = m_renderedSamples >= m_sampleCount;
+                pass = m_pass;
+            }
+
+            /* No blocks are handed out until the next pass starts, so the
+               callback can run without blocking the other connections */
+            m_callback(pass, last);
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (last) {
+                m_done = true;
+            } else {
+                ++m_pass;
+                startPass();
+            }
+            m_cond.notify_all();
+        }
+
+        /// Hand out the block of a job again (e.g. when its worker disconnected)
+        void fail(const Job &job) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_pending.push_front(job.block);
+            m_cond.notify_one();
+        }
+
+        /// Register a worker connection
+        void addWorker() {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_workers;
+        }
+
+        /// Unregister a worker connection, and give up if it was the last one
+        void removeWorker() {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (--m_workers == 0 && !m_done) {
+                m_aborted = true;
+                m_cond.notify_all();
+            }
+        }
+
+        /// Are all passes done (or was the job aborted)?
+        bool isDone() {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_done || m_aborted;
+        }
+
+        /// Did all workers disconnect before the passes were done?
+        bool isAborted() {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_aborted;
+        }
+
+    private:
+        void startPass() {
+            m_completed = 0;
+            m_passSamples = std::min(m_passSize, m_sampleCount - m_renderedSamples);
+            for (uint32_t i=0; i<m_blockCount; ++i)
+                m_pending.push_back(i);
+        }
+
+        std::mutex m_mutex;
+        std::condition_variable m_cond;
+        std::deque<uint32_t> m_pending;   ///< Blocks of the current pass that weren't handed out
+        uint32_t m_blockCount, m_sampleCount, m_passSize;
+        uint32_t m_pass = 0, m_passSamples = 0, m_renderedSamples = 0, m_completed = 0;
+        uint32_t m_workers = 0;           ///< Number of connected workers
+        bool m_done = false, m_aborted = false;
+        PassCallback m_callback;
+    };
+
+    /// Return the size (including the border) of the pixels of a block that are transmitted
+    Vector2i transmittedSize(const BlockGenerator &generator, const Vector2i &outputSize,
+                             uint32_t block, int borderSize) {
+        const Point2i &offset = generator.getBlockOffset((int) block);
+        Vector2i size = (outputSize - offset).cwiseMin(Vector2i::Constant(generator.getBlockSize()));
+        return size + Vector2i::Constant(2 * borderSize);
+    }
+};
+
+RenderCoordinator::RenderCoordinator(const std::string &address) : m_address(address) {
+#if defined(_WIN32)
+    throw NoriException("RenderCoordinator: distributed rendering is not supported on Windows!");
+#else
+    m_socket = openSocket(address, true);
+#endif
+}
+
+RenderCoordinator::~RenderCoordinator() {
+#if !defined(_WIN32)
+    if (m_socket != -1) {
+        close(m_socket);
+        if (m_address.compare(0, 5, "unix:") == 0)
+            unlink(m_address.substr(5).c_str());
+    }
+#endif
+}
+
+void RenderCoordinator::render(const BlockGenerator &generator, BlockAccumulator &accumulator,
+                               const ReconstructionFilter *filter, uint32_t sampleCount,
+                               uint32_t passSize, const PassCallback &callback) {
+#if !defined(_WIN32)
+    const ImageBlock &image = accumulator.getImage();
+    Vector2i outputSize = image.getSize();
+    int borderSize = image.getBorderSize();
+
+    JobScheduler scheduler((uint32_t) generator.getBlockCount(), sampleCount, passSize,
+        [&](uint32_t pass, bool last) {
+            callback(pass);
+            if (!last)
+                accumulator.nextPass();
+        }
+    );
+
+    /* Every connection is served by a separate thread */
+    auto serve = [&](int fd) {
+        HelloMessage hello;
+        if (!recvAll(fd, &hello, sizeof(HelloMessage)) ||
+            memcmp(hello.magic, protocolMagic, 8) != 0 ||
+            hello.version != protocolVersion) {
+            cerr << "Warning: rejected a connection that doesn't speak the protocol." << endl;
+            close(fd);
+            return;
+        }
+        if (hello.width != outputSize.x() || hello.height != outputSize.y() ||
+            hello.borderSize != borderSize || hello.blockCount != generator.getBlockCount()) {
+            cerr << "Warning: rejected a worker that loaded a different scene." << endl;
+            JobMessage quit = { EQuit, 0, 0, 0 };
+            sendAll(fd, &quit, sizeof(JobMessage));
+            close(fd);
+            return;
+        }
+
+        scheduler.addWorker();
+        ImageBlock block(Vector2i(generator.getBlockSize()), filter);
+        ImageBlock::Base pixels;
+        Job job;
+        while (scheduler.acquire(job)) {
+            JobMessage request = { ERenderBlock, job.pass, job.block, job.sampleCount };
+            ResultMessage result;
+            Vector2i size = transmittedSize(generator, outputSize, job.block, borderSize);
+
+            bool success = sendAll(fd, &request, sizeof(JobMessage)) &&
+                recvAll(fd, &result, sizeof(ResultMessage)) &&
+                result.pass == job.pass && result.block == job.block &&
+                result.rows == size.y() && result.cols == size.x();
+            if (success) {
+                pixels.resize(size.y(), size.x());
+                success = recvAll(fd, pixels.data(), sizeof(Color4f) * pixels.size());
+            }
+            if (!success) {
+                cerr << "Warning: lost a worker, handing out its block again." << endl;
+                scheduler.fail(job);
+                scheduler.removeWorker();
+                close(fd);
+                return;
+            }
+
+            /* Merge the block, borders included, into the image */
+            const Point2i &offset = generator.getBlockOffset((int) job.block);
+            block.setOffset(offset);
+            block.setSize(size - Vector2i::Constant(2 * borderSize));
+            block.topLeftCorner(size.y(), size.x()) = pixels;
+            accumulator.put(block);
+            scheduler.complete(job);
+        }
+
+        JobMessage quit = { EQuit, 0, 0, 0 };
+        sendAll(fd, &quit, sizeof(JobMessage));
+        scheduler.removeWorker();
+        close(fd);
+    };
+
+    /* Accept connections until all passes are done */
+    std::vector<std::thread> threads;
+    while (!scheduler.isDone()) {
+        pollfd pfd = { m_socket, POLLIN, 0 };
+        if (poll(&pfd, 1, 100) <= 0)
+            continue;
+        int fd = acceptSocket(m_socket);
+        if (fd != -1)
+            threads.emplace_back(serve, fd);
+    }
+
+    for (auto &thread : threads)
+        thread.join();
+
+    if (scheduler.isAborted())
+        throw NoriException("RenderCoordinator: all workers disconnected before the "
+                            "image was finished!");
+#endif
+}
+
+void RenderWorker::run(const std::string &address, const Scene *scene,
+                       int threadCount, const RenderFunction &renderFunction) {
+#if defined(_WIN32)
+    throw NoriException("RenderWorker: distributed rendering is not supported on Windows!");
+#else
+    const Camera *camera = scene->getCamera();
+    Vector2i outputSize = camera->getOutputSize();
+    BlockGenerator generator(outputSize, NORI_BLOCK_SIZE);
+    if (threadCount <= 0)
+        threadCount = std::max(1, (int) std::thread::hardware_concurrency());
+
+    cout << "Rendering blocks for the coordinator at \"" << address << "\" .. ";
+    cout.flush();
+    Timer timer;
+    std::atomic<int> blocksRendered(0);
+
+    auto work = [&]() {
+        /* The coordinator may not have started listening yet */
+        int fd = -1;
+        for (int attempt = 0; attempt < 100 && fd == -1; ++attempt) {
+            fd = openSocket(address, false);
+            if (fd == -1)
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        if (fd == -1)
+            throw NoriException("Unable to connect to \"%s\"!", address);
+
+        ImageBlock block(Vector2i(NORI_BLOCK_SIZE), camera->getReconstructionFilter());
+        std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
+
+        HelloMessage hello;
+        memset(&hello, 0, sizeof(HelloMessage));
+        memcpy(hello.magic, protocolMagic, 8);
+        hello.version = protocolVersion;
+        hello.width = outputSize.x();
+        hello.height = outputSize.y();
+        hello.borderSize = block.getBorderSize();
+        hello.blockCount = generator.getBlockCount();
+
+        JobMessage job;
+        bool success = sendAll(fd, &hello, sizeof(HelloMessage));
+        while (success && recvAll(fd, &job, sizeof(JobMessage)) && job.type == ERenderBlock) {
+            if (job.block >= (uint32_t) generator.getBlockCount())
+                break;
+            const Point2i &offset = generator.getBlockOffset((int) job.block);
+            block.setOffset(offset);
+            block.setSize((outputSize - offset).cwiseMin(Vector2i::Constant(NORI_BLOCK_SIZE)));
+            renderFunction(block, sampler.get(), job.pass, job.sampleCount);
+
+            Vector2i size = transmittedSize(generator, outputSize, job.block, block.getBorderSize());
+            ImageBlock::Base pixels = block.topLeftCorner(size.y(), size.x());
+            ResultMessage result = { job.pass, job.block, size.y(), size.x() };
+            success = sendAll(fd, &result, sizeof(ResultMessage)) &&
+                      sendAll(fd, pixels.data(), sizeof(Color4f) * pixels.size());
+            ++blocksRendered;
+        }
+        close(fd);
+    };
+
+    std::vector<std::thread> threads;
+    std::vector<std::string> errors(threadCount);
+    for (int i=0; i<threadCount; ++i) {
+        threads.emplace_back([&, i]() {
+            try {
+                work();
+            } catch (const std::exception &e) {
+                errors[i] = e.what();
+            }
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+
+    for (const std::string &error : errors)
+        if (!error.empty())
+            throw NoriException("%s", error);
+
+    cout << "done. (" << blocksRendered.load() << " blocks, took " << timer.elapsedString() << ")" << endl;
+#endif
+}
+
+NORI_NAMESPACE_END
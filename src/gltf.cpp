@@ -0,0 +1,681 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+*/
+
+#include <nori/instance.h>
+#include <nori/timer.h>
+#include <filesystem/resolver.h>
+#include <Eigen/Geometry>
+#include <fstream>
+#include <map>
+#include <set>
+
+#if !defined(_WIN32)
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+NORI_NAMESPACE_BEGIN
+
+namespace {
+    /// Minimal JSON document model (sufficient for glTF headers)
+    struct JSONValue {
+        enum EType { ENull, EBoolean, ENumber, EString, EArray, EObject };
+
+        EType type = ENull;
+        double number = 0;
+        std::string string;
+        std::vector<JSONValue> array;
+        std::map<std::string, JSONValue> object;
+
+        bool has(const std::string &key) const {
+            return type == EObject && object.find(key) != object.end();
+        }
+
+        const JSONValue &operator[](const std::string &key) const {
+            static const JSONValue null;
+            if (type != EObject)
+                return null;
+            auto it = object.find(key);
+            return it != object.end() ? it->second : null;
+        }
+
+        const JSONValue &operator[](size_t index) const {
+            static const JSONValue null;
+            return (type == EArray && index < array.size()) ? array[index] : null;
+        }
+
+        size_t size() const { return type == EArray ? array.size() : 0; }
+
+        double getNumber(const std::string &key, double defaultValue) const {
+            const JSONValue &value = operator[](key);
+            return value.type == ENumber ? value.number : defaultValue;
+        }
+
+        uint32_t getIndex(const std::string &key) const {
+            const JSONValue &value = operator[](key);
+            if (value.type != ENumber)
+                throw NoriException("glTF: missing property \"%s\"!", key);
+            return (uint32_t) value.number;
+        }
+    };
+
+    /// Recursive descent parser for JSON text
+    class JSONParser {
+    public:
+        JSONParser(const char *begin, const char *end) : m_pos(begin), m_end(end) { }
+
+        JSONValue parse() {
+            JSONValue value = parseValue();
+            skipWhitespace();
+            if (m_pos != m_end && *m_pos != '\0')
+                error("trailing characters");
+            return value;
+        }
+
+    private:
+        JSONValue parseValue() {
+            skipWhitespace();
+            if (m_pos == m_end)
+                error("unexpected end of input");
+
+            JSONValue value;
+            char c = *m_pos;
+            if (c == '{') {
+                value.type = JSONValue::EObject;
+                ++m_pos;
+                if (!consume('}')) {
+                    do {
+                        skipWhitespace();
+                        std::string key = parseString();
+                        if (!consume(':'))
+                            error("expected ':'");
+                        value.object[key] = parseValue();
+                    } while (consume(','));
+                    if (!consume('}'))
+                        error("expected '}'");
+                }
+            } else if (c == '[') {
+                value.type = JSONValue::EArray;
+                ++m_pos;
+                if (!consume(']')) {
+                    do {
+                        value.array.push_back(parseValue());
+                    } while (consume(','));
+                    if (!consume(']'))
+                        error("expected ']'");
+                }
+            } else if (c == '"') {
+                value.type = JSONValue::EString;
+                value.string = parseString();
+            } else if (match("true")) {
+                value.type = JSONValue::EBoolean;
+                value.number = 1;
+            } else if (match("false")) {
+                value.type = JSONValue::EBoolean;
+            } else if (match("null")) {
+                value.type = JSONValue::ENull;
+            } else {
+                char *numberEnd = nullptr;
+                std::string token(m_pos, std::min(m_end, m_pos + 64));
+                value.type = JSONValue::ENumber;
+                value.number = std::strtod(token.c_str(), &numberEnd);
+                if (numberEnd == token.c_str())
+                    error("invalid value");
+                m_pos += numberEnd - token.c_str();
+            }
+            return value;
+        }
+
+        std::string parseString() {
+            if (m_pos == m_end || *m_pos != '"')
+                error("expected a string");
+            ++m_pos;
+            std::string result;
+            while (m_pos != m_end && *m_pos != '"') {
+                char c = *m_pos++;
+                if (c == '\\' && m_pos != m_end) {
+                    char e = *m_pos++;
+                    switch (e) {
+                        case 'n': result += '\n'; break;
+                        case 't': result += '\t'; break;
+                        case 'r': result += '\r'; break;
+                        case 'b': result += '\b'; break;
+                        case 'f': result += '\f'; break;
+                        case 'u':
+                            /* Names are only used in messages, so non-ASCII
+                               characters are replaced */
+                            if (m_end - m_pos < 4)
+                                error("invalid escape sequence");
+                            m_pos += 4;
+                            result += '?';
+                            break;
+                        default: result += e; break;
+                    }
+                } else {
+                    result += c;
+                }
+            }
+            if (m_pos == m_end)
+                error("unterminated string");
+            ++m_pos;
+            return result;
+        }
+
+        void skipWhitespace() {
+            while (m_pos != m_end && (*m_pos == ' ' || *m_pos == '\t' ||
+                                      *m_pos == '\n' || *m_pos == '\r'))
+                ++m_pos;
+        }
+
+        bool consume(char c) {
+            skipWhitespace();
+            if (m_pos != m_end && *m_pos == c) {
+                ++m_pos;
+                return true;
+            }
+            return false;
+        }
+
+        bool match(const char *word) {
+            size_t length = strlen(word);
+            if ((size_t) (m_end - m_pos) < length || strncmp(m_pos, word, length) != 0)
+                return false;
+            m_pos += length;
+            return true;
+        }
+
+        void error(const char *message) const {
+            throw NoriException("glTF: invalid JSON chunk (%s)!", message);
+        }
+
+    private:
+        const char *m_pos, *m_end;
+    };
+
+    /// glTF component types
+    enum EComponentType {
+        EByte = 5120, EUnsignedByte = 5121, EShort = 5122,
+        EUnsignedShort = 5123, EUnsignedInt = 5125, EFloat = 5126
+    };
+
+    size_t componentSize(int type) {
+        switch (type) {
+            case EByte: case EUnsignedByte: return 1;
+            case EShort: case EUnsignedShort: return 2;
+            case EUnsignedInt: case EFloat: return 4;
+            default: throw NoriException("glTF: unsupported component type %i!", type);
+        }
+    }
+
+    /// Read a single component and convert it to double precision
+    double readComponent(const uint8_t *ptr, int type, bool normalized) {
+        switch (type) {
+            case EByte: { int8_t v; memcpy(&v, ptr, 1);
+                return normalized ? std::max(v / 127.0, -1.0) : v; }
+            case EUnsignedByte: { uint8_t v; memcpy(&v, ptr, 1);
+                return normalized ? v / 255.0 : v; }
+            case EShort: { int16_t v; memcpy(&v, ptr, 2);
+                return normalized ? std::max(v / 32767.0, -1.0) : v; }
+            case EUnsignedShort: { uint16_t v; memcpy(&v, ptr, 2);
+                return normalized ? v / 65535.0 : v; }
+            case EUnsignedInt: { uint32_t v; memcpy(&v, ptr, 4); return v; }
+            case EFloat: { float v; memcpy(&v, ptr, 4); return v; }
+            default: throw NoriException("glTF: unsupported component type %i!", type);
+        }
+    }
+
+    template <typename Scalar> struct ComponentType { };
+    template <> struct ComponentType<float>    { static const int value = EFloat; };
+    template <> struct ComponentType<uint32_t> { static const int value = EUnsignedInt; };
+    template <> struct ComponentType<uint16_t> { static const int value = EUnsignedShort; };
+
+    /// Mesh whose buffers were imported from a glTF file
+    class GLTFMesh : public Mesh {
+    public:
+        GLTFMesh(const std::string &name) {
+            m_name = name;
+            m_mappedGeometry = true;
+        }
+
+        void setBuffers(MeshBuffer<float> &&V, MeshBuffer<float> &&N,
+                        MeshBuffer<float> &&UV, MeshBuffer<uint32_t> &&F,
+                        MeshBuffer<uint16_t> &&F16) {
+            m_V = std::move(V);
+            m_N = std::move(N);
+            m_UV = std::move(UV);
+            m_F = std::move(F);
+            m_F16 = std::move(F16);
+            for (uint32_t i=0; i<(uint32_t) m_V.cols(); ++i)
+                m_bbox.expandBy(m_V.col(i));
+        }
+    };
+};
+
+/**
+ * \brief Loader for binary glTF 2.0 files (.glb)
+ *
+ * The file is memory-mapped, and vertex and index buffers point directly
+ * into it whenever the layout of an accessor matches the in-memory
+ * layout of \ref Mesh (tightly packed, aligned 32-bit floats, or 16/32-bit
+ * indices). Other accessors are converted into a copy. Texture coordinates
+ * are always copied, since glTF places their origin at the top left.
+ *
+ * Every triangle primitive of a glTF mesh becomes a \ref Mesh in object
+ * space. Nodes that reference a mesh are imported as \ref Instance shapes
+ * with the concatenated node transformations, except for the first
+ * untransformed use of a mesh, which is registered directly.
+ * Materials, cameras and external buffers are not supported.
+ *
+ * <pre>
+ * &lt;shape type="glb"&gt;
+ *     &lt;string name="filename" value="city.glb"/&gt;
+ *     &lt;transform name="toWorld"&gt; ... &lt;/transform&gt;
+ * &lt;/shape&gt;
+ * </pre>
+ */
+class GLTFScene : public Shape {
+public:
+    GLTFScene(const PropertyList &propList) {
+        filesystem::path filename =
+            getFileResolver()->resolve(propList.getString("filename"));
+        Transform toWorld = propList.getTransform("toWorld", Transform());
+        m_name = filename.str();
+        if (propList.has("alphaMask"))
+            throw NoriException("\"%s\": opacity masks are not supported for glTF "
+                                "scenes!", m_name);
+
+        cout << "Loading \"" << filename << "\" .. ";
+        cout.flush();
+        Timer timer;
+
+        map(filename.str());
+        parse();
+
+        /* Instantiate the nodes of the default scene */
+        const JSONValue &scenes = m_json["scenes"];
+        if (scenes.size() > 0) {
+            const JSONValue &roots = scenes[(size_t) m_json.getNumber("scene", 0)]["nodes"];
+            for (size_t i=0; i<roots.size(); ++i)
+                addNode((uint32_t) roots[i].number, toWorld, 0);
+        } else {
+            /* No scene: use all nodes that aren't children of another node */
+            const JSONValue &nodes = m_json["nodes"];
+            std::vector<bool> isChild(nodes.size(), false);
+            for (size_t i=0; i<nodes.size(); ++i) {
+                const JSONValue &children = nodes[i]["children"];
+                for (size_t j=0; j<children.size(); ++j)
+                    if ((size_t) children[j].number < isChild.size())
+                        isChild[(size_t) children[j].number] = true;
+            }
+            for (size_t i=0; i<nodes.size(); ++i)
+                if (!isChild[i])
+                    addNode((uint32_t) i, toWorld, 0);
+        }
+
+        size_t meshCount = 0;
+        for (const auto &primitives : m_meshes)
+            meshCount += primitives.size();
+
+        cout << "done. (" << meshCount << " meshes, "
+             << m_elements.size() - m_directCount << " instances, "
+             << memString(m_mappedBytes) << " of " << memString(m_mappedBytes + m_copiedBytes)
+             << " used in place, took " << timer.elapsedString() << ")" << endl;
+
+        /* Release the JSON header and the meshes that aren't used */
+        m_json = JSONValue();
+        for (auto &primitives : m_meshes) {
+            for (Mesh *&mesh : primitives) {
+                if (mesh && !m_used.count(mesh)) {
+                    delete mesh;
+                    mesh = nullptr;
+                }
+            }
+        }
+    }
+
+    ~GLTFScene() {
+        for (Shape *element : m_elements)
+            if (element->getClassType() != EMesh)
+                delete element;
+        for (auto &primitives : m_meshes)
+            for (Mesh *mesh : primitives)
+                delete mesh;
+    }
+
+    void activate() {
+        /* Meshes must be ready before their instances */
+        for (auto &primitives : m_meshes)
+            for (Mesh *mesh : primitives)
+                if (mesh)
+                    mesh->activate();
+        for (Shape *element : m_elements) {
+            if (element->getClassType() != EMesh)
+                element->activate();
+            m_bbox.expandBy(element->getBoundingBox());
+        }
+    }
+
+    bool isCompound() const { return true; }
+
+    Shape *getElement(size_t index) {
+        return index < m_elements.size() ? m_elements[index] : nullptr;
+    }
+
+    /* The elements are intersected instead of the compound shape */
+    uint32_t getPrimitiveCount() const { return 0; }
+    BoundingBox3f getBoundingBox(uint32_t) const { return m_bbox; }
+    Point3f getCentroid(uint32_t) const { return m_bbox.getCenter(); }
+    bool rayIntersect(uint32_t, const Ray3f &, float &, float &, float &) const { return false; }
+
+    void setHitInformation(uint32_t, const Ray3f &, Intersection &) const {
+        throw NoriException("GLTFScene::setHitInformation(): not supported!");
+    }
+
+    float getSurfaceArea() const {
+        float area = 0;
+        for (const Shape *element : m_elements)
+            area += element->getSurfaceArea();
+        return area;
+    }
+
+    void samplePosition(const Point2f &, Point3f &, Normal3f &, float &) const {
+        throw NoriException("GLTFScene::samplePosition(): sample the elements instead!");
+    }
+
+    void addChild(NoriObject *obj) {
+        throw NoriException("GLTFScene::addChild(<%s>) is not supported!",
+                            classTypeName(obj->getClassType()));
+    }
+
+    std::string toString() const {
+        return tfm::format(
+            "GLTFScene[\n"
+            "  filename = \"%s\",\n"
+            "  elements = %i\n"
+            "]",
+            m_name,
+            m_elements.size()
+        );
+    }
+
+private:
+    /// Map the file into memory (or read it on platforms without mmap)
+    void map(const std::string &filename) {
+#if defined(_WIN32)
+        std::ifstream is(filename, std::ios::binary | std::ios::ate);
+        if (is.fail())
+            throw NoriException("Unable to open glTF file \"%s\"!", filename);
+        auto data = std::make_shared<std::vector<uint8_t>>((size_t) is.tellg());
+        is.seekg(0);
+        if (!is.read((char *) data->data(), data->size()))
+            throw NoriException("Unable to read glTF file \"%s\"!", filename);
+        m_data = data->data();
+        m_size = data->size();
+        m_owner = data;
+#else
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd == -1)
+            throw NoriException("Unable to open glTF file \"%s\"!", filename);
+
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) != 0) {
+            close(fd);
+            throw NoriException("Unable to query the size of \"%s\"!", filename);
+        }
+        size_t size = (size_t) fileStat.st_size;
+
+        void *ptr = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (ptr == MAP_FAILED)
+            throw NoriException("Unable to map glTF file \"%s\"!", filename);
+
+        m_data = (const uint8_t *) ptr;
+        m_size = size;
+        /* The mapping stays alive as long as a buffer references it */
+        m_owner = std::shared_ptr<const void>(ptr, [size](const void *p) {
+            munmap(const_cast<void *>(p), size);
+        });
+#endif
+    }
+
+    /// Read the header and chunks of the binary container
+    void parse() {
+        struct { uint32_t magic, version, length; } header;
+        if (m_size < sizeof(header))
+            throw NoriException("\"%s\" is not a binary glTF file!", m_name);
+        memcpy(&header, m_data, sizeof(header));
+        if (header.magic != 0x46546C67 /* glTF */ || header.length > m_size)
+            throw NoriException("\"%s\" is not a binary glTF file!", m_name);
+        if (header.version != 2)
+            throw NoriException("\"%s\": unsupported glTF version %i!", m_name, header.version);
+
+        size_t offset = sizeof(header);
+        while (offset + 8 <= header.length) {
+            uint32_t chunkLength, chunkType;
+            memcpy(&chunkLength, m_data + offset, 4);
+            memcpy(&chunkType, m_data + offset + 4, 4);
+            offset += 8;
+            if (offset + chunkLength > header.length)
+                throw NoriException("\"%s\": truncated glTF chunk!", m_name);
+
+            if (chunkType == 0x4E4F534A /* JSON */ && m_json.type == JSONValue::ENull) {
+                const char *text = (const char *) m_data + offset;
+                m_json = JSONParser(text, text + chunkLength).parse();
+            } else if (chunkType == 0x004E4942 /* BIN */ && !m_binary) {
+                m_binary = m_data + offset;
+                m_binarySize = chunkLength;
+            }
+            offset += (chunkLength + 3) & ~3u;
+        }
+
+        if (m_json.type != JSONValue::EObject)
+            throw NoriException("\"%s\": the JSON chunk is missing!", m_name);
+        m_meshes.resize(m_json["meshes"].size());
+    }
+
+    /// Instantiate a node and its children
+    void addNode(uint32_t index, const Transform &parent, int depth) {
+        const JSONValue &node = m_json["nodes"][index];
+        if (node.type != JSONValue::EObject || depth > 64)
+            throw NoriException("\"%s\": invalid node %i!", m_name, index);
+
+        Eigen::Matrix4f local = Eigen::Matrix4f::Identity();
+        if (node.has("matrix")) {
+            const JSONValue &m = node["matrix"];
+            for (int i=0; i<16; ++i)
+                local(i % 4, i / 4) = (float) m[i].number; /* column-major */
+        } else {
+            const JSONValue &t = node["translation"], &r = node["rotation"], &s = node["scale"];
+            Eigen::Affine3f affine = Eigen::Affine3f::Identity();
+            if (t.size() == 3)
+                affine.translate(Eigen::Vector3f(t[0].number, t[1].number, t[2].number));
+            if (r.size() == 4)
+                affine.rotate(Eigen::Quaternionf(r[3].number, r[0].number,
+                                                 r[1].number, r[2].number).normalized());
+            if (s.size() == 3)
+                affine.scale(Eigen::Vector3f(s[0].number, s[1].number, s[2].number));
+            local = affine.matrix();
+        }
+        Transform toWorld = parent * Transform(local);
+
+        if (node.has("mesh")) {
+            uint32_t meshIndex = node.getIndex("mesh");
+            if (meshIndex >= m_meshes.size())
+                throw NoriException("\"%s\": invalid mesh index %i!", m_name, meshIndex);
+            if (m_meshes[meshIndex].empty())
+                loadMesh(meshIndex);
+
+            bool identity = toWorld.getMatrix() == Eigen::Matrix4f::Identity();
+            for (Mesh *mesh : m_meshes[meshIndex]) {
+                if (!mesh)
+                    continue;
+                if (identity && !m_used.count(mesh)) {
+                    m_elements.push_back(mesh);
+                    m_directCount++;
+                } else {
+                    m_elements.push_back(new Instance(mesh, toWorld));
+                }
+                m_used.insert(mesh);
+            }
+        }
+
+        const JSONValue &children = node["children"];
+        for (size_t i=0; i<children.size(); ++i)
+            addNode((uint32_t) children[i].number, toWorld, depth + 1);
+    }
+
+    /// Create the meshes of the triangle primitives of a glTF mesh
+    void loadMesh(uint32_t index) {
+        const JSONValue &desc = m_json["meshes"][index];
+        const JSONValue &primitives = desc["primitives"];
+        std::string name = desc["name"].type == JSONValue::EString
+            ? desc["name"].string : tfm::format("mesh %i", index);
+
+        for (size_t i=0; i<primitives.size(); ++i) {
+            const JSONValue &primitive = primitives[i];
+            const JSONValue &attributes = primitive["attributes"];
+            if (primitive.getNumber("mode", 4) != 4 || !attributes.has("POSITION")) {
+                cerr << "Warning: skipping a non-triangle primitive of \"" << name
+                     << "\" in \"" << m_name << "\"" << endl;
+                m_meshes[index].push_back(nullptr);
+                continue;
+            }
+
+            uint32_t vertexCount = (uint32_t) m_json["accessors"][
+                attributes.getIndex("POSITION")]["count"].number;
+
+            MeshBuffer<float> V = accessor<float>(attributes.getIndex("POSITION"), 3, false);
+            MeshBuffer<float> N, UV;
+            if (attributes.has("NORMAL"))
+                N = accessor<float>(attributes.getIndex("NORMAL"), 3, false);
+            if (attributes.has("TEXCOORD_0"))
+                UV = accessor<float>(attributes.getIndex("TEXCOORD_0"), 2, true);
+
+            /* Use the stored index format (small indices are widened to 16 bit) */
+            MeshBuffer<uint32_t> F;
+            MeshBuffer<uint16_t> F16;
+            if (primitive.has("indices")) {
+                uint32_t indices = primitive.getIndex("indices");
+                int type = (int) m_json["accessors"][indices].getNumber("componentType", 0);
+                if (type == EUnsignedInt)
+                    F = accessor<uint32_t>(indices, 3, false);
+                else
+                    F16 = accessor<uint16_t>(indices, 3, false);
+            } else {
+                MatrixXu indices(3, vertexCount / 3);
+                for (uint32_t j=0; j<(uint32_t) indices.size(); ++j)
+                    indices(j) = j;
+                m_copiedBytes += indices.size() * sizeof(uint32_t);
+                F = std::move(indices);
+            }
+
+            uint32_t maxIndex = F.size() > 0 ? F.maxCoeff() : (F16.size() > 0 ? F16.maxCoeff() : 0);
+            if (maxIndex >= vertexCount && (F.size() > 0 || F16.size() > 0))
+                throw NoriException("\"%s\": out-of-range vertex index in \"%s\"!", m_name, name);
+
+            GLTFMesh *mesh = new GLTFMesh(primitives.size() > 1
+                ? tfm::format("%s[%i]", name, i) : name);
+            mesh->setBuffers(std::move(V), std::move(N), std::move(UV),
+                             std::move(F), std::move(F16));
+            m_meshes[index].push_back(mesh);
+        }
+    }
+
+    /**
+     * \brief Return the contents of an accessor as a buffer with \c rows rows
+     *
+     * The buffer references the mapped file if the layout matches, and
+     * otherwise holds a converted copy. \c flipV maps the glTF texture
+     * coordinate convention to Nori's (and always requires a copy).
+     */
+    template <typename Scalar>
+    MeshBuffer<Scalar> accessor(uint32_t index, int rows, bool flipV) {
+        const JSONValue &acc = m_json["accessors"][index];
+        if (acc.type != JSONValue::EObject)
+            throw NoriException("\"%s\": invalid accessor %i!", m_name, index);
+        if (acc.has("sparse"))
+            throw NoriException("\"%s\": sparse accessors are not supported!", m_name);
+
+        static const std::map<std::string, int> typeSizes = {
+            { "SCALAR", 1 }, { "VEC2", 2 }, { "VEC3", 3 }, { "VEC4", 4 }
+        };
+        auto typeSize = typeSizes.find(acc["type"].string);
+        if (typeSize == typeSizes.end())
+            throw NoriException("\"%s\": unsupported accessor type \"%s\"!", m_name, acc["type"].string);
+
+        int type = (int) acc.getNumber("componentType", 0);
+        int components = typeSize->second;
+        size_t count = (size_t) acc.getNumber("count", 0);
+        bool normalized = acc["normalized"].type == JSONValue::EBoolean && acc["normalized"].number != 0;
+        size_t elementSize = componentSize(type) * components;
+
+        /* Index accessors are flat lists that are regrouped into triangles */
+        size_t values = count * components;
+        if (values % rows != 0)
+            throw NoriException("\"%s\": accessor %i doesn't contain whole elements!", m_name, index);
+        size_t cols = values / rows;
+
+        if (!acc.has("bufferView")) {
+            /* Accessors without a buffer view are zero-initialized */
+            typename MeshBuffer<Scalar>::Matrix result =
+                MeshBuffer<Scalar>::Matrix::Zero(rows, cols);
+            m_copiedBytes += result.size() * sizeof(Scalar);
+            return result;
+        }
+
+        const JSONValue &view = m_json["bufferViews"][acc.getIndex("bufferView")];
+        if (view.getNumber("buffer", 0) != 0 || !m_binary)
+            throw NoriException("\"%s\": only the embedded binary buffer is supported!", m_name);
+
+        size_t offset = (size_t) view.getNumber("byteOffset", 0) +
+                        (size_t) acc.getNumber("byteOffset", 0);
+        size_t stride = (size_t) view.getNumber("byteStride", 0);
+        if (stride == 0)
+            stride = elementSize;
+        if (count > 0 && (offset + (count - 1) * stride + elementSize > m_binarySize ||
+                          (size_t) view.getNumber("byteLength", 0) + (size_t) view.getNumber("byteOffset", 0) > m_binarySize))
+            throw NoriException("\"%s\": accessor %i exceeds the binary buffer!", m_name, index);
+
+        const uint8_t *ptr = m_binary + offset;
+        if (type == ComponentType<Scalar>::value && !normalized && !flipV &&
+            stride == elementSize && (uintptr_t) ptr % alignof(Scalar) == 0) {
+            /* Use the data in place */
+            m_mappedBytes += values * sizeof(Scalar);
+            return MeshBuffer<Scalar>((const Scalar *) ptr, rows, cols, m_owner);
+        }
+
+        typename MeshBuffer<Scalar>::Matrix result(rows, cols);
+        size_t csize = componentSize(type);
+        for (size_t i=0; i<count; ++i) {
+            for (int k=0; k<components; ++k) {
+                double value = readComponent(ptr + i * stride + k * csize, type, normalized);
+                if (flipV && k == 1)
+                    value = 1.0 - value;
+                result(i * components + k) = (Scalar) value;
+            }
+        }
+        m_copiedBytes += result.size() * sizeof(Scalar);
+        return result;
+    }
+
+private:
+    const uint8_t *m_data = nullptr;
+    size_t m_size = 0;
+    std::shared_ptr<const void> m_owner;     ///< Keeps the mapping alive
+    const uint8_t *m_binary = nullptr;       ///< Embedded binary buffer
+    size_t m_binarySize = 0;
+    JSONValue m_json;
+    std::vector<std::vector<Mesh *>> m_meshes; ///< Meshes of every glTF mesh (one per primitive)
+    std::set<const Mesh *> m_used;           ///< Meshes that are referenced by a node
+    std::vector<Shape *> m_elements;         ///< Meshes and instances registered with the scene
+    size_t m_directCount = 0;                ///< Number of meshes registered without an instance
+    size_t m_mappedBytes = 0, m_copiedBytes = 0;
+};
+
+NORI_REGISTER_CLASS(GLTFScene, "glb");
+NORI_NAMESPACE_END
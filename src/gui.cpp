@@ -15,10 +15,11 @@
 
 NORI_NAMESPACE_BEGIN
 
-NoriScreen::NoriScreen(const ImageBlock &block)
+NoriScreen::NoriScreen(const ImageBlock &block, const BlockAccumulator *accumulator)
  : nanogui::Screen(nanogui::Vector2i(block.getSize().x(), block.getSize().y() + 36),
                    "Nori", false),
-   m_block(block) {
+   m_block(block), m_accumulator(accumulator),
+   m_uploaded(accumulator ? accumulator->getTileCount() : 0, 0) {
     using namespace nanogui;
     inc_ref();
 
@@ -111,6 +112,7 @@ NoriScreen::NoriScreen(const ImageBlock &block)
                           size.y() + 2 * m_block.getBorderSize()),
         Texture::InterpolationMode::Nearest,
         Texture::InterpolationMode::Nearest);
+    m_texture->upload((uint8_t *) m_block.data());
 
     draw_all();
     set_visible(true);
@@ -118,8 +120,21 @@ NoriScreen::NoriScreen(const ImageBlock &block)
 
 
 void NoriScreen::draw_contents() {
-    // Reload the partially rendered image onto the GPU
-    m_block.lock();
+    // Upload the tiles that were resolved since the last frame
+    int border = m_block.getBorderSize();
+    ImageBlock::Base pixels;
+    for (size_t i=0; i<m_uploaded.size(); ++i) {
+        int passes;
+        if (m_uploaded[i] == m_accumulator->getResolvedPasses((int) i) ||
+            !m_accumulator->readTile((int) i, pixels, passes))
+            continue;
+        Point2i offset = m_accumulator->getTileOffset((int) i);
+        m_texture->upload_sub_region((uint8_t *) pixels.data(),
+            nanogui::Vector2i(offset.x() + border, offset.y() + border),
+            nanogui::Vector2i((int) pixels.cols(), (int) pixels.rows()));
+        m_uploaded[i] = passes;
+    }
+
     const Vector2i &size = m_block.getSize();
     m_shader->set_uniform("scale", m_scale);
     m_renderPass->resize(framebuffer_size());
@@ -127,14 +142,12 @@ void NoriScreen::draw_contents() {
     m_renderPass->set_viewport(nanogui::Vector2i(0, 0),
                                nanogui::Vector2i(m_pixel_ratio * size[0],
                                                  m_pixel_ratio * size[1]));
-    m_texture->upload((uint8_t *) m_block.data());
     m_shader->set_texture("source", m_texture);
     m_shader->begin();
     m_shader->draw_array(nanogui::Shader::PrimitiveType::Triangle, 0, 6, true);
     m_shader->end();
     m_renderPass->set_viewport(nanogui::Vector2i(0, 0), framebuffer_size());
     m_renderPass->end();
-    m_block.unlock();
 }
 
 NORI_NAMESPACE_END
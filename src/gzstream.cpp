@@ -0,0 +1,192 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+*/
+
+#include <nori/gzstream.h>
+#include <zlib.h>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Stream buffer that receives decompressed blocks from a
+ * background thread
+ */
+class GZipStreamBuffer : public std::streambuf {
+public:
+    /// Size of a block of decompressed data
+    static const size_t BlockSize = 1024 * 1024;
+
+    /// Maximum number of decompressed blocks waiting to be read
+    static const size_t MaxQueuedBlocks = 4;
+
+    GZipStreamBuffer(const std::string &filename)
+        : m_filename(filename), m_file(filename, std::ios::binary) {
+        if (m_file.fail())
+            throw NoriException("Unable to open file \"%s\"!", filename);
+        m_thread = std::thread([this] { run(); });
+    }
+
+    ~GZipStreamBuffer() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cond.notify_all();
+        m_thread.join();
+    }
+
+protected:
+    int_type underflow() {
+        if (gptr() < egptr())
+            return traits_type::to_int_type(*gptr());
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        /* Hand the block that was just consumed back to the decompressor */
+        if (!m_current.empty()) {
+            m_free.push_back(std::move(m_current));
+            m_current.clear();
+            m_cond.notify_all();
+        }
+
+        m_cond.wait(lock, [this] { return !m_full.empty() || m_done; });
+
+        if (m_full.empty()) {
+            if (!m_error.empty())
+                throw NoriException("%s", m_error);
+            return traits_type::eof();
+        }
+
+        m_current = std::move(m_full.front());
+        m_full.pop_front();
+        m_cond.notify_all();
+        lock.unlock();
+
+        char *data = m_current.data();
+        setg(data, data, data + m_current.size());
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    /// Body of the decompression thread
+    void run() {
+        z_stream strm;
+        memset(&strm, 0, sizeof(z_stream));
+
+        /* Accept gzip (and zlib) headers */
+        if (inflateInit2(&strm, 16 + MAX_WBITS) != Z_OK) {
+            finish("Could not initialize the decompressor!");
+            return;
+        }
+
+        std::vector<char> input(256 * 1024);
+        std::vector<char> output;
+        bool eof = false, streamEnd = false;
+        std::string error;
+
+        while (error.empty()) {
+            if (output.empty()) {
+                /* Wait for a free block (or allocate a new one) */
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cond.wait(lock, [this] {
+                    return m_stop || m_full.size() < MaxQueuedBlocks;
+                });
+                if (m_stop)
+                    break;
+                if (!m_free.empty()) {
+                    output = std::move(m_free.back());
+                    m_free.pop_back();
+                }
+                lock.unlock();
+                output.resize(BlockSize);
+                strm.next_out = (Bytef *) output.data();
+                strm.avail_out = (uInt) output.size();
+            }
+
+            if (strm.avail_in == 0 && !eof) {
+                m_file.read(input.data(), input.size());
+                strm.next_in = (Bytef *) input.data();
+                strm.avail_in = (uInt) m_file.gcount();
+                eof = strm.avail_in == 0;
+            }
+
+            if (strm.avail_in == 0 && eof) {
+                if (!streamEnd)
+                    error = "unexpected end of file";
+                break;
+            }
+
+            if (streamEnd) {
+                /* Another gzip member follows the previous one */
+                inflateReset(&strm);
+                streamEnd = false;
+            }
+
+            int rv = inflate(&strm, Z_NO_FLUSH);
+            if (rv == Z_STREAM_END)
+                streamEnd = true;
+            else if (rv != Z_OK && rv != Z_BUF_ERROR)
+                error = strm.msg ? strm.msg : "corrupt data";
+
+            if (strm.avail_out == 0)
+                submit(output, output.size());
+        }
+
+        size_t used = output.size() - strm.avail_out;
+        if (!output.empty() && used > 0)
+            submit(output, used);
+
+        inflateEnd(&strm);
+        finish(error.empty() ? error :
+            tfm::format("Error while decompressing \"%s\": %s", m_filename, error));
+    }
+
+    /// Pass a block of decompressed data to the reader
+    void submit(std::vector<char> &block, size_t size) {
+        block.resize(size);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_full.push_back(std::move(block));
+        block.clear();
+        m_cond.notify_all();
+    }
+
+    /// Signal the end of the stream
+    void finish(const std::string &error) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_error = error;
+        m_done = true;
+        m_cond.notify_all();
+    }
+
+private:
+    std::string m_filename;
+    std::ifstream m_file;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::deque<std::vector<char>> m_full;   ///< Decompressed blocks waiting to be read
+    std::vector<std::vector<char>> m_free;  ///< Blocks that can be reused
+    std::vector<char> m_current;            ///< Block that is currently being read
+    std::string m_error;
+    bool m_done = false;
+    bool m_stop = false;
+};
+
+GZipInputStream::GZipInputStream(const std::string &filename)
+    : std::istream(nullptr), m_buffer(new GZipStreamBuffer(filename)) {
+    rdbuf(m_buffer.get());
+
+    /* Rethrow errors raised by the stream buffer */
+    exceptions(std::ios::badbit);
+}
+
+GZipInputStream::~GZipInputStream() { }
+
+NORI_NAMESPACE_END
@@ -33,10 +33,11 @@ public:
         return std::move(cloned);
     }
 
-    void prepare(const ImageBlock &block) {
+    void prepare(const ImageBlock &block, uint32_t pass) {
+        /* Every pass uses a different stream of the generator */
         m_random.seed(
             block.getOffset().x(),
-            block.getOffset().y()
+            block.getOffset().y() + ((uint64_t) pass << 32)
         );
     }
 
@@ -0,0 +1,101 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+*/
+
+#include <nori/instance.h>
+#include <nori/bsdf.h>
+#include <nori/emitter.h>
+#include <Eigen/Geometry>
+
+NORI_NAMESPACE_BEGIN
+
+Instance::Instance(const Mesh *mesh, const Transform &toWorld)
+    : m_mesh(mesh), m_toWorld(toWorld), m_toObject(toWorld.inverse()) {
+    m_name = mesh->getName();
+}
+
+void Instance::activate() {
+    Shape::activate();
+
+    /* Transform the corners of the mesh's bounding box */
+    const BoundingBox3f &bbox = m_mesh->getBoundingBox();
+    m_bbox.reset();
+    for (int i=0; i<8; ++i)
+        m_bbox.expandBy(m_toWorld * bbox.getCorner(i));
+
+    /* Triangle areas change under non-rigid transformations */
+    uint32_t triangleCount = m_mesh->getTriangleCount();
+    m_areaTable.clear();
+    m_areaTable.reserve(triangleCount);
+    for (uint32_t i=0; i<triangleCount; ++i) {
+        TriangleVertices tri;
+        m_mesh->getTriangle(i, tri);
+        Vector3f e1 = m_toWorld * Vector3f(tri.p[1] - tri.p[0]),
+                 e2 = m_toWorld * Vector3f(tri.p[2] - tri.p[0]);
+        m_areaTable.append(0.5f * e1.cross(e2).norm());
+    }
+    m_areaTable.normalize();
+}
+
+BoundingBox3f Instance::getBoundingBox(uint32_t index) const {
+    TriangleVertices tri;
+    m_mesh->getTriangle(index, tri);
+    BoundingBox3f result(m_toWorld * tri.p[0]);
+    result.expandBy(m_toWorld * tri.p[1]);
+    result.expandBy(m_toWorld * tri.p[2]);
+    return result;
+}
+
+void Instance::setHitInformation(uint32_t index, const Ray3f &ray, Intersection &its) const {
+    /* Compute the intersection in object space (the ray parameter
+       is the same in both spaces), then transform it to world space */
+    m_mesh->setHitInformation(index, m_toObject * ray, its);
+
+    its.p = m_toWorld * its.p;
+    its.geoFrame = Frame((m_toWorld * its.geoFrame.n).normalized());
+    its.shFrame = Frame((m_toWorld * its.shFrame.n).normalized());
+}
+
+void Instance::samplePosition(const Point2f &sample_, Point3f &p, Normal3f &n, float &pdf) const {
+    if (m_areaTable.getSum() == 0)
+        throw NoriException("Instance::samplePosition(): \"%s\" has no surface area!", m_name);
+
+    Point2f sample(sample_);
+    uint32_t index = (uint32_t) m_areaTable.sampleReuse(sample.x());
+
+    TriangleVertices tri;
+    m_mesh->getTriangle(index, tri);
+
+    /* Uniformly sample the barycentric coordinates of the triangle */
+    float su = std::sqrt(1.0f - sample.x());
+    Vector3f bary(su * (1.0f - sample.y()), su * sample.y(), 1.0f - su);
+
+    p = m_toWorld * Point3f(bary.x() * tri.p[0] + bary.y() * tri.p[1] + bary.z() * tri.p[2]);
+
+    if (m_mesh->hasVertexNormals())
+        n = Normal3f(bary.x() * tri.n[0] + bary.y() * tri.n[1] + bary.z() * tri.n[2]);
+    else
+        n = Normal3f((tri.p[1] - tri.p[0]).cross(tri.p[2] - tri.p[0]));
+    n = (m_toWorld * n).normalized();
+
+    pdf = m_areaTable.getNormalization();
+}
+
+std::string Instance::toString() const {
+    return tfm::format(
+        "Instance[\n"
+        "  mesh = \"%s\",\n"
+        "  toWorld = %s,\n"
+        "  bsdf = %s,\n"
+        "  emitter = %s\n"
+        "]",
+        m_mesh->getName(),
+        indent(m_toWorld.toString(), 12),
+        m_bsdf ? indent(m_bsdf->toString()) : std::string("null"),
+        m_emitter ? indent(m_emitter->toString()) : std::string("null")
+    );
+}
+
+NORI_NAMESPACE_END
@@ -12,19 +12,42 @@
 #include <nori/bitmap.h>
 #include <nori/sampler.h>
 #include <nori/integrator.h>
+#include <nori/wavefront.h>
+#include <nori/checkpoint.h>
+#include <nori/distributed.h>
+#include <nori/server.h>
 #include <nori/gui.h>
+#include <nori/clusters.h>
+#include <nori/mesh.h>
 #include <tbb/parallel_for.h>
 #include <tbb/blocked_range.h>
 #include <tbb/task_scheduler_init.h>
 #include <filesystem/resolver.h>
+#include <fstream>
+#include <map>
 #include <thread>
 
 using namespace nori;
 
 static int threadCount = -1;
 static bool gui = true;
-
-static void renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block) {
+static uint32_t sampleBudget = 0;      ///< Samples per pixel (0: use the sampler's count)
+static uint32_t passSampleCount = 0;   ///< Samples per pixel and pass (0: render in a single pass)
+static double timeBudget = 0;          ///< Rendering time budget in seconds (0: unlimited)
+static float adaptiveThreshold = 0;    ///< Relative error of converged pixels (0: no adaptive sampling)
+static double checkpointInterval = 0;  ///< Seconds between checkpoints (0: no checkpoints)
+static std::string resumeName;         ///< Checkpoint file to resume from
+static std::string coordinatorAddress; ///< Address on which to hand out blocks to workers
+static std::string workerAddress;      ///< Address of the coordinator to render blocks for
+static std::string serverPath;         ///< Unix-domain socket on which to accept render jobs
+static uint32_t serverSceneLimit = 4;  ///< Number of scenes that the render server keeps loaded
+static uint32_t shardIndex = 0;        ///< Shard of the blocks to render (see --shard)
+static uint32_t shardCount = 1;        ///< Number of shards of the blocks
+static uint32_t sppShardIndex = 0;     ///< Shard of the samples to render (see --spp-shard)
+static uint32_t sppShardCount = 1;     ///< Number of shards of the samples
+
+static void renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block,
+                        uint32_t sampleCount, SampleStatistics *statistics, float threshold) {
     const Camera *camera = scene->getCamera();
     const Integrator *integrator = scene->getIntegrator();
 
@@ -37,7 +60,12 @@ static void renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block)
     /* For each pixel and pixel sample sample */
     for (int y=0; y<size.y(); ++y) {
         for (int x=0; x<size.x(); ++x) {
-            for (uint32_t i=0; i<sampler->getSampleCount(); ++i) {
+            /* When sampling adaptively, skip pixels that have converged */
+            Point2i pixel(x + offset.x(), y + offset.y());
+            if (statistics && statistics->getRelativeError(pixel) < threshold)
+                continue;
+
+            for (uint32_t i=0; i<sampleCount; ++i) {
                 Point2f pixelSample = Point2f((float) (x + offset.x()), (float) (y + offset.y())) + sampler->next2D();
                 Point2f apertureSample = sampler->next2D();
 
@@ -48,6 +76,9 @@ static void renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block)
                 /* Compute the incident radiance */
                 value *= integrator->Li(scene, sampler, ray);
 
+                if (statistics && value.isValid())
+                    statistics->put(pixel, value.getLuminance());
+
                 /* Store in the image block */
                 block.put(pixelSample, value);
             }
@@ -55,34 +86,207 @@ static void renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block)
     }
 }
 
-static void render(Scene *scene, const std::string &filename) {
+/// Return the name of the output files (without extension) of a render
+static std::string outputBaseName(const std::string &filename, const Checkpoint &state) {
+    std::string outputName = filename;
+    size_t lastdot = outputName.find_last_of(".");
+    if (lastdot != std::string::npos)
+        outputName.erase(lastdot, std::string::npos);
+
+    /* The shards of a render are stored side by side */
+    if (state.shardCount > 1)
+        outputName += tfm::format("-shard%iof%i", state.shardIndex, state.shardCount);
+    if (state.sppShardCount > 1)
+        outputName += tfm::format("-spp%iof%i", state.sppShardIndex, state.sppShardCount);
+    return outputName;
+}
+
+static void saveImage(const ImageBlock &result, const std::string &outputName,
+                      const SampleStatistics *statistics, bool sharded) {
+    if (sharded) {
+        /* Shards are stored unnormalized so that nori-merge can sum them */
+        std::unique_ptr<Bitmap> bitmap(result.toWeightedBitmap());
+        bitmap->saveEXR(outputName);
+        return;
+    }
+
+    /* Turn the rendered image block into a properly normalized bitmap */
+    std::unique_ptr<Bitmap> bitmap(result.toBitmap());
+
+    /* Store the number of samples per pixel when sampling adaptively */
+    if (statistics)
+        bitmap->addLayer("sampleCount", statistics->getSampleCounts());
+
+    /* Save using the OpenEXR format */
+    bitmap->saveEXR(outputName);
+
+    /* Save tonemapped (sRGB) output using the PNG format */
+    bitmap->savePNG(outputName);
+}
+
+/**
+ * \brief Render a scene and save the image next to \c filename
+ *
+ * \param sceneName
+ *    Scene file, whose version identifies the scene in checkpoints
+ * \param progress
+ *    Optional callback, which is periodically invoked with the fraction
+ *    of the passes that have been merged into the image
+ *
+ * \return The name of the output files (without extension)
+ */
+static std::string render(Scene *scene, const std::string &sceneName, const std::string &filename,
+        const RenderServer::ProgressFunction &progress = RenderServer::ProgressFunction()) {
     const Camera *camera = scene->getCamera();
     Vector2i outputSize = camera->getOutputSize();
     scene->getIntegrator()->preprocess(scene);
 
-    /* Create a block generator (i.e. a work scheduler) */
-    BlockGenerator blockGenerator(outputSize, NORI_BLOCK_SIZE);
+    /* Checkpoints must only be resumed with the same scene and settings */
+    uint64_t sceneHash = Checkpoint::hashScene(
+        filesystem::path(sceneName).make_absolute().str() + ":" + fileVersion(sceneName) + "\n" +
+        scene->getIntegrator()->toString() + "\n" + scene->getSampler()->toString() + "\n" +
+        camera->toString());
+
+    /* Wavefront integrators render entire passes at once */
+    const WavefrontIntegrator *wavefront =
+        dynamic_cast<const WavefrontIntegrator *>(scene->getIntegrator());
+
+    /* Determine the settings and progress of the render, which are
+       restored when resuming from a checkpoint. Progressive rendering
+       splits the samples into several passes over the image. The image
+       is valid after every pass, since the pixels are normalized by
+       their accumulated filter weight */
+    Checkpoint state;
+    if (!resumeName.empty()) {
+        state = Checkpoint(resumeName);
+        if (state.sceneHash != sceneHash)
+            throw NoriException("Checkpoint file \"%s\" was written for a different version "
+                                "of \"%s\" (or another integrator, sampler or camera)!",
+                                resumeName, sceneName);
+    } else {
+        uint32_t totalSamples = sampleBudget > 0 ? sampleBudget
+            : (uint32_t) scene->getSampler()->getSampleCount();
+
+        /* A shard of the samples takes an equal share of the samples per pixel */
+        state.shardIndex = shardIndex;
+        state.shardCount = shardCount;
+        state.sppShardIndex = sppShardIndex;
+        state.sppShardCount = sppShardCount;
+        state.sampleCount = totalSamples / sppShardCount +
+            (sppShardIndex < totalSamples % sppShardCount ? 1 : 0);
+        if (state.sampleCount == 0)
+            throw NoriException("The sample shard %i/%i doesn't contain any of the %i samples per pixel!",
+                                sppShardIndex, sppShardCount, totalSamples);
+        state.adaptiveThreshold = adaptiveThreshold;
+        state.sceneHash = sceneHash;
+        state.progressive = passSampleCount > 0 || timeBudget > 0 || adaptiveThreshold > 0;
+        state.passSize = state.sampleCount;
+        if (state.progressive)
+            state.passSize = std::min(passSampleCount > 0 ? passSampleCount : 4u, state.sampleCount);
+    }
+    uint32_t passCount = (state.sampleCount + state.passSize - 1) / state.passSize;
+    bool sharded = state.shardCount > 1 || state.sppShardCount > 1;
+
+    /* Create a block generator (i.e. a work scheduler) for the shard of the blocks */
+    BlockGenerator blockGenerator(outputSize, NORI_BLOCK_SIZE,
+                                  (int) state.shardIndex, (int) state.shardCount);
 
     /* Allocate memory for the entire output image and clear it */
     ImageBlock result(outputSize, camera->getReconstructionFilter());
     result.clear();
 
+    /* Merge the rendered blocks into it without a global lock */
+    BlockAccumulator accumulator(result, blockGenerator);
+
+    /* Track the convergence of the pixels for adaptive sampling */
+    std::unique_ptr<SampleStatistics> statistics;
+    if (state.adaptiveThreshold > 0) {
+        if (wavefront)
+            throw NoriException("Adaptive sampling is not supported by wavefront integrators!");
+        if (sharded)
+            throw NoriException("Adaptive sampling is not supported when rendering shards!");
+        statistics.reset(new SampleStatistics(outputSize));
+    }
+
+    if (!resumeName.empty()) {
+        state.restore(accumulator, statistics.get());
+        cout << "Resuming pass " << (state.pass + 1) << "/" << passCount << " at block "
+             << state.nextBlock << "/" << blockGenerator.getBlockCount() << " (rendered for "
+             << timeString(state.elapsed * 1000) << ")" << endl;
+    }
+    std::string outputName = outputBaseName(filename, state);
+    std::string checkpointName = outputName + ".nckpt";
+
+    /* Let worker processes render the blocks if requested */
+    std::unique_ptr<RenderCoordinator> coordinator;
+    if (!coordinatorAddress.empty()) {
+        if (wavefront || statistics || timeBudget > 0 || checkpointInterval > 0 ||
+            !resumeName.empty() || sharded)
+            throw NoriException("Distributed rendering doesn't support wavefront integrators, "
+                                "adaptive sampling, time budgets, checkpoints, or shards!");
+        coordinator.reset(new RenderCoordinator(coordinatorAddress));
+        cout << "Waiting for workers on \"" << coordinatorAddress << "\"" << endl;
+    }
+
     /* Create a window that visualizes the partially rendered result */
     NoriScreen *screen = nullptr;
     if (gui) {
         nanogui::init();
-        screen = new NoriScreen(result);
+        screen = new NoriScreen(result, &accumulator);
     }
 
     /* Do the following in parallel and asynchronously */
-    std::thread render_thread([&] {
+    auto renderAll = [&] {
         tbb::task_scheduler_init init(threadCount);
 
-        cout << "Rendering .. ";
+        uint32_t sampleCount = state.sampleCount, passSize = state.passSize;
+        bool progressive = state.progressive;
+        if (sharded)
+            cout << "Rendering " << blockGenerator.getBlockCount() << "/" << accumulator.getTileCount()
+                 << " blocks (shard " << state.shardIndex << "/" << state.shardCount << ") with "
+                 << sampleCount << " spp (shard " << state.sppShardIndex << "/"
+                 << state.sppShardCount << ")" << endl;
+        if (progressive)
+            cout << "Rendering " << sampleCount << " spp in " << passCount
+                 << " passes" << (timeBudget > 0 ? tfm::format(" (time budget: %s)",
+                    timeString(timeBudget * 1000)) : std::string()) << " .. " << endl;
+        else
+            cout << "Rendering .. ";
         cout.flush();
-        Timer timer;
+        Timer timer, passTimer, checkpointTimer;
+        ClusterFile::resetStatistics();
+
+        if (coordinator) {
+            coordinator->render(blockGenerator, accumulator, camera->getReconstructionFilter(),
+                sampleCount, passSize, [&](uint32_t pass) {
+                    if (!progressive)
+                        return;
+                    cout << "Pass " << (pass + 1) << "/" << passCount << ": "
+                         << std::min((pass + 1) * passSize, sampleCount) << " spp (took "
+                         << passTimer.lapString() << ")" << endl;
+                    saveImage(result, outputName, nullptr, false);
+                });
+            if (progressive)
+                cout << "Rendering done. (" << sampleCount << " spp, took "
+                     << timer.elapsedString() << ")" << endl;
+            else
+                cout << "done. (took " << timer.elapsedString() << ")" << endl;
+            return;
+        }
+
+        /* With checkpoints, the blocks of a pass are rendered in chunks,
+           after each of which all rendered blocks have been stored */
+        int blockCount = blockGenerator.getBlockCount(), chunkSize = blockCount;
+        if (checkpointInterval > 0)
+            chunkSize = 4 * (threadCount > 0 ? threadCount
+                                             : tbb::task_scheduler_init::default_num_threads());
+        uint32_t pass = state.pass, passSamples = 0, renderedSamples = state.renderedSamples;
 
-        tbb::blocked_range<int> range(0, blockGenerator.getBlockCount());
+        /* The shards of the samples use distinct random number streams,
+           which the samplers select based on the pass index */
+        uint32_t seedPass = 0;
+        int firstBlock = (int) state.nextBlock;
+        blockGenerator.reset(firstBlock);
 
         auto map = [&](const tbb::blocked_range<int> &range) {
             /* Allocate memory for a small image block to be rendered
@@ -98,29 +302,124 @@ static void render(Scene *scene, const std::string &filename) {
                 blockGenerator.next(block);
 
                 /* Inform the sampler about the block to be rendered */
-                sampler->prepare(block);
+                sampler->prepare(block, seedPass);
 
                 /* Render all contained pixels */
-                renderBlock(scene, sampler.get(), block);
+                renderBlock(scene, sampler.get(), block, passSamples,
+                            statistics.get(), state.adaptiveThreshold);
 
                 /* The image block has been processed. Now add it to
                    the "big" block that represents the entire image */
-                result.put(block);
+                accumulator.put(block);
             }
         };
 
-        /// Default: parallel rendering
-        tbb::parallel_for(range, map);
+        for (; pass < passCount; ++pass, firstBlock = 0) {
+            if (pass > 0 && firstBlock == 0) {
+                /* Don't start a pass that is expected to exceed the time budget */
+                double elapsed = state.elapsed + timer.elapsed() / 1000;
+                if (timeBudget > 0 && elapsed / pass * (pass + 1) > timeBudget)
+                    break;
+                blockGenerator.reset();
+                accumulator.nextPass();
+            }
+            passSamples = std::min(passSize, sampleCount - renderedSamples);
+            seedPass = pass * state.sppShardCount + state.sppShardIndex;
+
+            for (int i = firstBlock; i < blockCount; ) {
+                tbb::blocked_range<int> range(i, std::min(i + chunkSize, blockCount));
+
+                if (wavefront) {
+                    /// Wavefront integrators process the whole range stage by stage
+                    wavefront->render(scene, blockGenerator, accumulator, seedPass,
+                                      passSamples, range.begin(), range.end());
+                } else {
+                    /// Default: parallel rendering
+                    tbb::parallel_for(range, map);
+
+                    /// (equivalent to the following single-threaded call)
+                    // map(range);
+                }
+                i = range.end();
+
+                if (checkpointInterval > 0 && checkpointTimer.elapsed() >= checkpointInterval * 1000) {
+                    Checkpoint checkpoint = state;
+                    checkpoint.pass = pass;
+                    checkpoint.nextBlock = (uint32_t) i;
+                    checkpoint.renderedSamples = renderedSamples;
+                    checkpoint.elapsed = state.elapsed + timer.elapsed() / 1000;
+                    try {
+                        checkpoint.write(checkpointName, accumulator, statistics.get());
+                    } catch (const std::exception &e) {
+                        cerr << "Warning: " << e.what() << endl;
+                    }
+                    checkpointTimer.reset();
+                }
+            }
 
-        /// (equivalent to the following single-threaded call)
-        // map(range);
+            renderedSamples += passSamples;
+            if (progressive) {
+                cout << "Pass " << (pass + 1) << "/" << passCount << ": "
+                     << renderedSamples << " spp";
+                size_t converged = 0, pixelCount = (size_t) outputSize.prod();
+                if (statistics) {
+                    converged = statistics->getConvergedCount(state.adaptiveThreshold);
+                    cout << tfm::format(" max, %.1f%% of the pixels converged",
+                                        100.f * converged / pixelCount);
+                }
+                cout << " (took " << passTimer.lapString() << ")" << endl;
+                saveImage(result, outputName, statistics.get(), sharded);
+
+                /* Further passes would not take any samples */
+                if (statistics && converged == pixelCount)
+                    break;
+            }
+        }
 
-        cout << "done. (took " << timer.elapsedString() << ")" << endl;
+        if (statistics)
+            cout << tfm::format("Rendering done. (%.1f spp on average, took %s)",
+                statistics->getSampleCounts().mean(), timer.elapsedString()) << endl;
+        else if (progressive)
+            cout << "Rendering done. (" << renderedSamples << " spp, took "
+                 << timer.elapsedString() << ")" << endl;
+        else
+            cout << "done. (took " << timer.elapsedString() << ")" << endl;
+
+        if (ClusterFile::isActive())
+            cout << "Geometry paging: " << ClusterFile::getStatistics() << endl;
+    };
+
+    std::atomic<bool> finished(false);
+    std::exception_ptr error;
+    std::thread render_thread([&] {
+        try {
+            renderAll();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        finished = true;
     });
 
     /* Enter the application main loop */
-    if (gui)
+    if (gui) {
         nanogui::mainloop(50.f);
+    } else if (progress) {
+        /* Report the fraction of the passes that were merged into the tiles */
+        int renderedTiles = 0;
+        for (int i = 0; i < accumulator.getTileCount(); ++i)
+            renderedTiles += accumulator.isRendered(i) ? 1 : 0;
+        auto fraction = [&] {
+            size_t resolved = 0;
+            for (int i = 0; i < accumulator.getTileCount(); ++i)
+                if (accumulator.isRendered(i))
+                    resolved += (size_t) std::min(accumulator.getResolvedPasses(i), (int) passCount);
+            return (float) resolved / ((size_t) renderedTiles * passCount);
+        };
+        while (!finished) {
+            progress(fraction());
+            std::this_thread::sleep_for(std::chrono::milliseconds(250));
+        }
+    }
 
     /* Shut down the user interface */
     render_thread.join();
@@ -130,30 +429,162 @@ static void render(Scene *scene, const std::string &filename) {
         nanogui::shutdown();
     }
 
-    /* Now turn the rendered image block into
-       a properly normalized bitmap */
-    std::unique_ptr<Bitmap> bitmap(result.toBitmap());
+    if (error)
+        std::rethrow_exception(error);
 
-    /* Determine the filename of the output bitmap */
-    std::string outputName = filename;
-    size_t lastdot = outputName.find_last_of(".");
-    if (lastdot != std::string::npos)
-        outputName.erase(lastdot, std::string::npos);
+    /* Progressive rendering already saved the image after the last pass */
+    if (!state.progressive)
+        saveImage(result, outputName, nullptr, sharded);
 
-    /* Save using the OpenEXR format */
-    bitmap->saveEXR(outputName);
+    /* The checkpoint is obsolete once the render has finished */
+    if (checkpointInterval > 0 || !resumeName.empty())
+        std::remove(checkpointName.c_str());
+    return outputName;
+}
 
-    /* Save tonemapped (sRGB) output using the PNG format */
-    bitmap->savePNG(outputName);
+static void serve(Scene *scene) {
+    const Integrator *integrator = scene->getIntegrator();
+    if (dynamic_cast<const WavefrontIntegrator *>(integrator))
+        throw NoriException("Distributed rendering doesn't support wavefront integrators!");
+    if (shardCount > 1 || sppShardCount > 1)
+        throw NoriException("Distributed rendering doesn't support shards!");
+    scene->getIntegrator()->preprocess(scene);
+
+    /* Render the blocks handed out by the coordinator */
+    RenderWorker::run(workerAddress, scene, threadCount,
+        [&](ImageBlock &block, Sampler *sampler, uint32_t pass, uint32_t sampleCount) {
+            sampler->prepare(block, pass);
+            renderBlock(scene, sampler, block, sampleCount, nullptr, 0.f);
+        }
+    );
+}
+
+/**
+ * \brief Append the scene files of a job list to \c sceneNames
+ *
+ * Job lists contain one scene file per line, relative to the directory
+ * of the list. Empty lines and lines starting with '#' are ignored.
+ */
+static void readJobList(const std::string &filename, std::vector<std::string> &sceneNames) {
+    std::ifstream is(filename);
+    if (is.fail())
+        throw NoriException("Unable to open job list \"%s\"!", filename);
+
+    filesystem::path directory = filesystem::path(filename).parent_path();
+    std::string line;
+    while (std::getline(is, line)) {
+        size_t begin = line.find_first_not_of(" \t\r"),
+               end = line.find_last_not_of(" \t\r");
+        if (begin == std::string::npos || line[begin] == '#')
+            continue;
+        line = line.substr(begin, end - begin + 1);
+        filesystem::path path(line);
+        if (!path.is_absolute() && !directory.empty())
+            path = directory / path;
+        sceneNames.push_back(path.str());
+    }
+}
+
+/**
+ * \brief Render the jobs submitted to a render server
+ *
+ * Loaded scenes stay in memory between jobs and are only loaded again
+ * when their file or one of the resources it references was modified.
+ * At most \ref serverSceneLimit scenes are kept, and the least recently
+ * used one is released first. The camera overrides of a job are applied
+ * to a copy of the camera, so that later jobs see the original one.
+ */
+static void runServer(const std::string &path) {
+    struct WarmScene {
+        std::unique_ptr<NoriObject> root;
+        std::string version;   ///< Versions of the scene file and its resources
+        uint64_t lastUsed = 0; ///< Number of the last job that used the scene
+    };
+    std::map<std::string, WarmScene> scenes;
+    uint64_t jobCount = 0;
+
+    RenderServer server(path);
+    cout << "Accepting render jobs on \"" << path << "\" (keeping up to "
+         << serverSceneLimit << " scenes loaded)" << endl;
+
+    server.run([&](const RenderJob &job, const RenderServer::ProgressFunction &progress) {
+        std::string sceneName = filesystem::path(job.scene).make_absolute().str();
+
+        /* Resources are referenced relative to the scene file */
+        getFileResolver()->prepend(filesystem::path(sceneName).parent_path());
+        WarmScene &warm = scenes[sceneName];
+        try {
+            std::string version = sceneName + ":" + fileVersion(sceneName) + "\n";
+            for (const std::string &filename : findReferencedFiles(sceneName))
+                version += filename + ":" + fileVersion(filename) + "\n";
+
+            if (!warm.root || warm.version != version) {
+                /* The old version is only destroyed after loading the new
+                   one, so that unchanged meshes are taken from the geometry
+                   cache */
+                std::unique_ptr<NoriObject> root(loadFromXML(sceneName));
+                if (root->getClassType() != NoriObject::EScene)
+                    throw NoriException("\"%s\" doesn't contain a scene!", job.scene);
+                warm.root = std::move(root);
+                warm.version = version;
+            } else {
+                cout << "Reusing the loaded scene \"" << sceneName << "\"" << endl;
+            }
+        } catch (...) {
+            getFileResolver()->erase(getFileResolver()->begin());
+            scenes.erase(sceneName);
+            throw;
+        }
+        getFileResolver()->erase(getFileResolver()->begin());
+        warm.lastUsed = ++jobCount;
+
+        /* Release the least recently used scenes beyond the limit */
+        while (scenes.size() > serverSceneLimit) {
+            auto lru = scenes.end();
+            for (auto it = scenes.begin(); it != scenes.end(); ++it)
+                if (it->first != sceneName && (lru == scenes.end() || it->second.lastUsed < lru->second.lastUsed))
+                    lru = it;
+            cout << "Releasing the loaded scene \"" << lru->first << "\"" << endl;
+            scenes.erase(lru);
+        }
+        Scene *scene = static_cast<Scene *>(warm.root.get());
+
+        /* Render with a modified copy of the camera, and restore the
+           original one (and sample count) afterwards */
+        std::unique_ptr<Camera> original;
+        if (job.overrideCamera)
+            original.reset(scene->setCamera(scene->getCamera()->clone(job.camera)));
+        uint32_t savedBudget = sampleBudget;
+        if (job.sampleCount > 0)
+            sampleBudget = job.sampleCount;
+
+        std::string outputName;
+        try {
+            outputName = render(scene, sceneName, job.output.empty() ? sceneName : job.output, progress);
+        } catch (...) {
+            sampleBudget = savedBudget;
+            if (original)
+                delete scene->setCamera(original.release());
+            throw;
+        }
+        sampleBudget = savedBudget;
+        if (original)
+            delete scene->setCamera(original.release());
+        return outputName + ".exr";
+    });
 }
 
 int main(int argc, char **argv) {
     if (argc < 2) {
-        cerr << "Syntax: " << argv[0] << " <scene.xml> [--no-gui] [--threads N]" <<  endl;
+        cerr << "Syntax: " << argv[0] << " <scene.xml> [<scene.xml> ...] [--jobs FILE] [--no-gui] [--threads N] [--geometry-budget MiB] [--shared-geometry DIR]"
+                " [--spp N] [--pass-spp N] [--time SECONDS] [--adaptive ERROR]"
+                " [--checkpoint SECONDS] [--resume FILE] [--coordinator ADDRESS | --worker ADDRESS]"
+                " [--shard i/N] [--spp-shard i/N]" <<  endl;
+        cerr << "       " << argv[0] << " --server SOCKET [--server-scenes N] [options]" << endl;
         return -1;
     }
 
-    std::string sceneName = "";
+    std::vector<std::string> sceneNames;
     std::string exrName = "";
 
     for (int i = 1; i < argc; ++i) {
@@ -172,6 +603,129 @@ int main(int argc, char **argv) {
 
             continue;
         }
+        else if (token == "--geometry-budget") {
+            int budget = i+1 < argc ? atoi(argv[i+1]) : 0;
+            if (budget <= 0) {
+                cerr << "\"--geometry-budget\" argument expects a positive integer following it." << endl;
+                return -1;
+            }
+            ClusterFile::setMemoryBudget((size_t) budget * 1024 * 1024);
+            i++;
+            continue;
+        }
+        else if (token == "--shared-geometry") {
+            if (i+1 >= argc) {
+                cerr << "\"--shared-geometry\" argument expects a directory (e.g. /dev/shm) following it." << endl;
+                return -1;
+            }
+            try {
+                GeometryCache::setSharedDirectory(argv[i+1]);
+            } catch (const std::exception &e) {
+                cerr << "Error: " << e.what() << endl;
+                return -1;
+            }
+            i++;
+            continue;
+        }
+        else if (token == "--spp" || token == "--pass-spp") {
+            int count = i+1 < argc ? atoi(argv[i+1]) : 0;
+            if (count <= 0) {
+                cerr << "\"" << token << "\" argument expects a positive integer following it." << endl;
+                return -1;
+            }
+            (token == "--spp" ? sampleBudget : passSampleCount) = (uint32_t) count;
+            i++;
+            continue;
+        }
+        else if (token == "--time") {
+            timeBudget = i+1 < argc ? atof(argv[i+1]) : 0;
+            if (timeBudget <= 0) {
+                cerr << "\"--time\" argument expects a positive number of seconds following it." << endl;
+                return -1;
+            }
+            i++;
+            continue;
+        }
+        else if (token == "--adaptive") {
+            adaptiveThreshold = i+1 < argc ? (float) atof(argv[i+1]) : 0;
+            if (adaptiveThreshold <= 0) {
+                cerr << "\"--adaptive\" argument expects a positive relative error (e.g. 0.01) following it." << endl;
+                return -1;
+            }
+            i++;
+            continue;
+        }
+        else if (token == "--checkpoint") {
+            checkpointInterval = i+1 < argc ? atof(argv[i+1]) : 0;
+            if (checkpointInterval <= 0) {
+                cerr << "\"--checkpoint\" argument expects a positive number of seconds following it." << endl;
+                return -1;
+            }
+            i++;
+            continue;
+        }
+        else if (token == "--resume") {
+            if (i+1 >= argc) {
+                cerr << "\"--resume\" argument expects a checkpoint file following it." << endl;
+                return -1;
+            }
+            resumeName = argv[i+1];
+            i++;
+            continue;
+        }
+        else if (token == "--coordinator" || token == "--worker") {
+            if (i+1 >= argc) {
+                cerr << "\"" << token << "\" argument expects an address (host:port or unix:path) following it." << endl;
+                return -1;
+            }
+            (token == "--coordinator" ? coordinatorAddress : workerAddress) = argv[i+1];
+            i++;
+            continue;
+        }
+        else if (token == "--shard" || token == "--spp-shard") {
+            unsigned int index = 0, count = 0;
+            if (i+1 >= argc || sscanf(argv[i+1], "%u/%u", &index, &count) != 2 || index >= count) {
+                cerr << "\"" << token << "\" argument expects a shard i/N (with 0 <= i < N) following it." << endl;
+                return -1;
+            }
+            (token == "--shard" ? shardIndex : sppShardIndex) = index;
+            (token == "--shard" ? shardCount : sppShardCount) = count;
+            i++;
+            continue;
+        }
+        else if (token == "--server") {
+            if (i+1 >= argc) {
+                cerr << "\"--server\" argument expects the path of a Unix-domain socket following it." << endl;
+                return -1;
+            }
+            serverPath = argv[i+1];
+            i++;
+            continue;
+        }
+        else if (token == "--server-scenes") {
+            int count = i+1 < argc ? atoi(argv[i+1]) : 0;
+            if (count <= 0) {
+                cerr << "\"--server-scenes\" argument expects a positive integer following it." << endl;
+                return -1;
+            }
+            serverSceneLimit = (uint32_t) count;
+            i++;
+            continue;
+        }
+        else if (token == "--jobs") {
+            if (i+1 >= argc) {
+                cerr << "\"--jobs\" argument expects a job list (one scene file per line) following it." << endl;
+                return -1;
+            }
+            try {
+                readJobList(argv[i+1], sceneNames);
+            } catch (const std::exception &e) {
+                cerr << "Error: " << e.what() << endl;
+                return -1;
+            }
+            i++;
+            continue;
+        }
         else if (token == "--no-gui") {
             gui = false;
             continue;
@@ -181,12 +735,7 @@ int main(int argc, char **argv) {
 
         try {
             if (path.extension() == "xml") {
-                sceneName = argv[i];
-
-                /* Add the parent directory of the scene file to the
-                   file resolver. That way, the XML file can reference
-                   resources (OBJ files, textures) using relative paths */
-                getFileResolver()->prepend(path.parent_path());
+                sceneNames.push_back(argv[i]);
             } else if (path.extension() == "exr") {
                 /* Alternatively, provide a basic OpenEXR image viewer */
                 exrName = argv[i];
@@ -200,11 +749,28 @@ int main(int argc, char **argv) {
         }
     }
 
-    if (exrName !="" && sceneName !="") {
+    if (!serverPath.empty()) {
+        if (exrName != "" || !sceneNames.empty() || !resumeName.empty() ||
+            !coordinatorAddress.empty() || !workerAddress.empty()) {
+            cerr << "Flag --server doesn't take scene files and can't be combined with --resume, "
+                    "--coordinator, or --worker." << endl;
+            return -1;
+        }
+        if (threadCount < 0)
+            threadCount = tbb::task_scheduler_init::automatic;
+        gui = false;
+        try {
+            runServer(serverPath);
+        } catch (const std::exception &e) {
+            cerr << "Error: " << e.what() << endl;
+            return -1;
+        }
+    }
+    else if (exrName !="" && !sceneNames.empty()) {
         cerr << "Both .xml and .exr files were provided. Please only provide one of them." << endl;
         return -1;
     }
-    else if (exrName == "" && sceneName == "") {
+    else if (exrName == "" && sceneNames.empty()) {
         cerr << "Please provide the path to a .xml (or .exr) file." << endl;
         return -1;
     }
@@ -227,19 +793,59 @@ int main(int argc, char **argv) {
             return -1;
         }
     }
-    else { // sceneName != ""
+    else { // !sceneNames.empty()
         if (threadCount < 0) {
             threadCount = tbb::task_scheduler_init::automatic;
         }
-        try {
-            std::unique_ptr<NoriObject> root(loadFromXML(sceneName));
-            /* When the XML root object is a scene, start rendering it .. */
-            if (root->getClassType() == NoriObject::EScene)
-                render(static_cast<Scene *>(root.get()), sceneName);
-        } catch (const std::exception &e) {
-            cerr << e.what() << endl;
+        bool batch = sceneNames.size() > 1;
+        if (batch && (!resumeName.empty() || !coordinatorAddress.empty() || !workerAddress.empty())) {
+            cerr << "Flags --resume, --coordinator, and --worker only support a single scene." << endl;
             return -1;
         }
+
+        /* Render the scenes one after another. The previous scene is only
+           destroyed once the next one has been loaded, so that the meshes
+           they have in common are taken from the geometry cache instead of
+           being loaded and processed again. */
+        std::unique_ptr<NoriObject> previous;
+        int failed = 0;
+        Timer timer;
+        for (size_t i = 0; i < sceneNames.size(); ++i) {
+            const std::string &sceneName = sceneNames[i];
+            if (batch)
+                cout << "Scene " << (i + 1) << "/" << sceneNames.size()
+                     << ": \"" << sceneName << "\"" << endl;
+
+            /* Add the parent directory of the scene file to the
+               file resolver. That way, the XML file can reference
+               resources (OBJ files, textures) using relative paths */
+            getFileResolver()->prepend(filesystem::path(sceneName).parent_path());
+
+            try {
+                std::unique_ptr<NoriObject> root(loadFromXML(sceneName));
+                previous.reset();
+
+                /* When the XML root object is a scene, start rendering it .. */
+                if (root->getClassType() == NoriObject::EScene) {
+                    if (!workerAddress.empty())
+                        serve(static_cast<Scene *>(root.get()));
+                    else
+                        render(static_cast<Scene *>(root.get()), sceneName, sceneName);
+                }
+                previous = std::move(root);
+            } catch (const std::exception &e) {
+                cerr << e.what() << endl;
+                ++failed;
+            }
+
+            getFileResolver()->erase(getFileResolver()->begin());
+        }
+
+        if (batch)
+            cout << "Rendered " << sceneNames.size() - failed << "/" << sceneNames.size()
+                 << " scenes (took " << timer.elapsedString() << ")" << endl;
+        if (failed > 0)
+            return -1;
     }
 
     return 0;
@@ -0,0 +1,94 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+*/
+
+/* =======================================================================
+     nori-merge: sums the unnormalized OpenEXR files of the shards of a
+     render (see the --shard and --spp-shard options of nori), and
+     normalizes the result by the accumulated filter weights.
+ * ======================================================================= */
+
+#include <nori/bitmap.h>
+#include <algorithm>
+
+using namespace nori;
+
+typedef Eigen::Array<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> Sum;
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        cerr << "Syntax: " << argv[0] << " <output.exr> <shard.exr> [<shard.exr> ...]" << endl;
+        return -1;
+    }
+
+    std::string outputName = argv[1];
+    if (endsWith(toLower(outputName), ".exr"))
+        outputName.erase(outputName.size() - 4);
+
+    try {
+        /* Sum all channels in double precision: the red, green, and blue
+           components, followed by the layers (the filter weights and
+           e.g. the number of samples per pixel) */
+        std::vector<std::string> names;
+        std::vector<Sum> sums;
+        Vector2i size;
+
+        for (int i = 2; i < argc; ++i) {
+            Bitmap shard(argv[i]);
+            const auto &layers = shard.getLayers();
+
+            if (i == 2) {
+                size = Vector2i((int) shard.cols(), (int) shard.rows());
+                names = { "R", "G", "B" };
+                for (const auto &layer : layers)
+                    names.push_back(layer.first);
+                if (std::find(names.begin(), names.end(), "weight") == names.end())
+                    throw NoriException("\"%s\" is not an unnormalized shard (no \"weight\" "
+                                        "channel)!", argv[i]);
+                sums.assign(names.size(), Sum::Zero(size.y(), size.x()));
+            } else if (shard.cols() != size.x() || shard.rows() != size.y() ||
+                       layers.size() + 3 != names.size()) {
+                throw NoriException("\"%s\" doesn't match the size and channels of \"%s\"!",
+                                    argv[i], argv[2]);
+            }
+
+            for (int c = 0; c < 3; ++c)
+                sums[c] += shard.unaryExpr([c](const Color3f &value) { return value[c]; }).cast<double>();
+
+            for (const auto &layer : layers) {
+                auto it = std::find(names.begin(), names.end(), layer.first);
+                if (it == names.end())
+                    throw NoriException("\"%s\" contains the unexpected channel \"%s\"!",
+                                        argv[i], layer.first);
+                sums[it - names.begin()] += layer.second.cast<double>();
+            }
+        }
+
+        /* Normalize the color by the filter weights */
+        const Sum &weight = sums[std::find(names.begin(), names.end(), "weight") - names.begin()];
+        Bitmap result(size);
+        for (int y = 0; y < size.y(); ++y) {
+            for (int x = 0; x < size.x(); ++x) {
+                double w = weight(y, x);
+                for (int c = 0; c < 3; ++c)
+                    result(y, x)[c] = w != 0 ? (float) (sums[c](y, x) / w) : 0.f;
+            }
+        }
+
+        /* Keep the other layers as summed */
+        for (size_t i = 3; i < names.size(); ++i) {
+            if (names[i] != "weight")
+                result.addLayer(names[i], sums[i].cast<float>());
+        }
+
+        result.saveEXR(outputName);
+        result.savePNG(outputName);
+    } catch (const std::exception &e) {
+        cerr << "Error: " << e.what() << endl;
+        return -1;
+    }
+
+    return 0;
+}
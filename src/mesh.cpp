@@ -5,31 +5,532 @@
 */
 
 #include <nori/mesh.h>
+#include <nori/simplify.h>
+#include <nori/camera.h>
 #include <nori/bbox.h>
 #include <nori/bsdf.h>
 #include <nori/emitter.h>
 #include <nori/warp.h>
+#include <nori/timer.h>
 #include <Eigen/Geometry>
+#include <filesystem/path.h>
+#include <tbb/mutex.h>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <unordered_map>
+
+#if !defined(_WIN32)
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
 
 NORI_NAMESPACE_BEGIN
 
 Mesh::Mesh() { }
 
-Mesh::~Mesh() {
-    delete m_bsdf;
-    delete m_emitter;
-}
+Mesh::~Mesh() { }
 
 void Mesh::activate() {
-    if (!m_bsdf) {
-        /* If no material was assigned, instantiate a diffuse BRDF */
-        m_bsdf = static_cast<BSDF *>(
-            NoriObjectFactory::createInstance("diffuse", PropertyList()));
+    Shape::activate();
+
+    /* Process freshly loaded buffers (shared, mapped and paged ones are final) */
+    if (!m_sharedGeometry && !m_mappedGeometry && !m_clusters) {
+        if (m_cleanup && m_F.cols() > 0) {
+            Timer timer;
+            uint32_t vertexCount = getVertexCount(), triangleCount = getTriangleCount();
+            uint32_t welded, degenerate, duplicate;
+            cleanup(welded, degenerate, duplicate);
+            cout << "Cleaned up \"" << m_name << "\": welded " << welded
+                 << " vertices, removed " << degenerate << " degenerate and "
+                 << duplicate << " duplicate triangles (V=" << vertexCount << " -> "
+                 << getVertexCount() << ", F=" << triangleCount << " -> "
+                 << getTriangleCount() << ", took " << timer.elapsedString() << ")" << endl;
+        }
+
+        /* Defer the remaining steps until a level has been chosen */
+        if (m_lodLevels > 1 && m_F.cols() > 0) {
+            buildLevelsOfDetail();
+            if (!m_levels.empty())
+                return;
+        }
+    }
+
+    preprocess();
+}
+
+void Mesh::preprocess() {
+    /* The triangles may have changed: rebuild the area distribution on demand */
+    m_areaTableReady = false;
+
+    /* Process freshly loaded buffers (shared, mapped and paged ones are final) */
+    if (!m_sharedGeometry && !m_mappedGeometry && !m_clusters) {
+        if (m_reorder && m_F.cols() > 0) {
+            Timer timer;
+            reorderTriangles();
+            cout << "Reordered the triangles of \"" << m_name << "\" along a Morton curve (took "
+                 << timer.elapsedString() << ")" << endl;
+        }
+
+        if (!m_clusterFilename.empty()) {
+            pageOut();
+        } else {
+            /* Small meshes always use 16-bit indices */
+            compactIndices();
+
+            if (m_compact && (m_N.size() > 0 || m_UV.size() > 0)) {
+                size_t saved = compactAttributes();
+                cout << "Compacted the vertex attributes of \"" << m_name << "\" (saved "
+                     << memString(saved) << ")" << endl;
+            }
+
+            /* Make the final buffers available to other meshes with the same geometry */
+            if (!m_geometryKey.empty())
+                GeometryCache::put(m_geometryKey, this);
+        }
+    }
+
+    /* Find the triangles that need no opacity mask lookups */
+    if (hasAlphaMask()) {
+        if (!hasVertexTexCoords())
+            throw NoriException("Mesh \"%s\": an opacity mask requires texture coordinates!", m_name);
+        classifyAlphaCoverage();
+    }
+}
+
+void Mesh::classifyAlphaCoverage() {
+    /* Triangles covering more texels are assumed to be partially transparent */
+    const int64_t MaxTexels = 4096;
+
+    Timer timer;
+    uint32_t triangleCount = getTriangleCount();
+    uint32_t counts[3] = { 0, 0, 0 };
+    m_alphaCoverage.resize(triangleCount);
+
+    for (uint32_t i=0; i<triangleCount; ++i) {
+        Point2f uvMin(std::numeric_limits<float>::infinity()),
+                uvMax(-std::numeric_limits<float>::infinity());
+        for (int k=0; k<3; ++k) {
+            Point2f uv = getVertexTexCoord(getVertexIndex(i, k));
+            uvMin = uvMin.cwiseMin(uv);
+            uvMax = uvMax.cwiseMax(uv);
+        }
+
+        /* Texel range covered by the triangle (rows are flipped). Edges
+           that lie exactly on texel boundaries don't touch the next texel. */
+        const float Eps = 1e-4f;
+        int64_t x0 = (int64_t) std::floor(uvMin.x() * m_alphaMaskSize.x() + Eps),
+                x1 = (int64_t) std::floor(uvMax.x() * m_alphaMaskSize.x() - Eps),
+                y0 = (int64_t) std::floor((1.0f - uvMax.y()) * m_alphaMaskSize.y() + Eps),
+                y1 = (int64_t) std::floor((1.0f - uvMin.y()) * m_alphaMaskSize.y() - Eps);
+        x1 = std::max(x0, x1);
+        y1 = std::max(y0, y1);
+        int64_t texels = (x1 - x0 + 1) * (y1 - y0 + 1);
+
+        EAlphaCoverage coverage = EPartial;
+        if (texels <= MaxTexels) {
+            int64_t cutout = 0;
+            for (int64_t y=y0; y<=y1; ++y)
+                for (int64_t x=x0; x<=x1; ++x)
+                    cutout += isCutout((int) x, (int) y) ? 1 : 0;
+            if (cutout == 0)
+                coverage = EOpaque;
+            else if (cutout == texels)
+                coverage = ETransparent;
+        }
+
+        m_alphaCoverage[i] = (uint8_t) coverage;
+        counts[coverage]++;
+    }
+
+    cout << "Classified the triangles of \"" << m_name << "\" by opacity (" << counts[EOpaque]
+         << " opaque, " << counts[ETransparent] << " transparent, " << counts[EPartial]
+         << " partial, took " << timer.elapsedString() << ")" << endl;
+}
+
+void Mesh::buildLevelsOfDetail() {
+    /* Levels with fewer triangles than this aren't worth building */
+    const uint32_t MinTriangles = 64;
+
+    Timer timer;
+    MeshSimplifier simplifier(this);
+    uint32_t target = getTriangleCount();
+    std::string counts = std::to_string(target);
+
+    for (int i=1; i<m_lodLevels; ++i) {
+        target /= 2;
+        if (target < MinTriangles)
+            break;
+        simplifier.simplify(target);
+
+        uint32_t previous = m_levels.empty() ? getTriangleCount()
+            : (uint32_t) m_levels.back().F.cols();
+        if (simplifier.getTriangleCount() == previous)
+            break; /* No further collapses are possible */
+
+        MatrixXf V, N, UV;
+        MatrixXu F;
+        simplifier.extract(V, N, UV, F);
+
+        LevelOfDetail level;
+        level.V = std::move(V);
+        level.N = std::move(N);
+        level.UV = std::move(UV);
+        level.F = std::move(F);
+        level.error = simplifier.getError();
+        m_levels.push_back(std::move(level));
+        counts += " -> " + std::to_string(simplifier.getTriangleCount());
+    }
+
+    cout << "Built " << m_levels.size() + 1 << " levels of detail for \"" << m_name
+         << "\" (F=" << counts << ", took " << timer.elapsedString() << ")" << endl;
+}
+
+void Mesh::selectLevelOfDetail(const Camera *camera) {
+    if (m_levels.empty())
+        return;
+
+    /* Pick the coarsest level whose error covers at most m_lodThreshold pixels */
+    float size = camera->getProjectedSize(m_bbox);
+    float diagonal = m_bbox.getExtents().norm();
+    size_t chosen = 0;
+    for (size_t i=0; i<m_levels.size(); ++i) {
+        if (m_levels[i].error * size <= m_lodThreshold * diagonal)
+            chosen = i + 1;
+    }
+
+    if (chosen > 0) {
+        LevelOfDetail &level = m_levels[chosen - 1];
+        m_V = std::move(level.V);
+        m_N = std::move(level.N);
+        m_UV = std::move(level.UV);
+        m_F = std::move(level.F);
+
+        m_bbox.reset();
+        for (uint32_t i=0; i<getVertexCount(); ++i)
+            m_bbox.expandBy(m_V.col(i));
+    }
+    m_levels.clear();
+    m_levels.shrink_to_fit();
+
+    cout << "Using level of detail " << chosen << " for \"" << m_name << "\" (F="
+         << getTriangleCount() << ", projected size: "
+         << tfm::format("%.1f", size) << " pixels)" << endl;
+
+    preprocess();
+}
+
+bool Mesh::lookupGeometry(const std::string &key) {
+    m_geometryKey = key;
+    m_sharedGeometry = GeometryCache::get(key, this);
+    return m_sharedGeometry;
+}
+
+void Mesh::pageOut() {
+    cout << "Writing \"" << m_clusterFilename << "\" .. ";
+    cout.flush();
+    Timer timer;
+
+    ClusterFile::write(m_clusterFilename, m_geometryKey, this, m_clusterSize);
+    m_clusters.reset(new ClusterFile(m_clusterFilename));
+
+    m_V = m_N = m_UV = MeshBuffer<float>();
+    m_NOct = m_F = MeshBuffer<uint32_t>();
+    m_F16 = MeshBuffer<uint16_t>();
+    m_UVHalf = MeshBuffer<uint16_t>();
+
+    cout << "done. (" << m_clusters->getClusterCount() << " clusters, took "
+         << timer.elapsedString() << ")" << endl;
+}
+
+namespace {
+    /// Spread the lower 21 bits of a value so that there are two zero bits between each
+    inline uint64_t expandBits(uint64_t v) {
+        v &= 0x1FFFFF;
+        v = (v | v << 32) & 0x001F00000000FFFFull;
+        v = (v | v << 16) & 0x001F0000FF0000FFull;
+        v = (v | v <<  8) & 0x100F00F00F00F00Full;
+        v = (v | v <<  4) & 0x10C30C30C30C30C3ull;
+        v = (v | v <<  2) & 0x1249249249249249ull;
+        return v;
+    }
+
+    /**
+     * \brief Reorder the columns of a vertex attribute buffer
+     *
+     * Columns whose new index is <tt>(uint32_t) -1</tt> are dropped, in
+     * which case \c newSize specifies the number of remaining columns.
+     */
+    template <typename Scalar>
+    MeshBuffer<Scalar> permuteColumns(const MeshBuffer<Scalar> &buffer,
+                                      const std::vector<uint32_t> &newIndex,
+                                      uint32_t newSize = (uint32_t) -1) {
+        if (newSize == (uint32_t) -1)
+            newSize = (uint32_t) buffer.cols();
+        typename MeshBuffer<Scalar>::Matrix result(buffer.rows(), newSize);
+        for (uint32_t i=0; i<(uint32_t) buffer.cols(); ++i) {
+            if (newIndex[i] != (uint32_t) -1)
+                result.col(newIndex[i]) = buffer.col(i);
+        }
+        return result;
+    }
+
+    /// Scramble a 64-bit value (finalizer of MurmurHash3)
+    inline uint64_t mixBits(uint64_t hash) {
+        hash ^= hash >> 33;
+        hash *= 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 33;
+        hash *= 0xC4CEB9FE1A85EC53ull;
+        hash ^= hash >> 33;
+        return hash;
+    }
+};
+
+void Mesh::cleanup(uint32_t &welded, uint32_t &degenerate, uint32_t &duplicate) {
+    uint32_t triangleCount = (uint32_t) m_F.cols(),
+             vertexCount = (uint32_t) m_V.cols();
+    welded = degenerate = duplicate = 0;
+
+    /* Weld vertices using a hash grid with cells twice as large as the
+       tolerance, so that at most 8 cells must be searched per vertex.
+       Without a tolerance, only identical positions are merged. */
+    typedef Eigen::Matrix<int64_t, 3, 1> Vector3l;
+    float tolerance = m_weldTolerance, invCellSize = 0.5f / tolerance;
+    auto cellKey = [](const Vector3l &cell) -> uint64_t {
+        uint64_t key = 0;
+        for (int k=0; k<3; ++k)
+            key = mixBits(key ^ (uint64_t) cell[k]);
+        return key;
+    };
+
+    auto matches = [&](uint32_t i, uint32_t j) {
+        Vector3f pi = m_V.col(i), pj = m_V.col(j);
+        if (tolerance > 0 ? (pi - pj).norm() > tolerance : pi != pj)
+            return false;
+        if (m_N.size() > 0 && m_N.col(i) != m_N.col(j))
+            return false;
+        if (m_UV.size() > 0 && m_UV.col(i) != m_UV.col(j))
+            return false;
+        return true;
+    };
+
+    /* Each cell stores a linked list of the vertices that were kept */
+    std::unordered_map<uint64_t, uint32_t> head(vertexCount);
+    std::vector<uint32_t> next(vertexCount, (uint32_t) -1);
+    std::vector<uint32_t> weldedIndex(vertexCount);
+
+    for (uint32_t i=0; i<vertexCount; ++i) {
+        Vector3f p = m_V.col(i);
+        Vector3l cell, side = Vector3l::Zero();
+        for (int k=0; k<3; ++k) {
+            if (tolerance > 0) {
+                float x = p[k] * invCellSize, base = std::floor(x);
+                cell[k] = (int64_t) base;
+                side[k] = x - base < 0.5f ? -1 : 1;
+            } else {
+                float value = p[k] == 0 ? 0.0f : p[k]; /* Merge +0 and -0 */
+                uint32_t bits;
+                memcpy(&bits, &value, sizeof(uint32_t));
+                cell[k] = (int64_t) bits;
+            }
+        }
+
+        /* Search the cell of the vertex and its neighbors on the near side */
+        uint32_t target = i;
+        int neighbors = tolerance > 0 ? 8 : 1;
+        for (int n=0; n<neighbors && target == i; ++n) {
+            Vector3l offset((n & 1) ? side[0] : 0, (n & 2) ? side[1] : 0, (n & 4) ? side[2] : 0);
+            auto it = head.find(cellKey(cell + offset));
+            if (it == head.end())
+                continue;
+            for (uint32_t j = it->second; j != (uint32_t) -1; j = next[j]) {
+                if (matches(i, j)) {
+                    target = j;
+                    break;
+                }
+            }
+        }
+
+        weldedIndex[i] = target;
+        if (target == i) {
+            uint32_t &first = head.emplace(cellKey(cell), (uint32_t) -1).first->second;
+            next[i] = first;
+            first = i;
+        } else {
+            welded++;
+        }
+    }
+    head = std::unordered_map<uint64_t, uint32_t>();
+    next = std::vector<uint32_t>();
+
+    /* Remove degenerate triangles and those that repeat an earlier one
+       (with any rotation or orientation of the vertex indices) */
+    std::vector<std::pair<std::array<uint32_t, 3>, uint32_t>> sorted;
+    sorted.reserve(triangleCount);
+    for (uint32_t i=0; i<triangleCount; ++i) {
+        std::array<uint32_t, 3> idx;
+        for (int k=0; k<3; ++k)
+            idx[k] = weldedIndex[m_F(k, i)];
+
+        if (idx[0] == idx[1] || idx[1] == idx[2] || idx[2] == idx[0]) {
+            degenerate++;
+            continue;
+        }
+
+        Vector3f p0 = m_V.col(idx[0]), p1 = m_V.col(idx[1]), p2 = m_V.col(idx[2]);
+        if ((p1 - p0).cross(p2 - p0).squaredNorm() == 0) {
+            degenerate++;
+            continue;
+        }
+
+        std::sort(idx.begin(), idx.end());
+        sorted.push_back(std::make_pair(idx, i));
+    }
+    std::sort(sorted.begin(), sorted.end());
+
+    std::vector<bool> keep(triangleCount, false);
+    for (size_t i=0; i<sorted.size(); ++i) {
+        if (i > 0 && sorted[i].first == sorted[i-1].first)
+            duplicate++;
+        else
+            keep[sorted[i].second] = true;
+    }
+    sorted = decltype(sorted)();
+
+    if (welded == 0 && degenerate == 0 && duplicate == 0)
+        return;
+
+    /* Rebuild the index buffer and drop vertices that are no longer
+       referenced, retaining the original order of both */
+    std::vector<uint32_t> newIndex(vertexCount, (uint32_t) -1);
+    for (uint32_t i=0; i<triangleCount; ++i) {
+        if (keep[i]) {
+            for (int k=0; k<3; ++k)
+                newIndex[weldedIndex[m_F(k, i)]] = 0;
+        }
+    }
+    uint32_t nextIndex = 0;
+    m_bbox.reset();
+    for (uint32_t i=0; i<vertexCount; ++i) {
+        if (newIndex[i] != (uint32_t) -1) {
+            newIndex[i] = nextIndex++;
+            m_bbox.expandBy(m_V.col(i));
+        }
+    }
+
+    MatrixXu F(3, triangleCount - degenerate - duplicate);
+    for (uint32_t i=0, j=0; i<triangleCount; ++i) {
+        if (keep[i]) {
+            for (int k=0; k<3; ++k)
+                F(k, j) = newIndex[weldedIndex[m_F(k, i)]];
+            j++;
+        }
+    }
+
+    m_F = std::move(F);
+    m_V = permuteColumns(m_V, newIndex, nextIndex);
+    if (m_N.size() > 0)
+        m_N = permuteColumns(m_N, newIndex, nextIndex);
+    if (m_UV.size() > 0)
+        m_UV = permuteColumns(m_UV, newIndex, nextIndex);
+}
+
+void Mesh::reorderTriangles() {
+    uint32_t triangleCount = (uint32_t) m_F.cols(),
+             vertexCount = (uint32_t) m_V.cols();
+
+    /* Quantize the triangle centroids to 21 bits per axis and
+       sort the triangles by their interleaved (Morton) code */
+    Vector3f scale = m_bbox.getExtents();
+    for (int i=0; i<3; ++i)
+        scale[i] = scale[i] > 0 ? (float) 0x1FFFFF / scale[i] : 0.0f;
+
+    std::vector<std::pair<uint64_t, uint32_t>> order(triangleCount);
+    for (uint32_t i=0; i<triangleCount; ++i) {
+        Vector3f q = (getCentroid(i) - m_bbox.min).cwiseProduct(scale);
+        uint64_t code = 0;
+        for (int k=0; k<3; ++k)
+            code |= expandBits((uint64_t) std::min(std::max(q[k], 0.0f), (float) 0x1FFFFF)) << k;
+        order[i] = std::make_pair(code, i);
+    }
+    std::sort(order.begin(), order.end());
+
+    /* Renumber the vertices in the order of their first use */
+    std::vector<uint32_t> newIndex(vertexCount, (uint32_t) -1);
+    uint32_t nextIndex = 0;
+    MatrixXu F(3, triangleCount);
+    for (uint32_t i=0; i<triangleCount; ++i) {
+        for (int k=0; k<3; ++k) {
+            uint32_t &index = newIndex[m_F(k, order[i].second)];
+            if (index == (uint32_t) -1)
+                index = nextIndex++;
+            F(k, i) = index;
+        }
     }
+    for (uint32_t &index : newIndex) {
+        if (index == (uint32_t) -1)
+            index = nextIndex++;
+    }
+
+    m_F = std::move(F);
+    m_V = permuteColumns(m_V, newIndex);
+    if (m_N.size() > 0)
+        m_N = permuteColumns(m_N, newIndex);
+    if (m_UV.size() > 0)
+        m_UV = permuteColumns(m_UV, newIndex);
+}
+
+size_t Mesh::compactIndices() {
+    if (m_F.cols() == 0 || m_V.cols() > 0x10000)
+        return 0;
+
+    MatrixXu16 F16 = m_F.cast<uint16_t>();
+    m_F16 = std::move(F16);
+    m_F = MeshBuffer<uint32_t>();
+
+    return m_F16.getByteSize();
+}
+
+size_t Mesh::compactAttributes() {
+    size_t before = sizeof(float) * (m_N.size() + m_UV.size());
+
+    if (m_N.size() > 0) {
+        MatrixXu NOct(1, m_N.cols());
+        for (uint32_t i=0; i<m_N.cols(); ++i)
+            NOct(0, i) = encodeOctahedral(m_N.col(i));
+        m_NOct = std::move(NOct);
+        m_N = MeshBuffer<float>();
+    }
+
+    if (m_UV.size() > 0) {
+        MatrixXu16 UVHalf(2, m_UV.cols());
+        for (uint32_t i=0; i<m_UV.cols(); ++i) {
+            UVHalf(0, i) = half(m_UV(0, i)).bits();
+            UVHalf(1, i) = half(m_UV(1, i)).bits();
+        }
+        m_UVHalf = std::move(UVHalf);
+        m_UV = MeshBuffer<float>();
+    }
+
+    size_t after = sizeof(uint32_t) * m_NOct.size() +
+                   sizeof(uint16_t) * m_UVHalf.size();
+
+    return before - after;
 }
 
 float Mesh::surfaceArea(uint32_t index) const {
-    uint32_t i0 = m_F(0, index), i1 = m_F(1, index), i2 = m_F(2, index);
+    if (m_clusters) {
+        TriangleVertices tri;
+        m_clusters->getTriangle(index, tri);
+        return 0.5f * Vector3f((tri.p[1] - tri.p[0]).cross(tri.p[2] - tri.p[0])).norm();
+    }
+
+    uint32_t i0 = getVertexIndex(index, 0), i1 = getVertexIndex(index, 1),
+             i2 = getVertexIndex(index, 2);
 
     const Point3f p0 = m_V.col(i0), p1 = m_V.col(i1), p2 = m_V.col(i2);
 
@@ -37,9 +538,20 @@ float Mesh::surfaceArea(uint32_t index) const {
 }
 
 bool Mesh::rayIntersect(uint32_t index, const Ray3f &ray, float &u, float &v, float &t) const {
-    uint32_t i0 = m_F(0, index), i1 = m_F(1, index), i2 = m_F(2, index);
-    const Point3f p0 = m_V.col(i0), p1 = m_V.col(i1), p2 = m_V.col(i2);
+    if (m_clusters) {
+        TriangleVertices tri;
+        m_clusters->getTriangle(index, tri);
+        return rayIntersect(tri.p[0], tri.p[1], tri.p[2], ray, u, v, t);
+    }
+
+    if (hasCompactIndices())
+        return rayIntersect<uint16_t>(index, ray, u, v, t);
+    else
+        return rayIntersect<uint32_t>(index, ray, u, v, t);
+}
 
+bool Mesh::rayIntersect(const Point3f &p0, const Point3f &p1, const Point3f &p2,
+                        const Ray3f &ray, float &u, float &v, float &t) {
     /* Find vectors for two edges sharing v[0] */
     Vector3f edge1 = p1 - p0, edge2 = p2 - p0;
 
@@ -76,80 +588,534 @@ bool Mesh::rayIntersect(uint32_t index, const Ray3f &ray, float &u, float &v, fl
 }
 
 BoundingBox3f Mesh::getBoundingBox(uint32_t index) const {
-    BoundingBox3f result(m_V.col(m_F(0, index)));
-    result.expandBy(m_V.col(m_F(1, index)));
-    result.expandBy(m_V.col(m_F(2, index)));
+    if (m_clusters) {
+        TriangleVertices tri;
+        m_clusters->getTriangle(index, tri);
+        BoundingBox3f result(tri.p[0]);
+        result.expandBy(tri.p[1]);
+        result.expandBy(tri.p[2]);
+        return result;
+    }
+
+    BoundingBox3f result(m_V.col(getVertexIndex(index, 0)));
+    result.expandBy(m_V.col(getVertexIndex(index, 1)));
+    result.expandBy(m_V.col(getVertexIndex(index, 2)));
     return result;
 }
 
 Point3f Mesh::getCentroid(uint32_t index) const {
+    if (m_clusters) {
+        TriangleVertices tri;
+        m_clusters->getTriangle(index, tri);
+        return (1.0f / 3.0f) * (tri.p[0] + tri.p[1] + tri.p[2]);
+    }
+
     return (1.0f / 3.0f) *
-        (m_V.col(m_F(0, index)) +
-         m_V.col(m_F(1, index)) +
-         m_V.col(m_F(2, index)));
-}
-
-void Mesh::addChild(NoriObject *obj) {
-    switch (obj->getClassType()) {
-        case EBSDF:
-            if (m_bsdf)
-                throw NoriException(
-                    "Mesh: tried to register multiple BSDF instances!");
-            m_bsdf = static_cast<BSDF *>(obj);
-            break;
+        (m_V.col(getVertexIndex(index, 0)) +
+         m_V.col(getVertexIndex(index, 1)) +
+         m_V.col(getVertexIndex(index, 2)));
+}
 
-        case EEmitter: {
-                Emitter *emitter = static_cast<Emitter *>(obj);
-                if (m_emitter)
-                    throw NoriException(
-                        "Mesh: tried to register multiple Emitter instances!");
-                m_emitter = emitter;
-            }
-            break;
+void Mesh::getTriangle(uint32_t index, TriangleVertices &tri) const {
+    if (m_clusters) {
+        m_clusters->getTriangle(index, tri);
+        return;
+    }
 
-        default:
-            throw NoriException("Mesh::addChild(<%s>) is not supported!",
-                                classTypeName(obj->getClassType()));
+    bool hasNormals = hasVertexNormals(), hasTexCoords = hasVertexTexCoords();
+    for (int k=0; k<3; ++k) {
+        uint32_t idx = getVertexIndex(index, k);
+        tri.p[k] = m_V.col(idx);
+        if (hasNormals)
+            tri.n[k] = getVertexNormal(idx);
+        if (hasTexCoords)
+            tri.uv[k] = getVertexTexCoord(idx);
     }
 }
 
+bool Mesh::isTransparent(uint32_t index, float u, float v) const {
+    EAlphaCoverage coverage = getAlphaCoverage(index);
+    if (coverage != EPartial)
+        return coverage == ETransparent;
+
+    Point2f uv0 = getVertexTexCoord(getVertexIndex(index, 0)),
+            uv1 = getVertexTexCoord(getVertexIndex(index, 1)),
+            uv2 = getVertexTexCoord(getVertexIndex(index, 2));
+
+    return isCutout(Point2f((1 - u - v) * uv0 + u * uv1 + v * uv2));
+}
+
+void Mesh::setHitInformation(uint32_t index, const Ray3f &ray, Intersection &its) const {
+    /* Find the barycentric coordinates */
+    Vector3f bary;
+    bary << 1-its.uv.sum(), its.uv;
+
+    /* Look up the vertices of the triangle (decoding compact
+       attributes or paging in its cluster if necessary) */
+    TriangleVertices tri;
+    getTriangle(index, tri);
+
+    const Point3f &p0 = tri.p[0], &p1 = tri.p[1], &p2 = tri.p[2];
+
+    /* Compute the intersection positon accurately
+       using barycentric coordinates */
+    its.p = bary.x() * p0 + bary.y() * p1 + bary.z() * p2;
+
+    /* Compute proper texture coordinates if provided by the mesh */
+    if (hasVertexTexCoords())
+        its.uv = bary.x() * tri.uv[0] +
+            bary.y() * tri.uv[1] +
+            bary.z() * tri.uv[2];
+
+    /* Compute the geometry frame */
+    its.geoFrame = Frame((p1-p0).cross(p2-p0).normalized());
+
+    if (hasVertexNormals()) {
+        /* Compute the shading frame. Note that for simplicity,
+           the current implementation doesn't attempt to provide
+           tangents that are continuous across the surface. That
+           means that this code will need to be modified to be able
+           use anisotropic BRDFs, which need tangent continuity */
+
+        its.shFrame = Frame(
+            (bary.x() * tri.n[0] +
+             bary.y() * tri.n[1] +
+             bary.z() * tri.n[2]).normalized());
+    } else {
+        its.shFrame = its.geoFrame;
+    }
+}
+
+const DiscreteAliasTable &Mesh::getAreaTable() const {
+    if (!m_areaTableReady.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(m_areaTableMutex);
+        if (!m_areaTableReady.load(std::memory_order_relaxed)) {
+            uint32_t triangleCount = getTriangleCount();
+            m_areaTable.clear();
+            m_areaTable.reserve(triangleCount);
+            for (uint32_t i=0; i<triangleCount; ++i)
+                m_areaTable.append(surfaceArea(i));
+            m_areaTable.normalize();
+            m_areaTableReady.store(true, std::memory_order_release);
+        }
+    }
+    return m_areaTable;
+}
+
+void Mesh::samplePosition(const Point2f &sample_, Point3f &p, Normal3f &n, float &pdf) const {
+    const DiscreteAliasTable &areaTable = getAreaTable();
+    if (areaTable.getSum() == 0)
+        throw NoriException("Mesh::samplePosition(): \"%s\" has no surface area!", m_name);
+
+    Point2f sample(sample_);
+    uint32_t index = (uint32_t) areaTable.sampleReuse(sample.x());
+
+    TriangleVertices tri;
+    getTriangle(index, tri);
+
+    /* Uniformly sample the barycentric coordinates of the triangle */
+    float su = std::sqrt(1.0f - sample.x());
+    Vector3f bary(su * (1.0f - sample.y()), su * sample.y(), 1.0f - su);
+
+    p = bary.x() * tri.p[0] + bary.y() * tri.p[1] + bary.z() * tri.p[2];
+
+    if (hasVertexNormals())
+        n = (bary.x() * tri.n[0] + bary.y() * tri.n[1] + bary.z() * tri.n[2]).normalized();
+    else
+        n = (tri.p[1] - tri.p[0]).cross(tri.p[2] - tri.p[0]).normalized();
+
+    pdf = areaTable.getNormalization();
+}
+
 std::string Mesh::toString() const {
     return tfm::format(
         "Mesh[\n"
         "  name = \"%s\",\n"
         "  vertexCount = %i,\n"
         "  triangleCount = %i,\n"
+        "  compact = %s,\n"
+        "  indices = %s,\n"
+        "  clusters = %s,\n"
         "  bsdf = %s,\n"
         "  emitter = %s\n"
         "]",
         m_name,
-        m_V.cols(),
-        m_F.cols(),
+        getVertexCount(),
+        getTriangleCount(),
+        hasCompactAttributes() ? "true" : "false",
+        hasCompactIndices() ? "16 bit" : "32 bit",
+        m_clusters ? m_clusters->toString() : std::string("null"),
         m_bsdf ? indent(m_bsdf->toString()) : std::string("null"),
         m_emitter ? indent(m_emitter->toString()) : std::string("null")
     );
 }
 
-std::string Intersection::toString() const {
-    if (!mesh)
-        return "Intersection[invalid]";
+namespace {
+    /// Weak reference to the memory of a \ref MeshBuffer
+    template <typename Scalar> struct WeakMeshBuffer {
+        const Scalar *data = nullptr;
+        Eigen::Index rows = 0, cols = 0;
+        std::weak_ptr<const void> owner;
 
-    return tfm::format(
-        "Intersection[\n"
-        "  p = %s,\n"
-        "  t = %f,\n"
-        "  uv = %s,\n"
-        "  shFrame = %s,\n"
-        "  geoFrame = %s,\n"
-        "  mesh = %s\n"
-        "]",
-        p.toString(),
-        t,
-        uv.toString(),
-        indent(shFrame.toString()),
-        indent(geoFrame.toString()),
-        mesh ? mesh->toString() : std::string("null")
-    );
+        WeakMeshBuffer() { }
+
+        WeakMeshBuffer(const MeshBuffer<Scalar> &buffer)
+            : data(buffer.data()), rows(buffer.rows()), cols(buffer.cols()),
+              owner(buffer.getOwner()) { }
+
+        /// Try to recreate the buffer (returns \c false if it has expired)
+        bool lock(MeshBuffer<Scalar> &buffer) const {
+            if (!data) {
+                buffer = MeshBuffer<Scalar>();
+                return true;
+            }
+            std::shared_ptr<const void> ptr = owner.lock();
+            if (!ptr)
+                return false;
+            buffer = MeshBuffer<Scalar>(data, rows, cols, ptr);
+            return true;
+        }
+
+        /// Has the referenced memory been released?
+        bool expired() const { return data && owner.expired(); }
+    };
+
+    struct GeometryCacheEntry {
+        WeakMeshBuffer<float> V, N, UV;
+        WeakMeshBuffer<uint32_t> NOct, F;
+        WeakMeshBuffer<uint16_t> UVHalf, F16;
+        BoundingBox3f bbox;
+
+        /// Has any of the buffers been released?
+        bool expired() const {
+            return V.expired() || N.expired() || UV.expired() || NOct.expired() ||
+                   UVHalf.expired() || F.expired() || F16.expired();
+        }
+    };
+
+    std::map<std::string, GeometryCacheEntry> &geometryCache() {
+        static std::map<std::string, GeometryCacheEntry> *cache =
+            new std::map<std::string, GeometryCacheEntry>();
+        return *cache;
+    }
+
+    tbb::mutex &geometryCacheMutex() {
+        static tbb::mutex *mutex = new tbb::mutex();
+        return *mutex;
+    }
+
+    /// Directory for geometry shared with other processes (empty: disabled)
+    std::string &sharedGeometryDirectory() {
+        static std::string *directory = new std::string();
+        return *directory;
+    }
+
+    /// Location of a buffer within a shared geometry file
+    struct SharedBufferInfo {
+        uint64_t offset;
+        uint32_t rows, cols;
+    };
+
+    /// Header at the beginning of a shared geometry file
+    struct SharedGeometryHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t keyLength;
+        uint64_t fileSize;
+        SharedBufferInfo buffers[7]; ///< V, N, UV, NOct, UVHalf, F, F16
+        float bbox[6];
+    };
+
+    const char *sharedGeometryMagic = "NORIGEO";
+    const uint32_t sharedGeometryVersion = 1;
+
+    /// Buffers in shared geometry files are aligned to cache lines
+    const uint64_t sharedBufferAlignment = 64;
+
+    /**
+     * \brief Return the name of the shared geometry file of a key
+     *
+     * The file version at the end of the key isn't part of the name, so
+     * that a new version of the geometry replaces the file of the old one.
+     */
+    std::string sharedGeometryFilename(const std::string &key) {
+        /* 64-bit FNV-1a hash (the file also stores the full key) */
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (char c : key.substr(0, key.rfind('|')))
+            hash = (hash ^ (uint8_t) c) * 0x100000001b3ull;
+        return tfm::format("%s/nori-%016x.geom", sharedGeometryDirectory(), hash);
+    }
+
+    /// Does a shared geometry file store the geometry of the given key?
+    bool sharedGeometryHasKey(const std::string &filename, const std::string &key) {
+        std::ifstream is(filename, std::ios::binary);
+        SharedGeometryHeader header;
+        if (!is.read((char *) &header, sizeof(SharedGeometryHeader)) ||
+            memcmp(header.magic, sharedGeometryMagic, 8) != 0 ||
+            header.version != sharedGeometryVersion ||
+            header.keyLength != key.length())
+            return false;
+        std::string stored(key.length(), '\0');
+        return is.read(&stored[0], key.length()) && stored == key;
+    }
+
+    /// Create a buffer that refers to a part of a mapped shared geometry file
+    template <typename Scalar>
+    MeshBuffer<Scalar> mapBuffer(const std::shared_ptr<const void> &owner,
+                                 const uint8_t *data, const SharedBufferInfo &info) {
+        if (info.rows == 0 || info.cols == 0)
+            return MeshBuffer<Scalar>();
+        return MeshBuffer<Scalar>((const Scalar *) (data + info.offset),
+                                  info.rows, info.cols, owner);
+    }
+
+#if !defined(_WIN32)
+    /// Read-only mapping of a shared geometry file, which owns the mapped buffers
+    struct SharedGeometryMapping {
+        const uint8_t *data;
+        size_t size;
+
+        SharedGeometryMapping(const uint8_t *data, size_t size) : data(data), size(size) { }
+        ~SharedGeometryMapping() { munmap((void *) data, size); }
+    };
+#endif
+};
+
+std::string GeometryCache::makeKey(const filesystem::path &filename,
+                                   const Transform &trafo,
+                                   const std::string &options) {
+    std::ostringstream oss;
+    oss << filename.make_absolute().str() << "|" << options << "|" << std::hexfloat;
+    const Eigen::Matrix4f &matrix = trafo.getMatrix();
+    for (int i=0; i<16; ++i)
+        oss << matrix.data()[i] << ",";
+
+    /* Cached geometry must not outlive changes to the file, even ones
+       within the same second that keep its size */
+    oss << "|" << fileVersion(filename.str());
+    return oss.str();
+}
+
+void GeometryCache::setSharedDirectory(const std::string &directory) {
+#if defined(_WIN32)
+    if (!directory.empty())
+        throw NoriException("GeometryCache: shared geometry is not supported on Windows!");
+#endif
+    sharedGeometryDirectory() = directory;
+}
+
+void GeometryCache::put(const std::string &key, Mesh *mesh) {
+    /* Replace the buffers by a mapping that other processes can share.
+       Another process may have published them while this one was busy. */
+    if (!sharedGeometryDirectory().empty() && !attachShared(key, mesh)) {
+        publishShared(key, mesh);
+        attachShared(key, mesh);
+    }
+    store(key, mesh);
+}
+
+void GeometryCache::store(const std::string &key, const Mesh *mesh) {
+    GeometryCacheEntry entry;
+    entry.V = mesh->m_V;
+    entry.N = mesh->m_N;
+    entry.UV = mesh->m_UV;
+    entry.NOct = mesh->m_NOct;
+    entry.UVHalf = mesh->m_UVHalf;
+    entry.F = mesh->m_F;
+    entry.F16 = mesh->m_F16;
+    entry.bbox = mesh->m_bbox;
+
+    tbb::mutex::scoped_lock lock(geometryCacheMutex());
+    auto &cache = geometryCache();
+
+    /* Drop the entries of geometry that is no longer used by any mesh */
+    for (auto it = cache.begin(); it != cache.end(); ) {
+        if (it->second.expired())
+            it = cache.erase(it);
+        else
+            ++it;
+    }
+    cache[key] = entry;
+}
+
+bool GeometryCache::get(const std::string &key, Mesh *mesh) {
+    {
+        tbb::mutex::scoped_lock lock(geometryCacheMutex());
+        auto &cache = geometryCache();
+        auto it = cache.find(key);
+        if (it != cache.end()) {
+            const GeometryCacheEntry &entry = it->second;
+            MeshBuffer<float> V, N, UV;
+            MeshBuffer<uint32_t> NOct, F;
+            MeshBuffer<uint16_t> UVHalf, F16;
+            if (entry.V.lock(V) && entry.N.lock(N) && entry.UV.lock(UV) &&
+                entry.NOct.lock(NOct) && entry.UVHalf.lock(UVHalf) &&
+                entry.F.lock(F) && entry.F16.lock(F16)) {
+                mesh->m_V = V;
+                mesh->m_N = N;
+                mesh->m_UV = UV;
+                mesh->m_NOct = NOct;
+                mesh->m_UVHalf = UVHalf;
+                mesh->m_F = F;
+                mesh->m_F16 = F16;
+                mesh->m_bbox = entry.bbox;
+                return true;
+            }
+
+            /* The last mesh using this geometry was destroyed */
+            cache.erase(it);
+        }
+    }
+
+    /* Attach to geometry that was published by another process */
+    if (sharedGeometryDirectory().empty() || !attachShared(key, mesh))
+        return false;
+    store(key, mesh);
+    return true;
+}
+
+bool GeometryCache::attachShared(const std::string &key, Mesh *mesh) {
+#if defined(_WIN32)
+    return false;
+#else
+    std::string filename = sharedGeometryFilename(key);
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+
+    struct stat fileStat;
+    size_t fileSize = fstat(fd, &fileStat) == 0 ? (size_t) fileStat.st_size : 0;
+    void *ptr = fileSize >= sizeof(SharedGeometryHeader)
+        ? mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (ptr == MAP_FAILED)
+        return false;
+
+    auto mapping = std::make_shared<SharedGeometryMapping>((const uint8_t *) ptr, fileSize);
+    const uint8_t *data = mapping->data;
+
+    /* Files with a different key (i.e. a hash collision) are ignored */
+    SharedGeometryHeader header;
+    memcpy(&header, data, sizeof(SharedGeometryHeader));
+    if (memcmp(header.magic, sharedGeometryMagic, 8) != 0 ||
+        header.version != sharedGeometryVersion ||
+        header.fileSize != fileSize ||
+        header.keyLength != key.length() ||
+        sizeof(SharedGeometryHeader) + key.length() > fileSize ||
+        memcmp(data + sizeof(SharedGeometryHeader), key.data(), key.length()) != 0)
+        return false;
+
+    const size_t scalarSize[7] = { 4, 4, 4, 4, 2, 4, 2 };
+    for (int i=0; i<7; ++i) {
+        const SharedBufferInfo &info = header.buffers[i];
+        if (info.offset + scalarSize[i] * (uint64_t) info.rows * info.cols > fileSize)
+            return false;
+    }
+
+    mesh->m_V = mapBuffer<float>(mapping, data, header.buffers[0]);
+    mesh->m_N = mapBuffer<float>(mapping, data, header.buffers[1]);
+    mesh->m_UV = mapBuffer<float>(mapping, data, header.buffers[2]);
+    mesh->m_NOct = mapBuffer<uint32_t>(mapping, data, header.buffers[3]);
+    mesh->m_UVHalf = mapBuffer<uint16_t>(mapping, data, header.buffers[4]);
+    mesh->m_F = mapBuffer<uint32_t>(mapping, data, header.buffers[5]);
+    mesh->m_F16 = mapBuffer<uint16_t>(mapping, data, header.buffers[6]);
+    mesh->m_bbox = BoundingBox3f(
+        Point3f(header.bbox[0], header.bbox[1], header.bbox[2]),
+        Point3f(header.bbox[3], header.bbox[4], header.bbox[5]));
+
+    cout << "Attached the shared geometry of \"" << mesh->getName() << "\" ("
+         << memString(fileSize) << " in \"" << filename << "\")" << endl;
+    return true;
+#endif
+}
+
+
+void GeometryCache::publishShared(const std::string &key, const Mesh *mesh) {
+#if !defined(_WIN32)
+    std::string filename = sharedGeometryFilename(key);
+    std::string tempName = tfm::format("%s.%i.tmp", filename, (int) getpid());
+
+    const uint8_t *buffers[7] = {
+        (const uint8_t *) mesh->m_V.data(), (const uint8_t *) mesh->m_N.data(),
+        (const uint8_t *) mesh->m_UV.data(), (const uint8_t *) mesh->m_NOct.data(),
+        (const uint8_t *) mesh->m_UVHalf.data(), (const uint8_t *) mesh->m_F.data(),
+        (const uint8_t *) mesh->m_F16.data()
+    };
+    const Eigen::Index rows[7] = {
+        mesh->m_V.rows(), mesh->m_N.rows(), mesh->m_UV.rows(), mesh->m_NOct.rows(),
+        mesh->m_UVHalf.rows(), mesh->m_F.rows(), mesh->m_F16.rows()
+    }, cols[7] = {
+        mesh->m_V.cols(), mesh->m_N.cols(), mesh->m_UV.cols(), mesh->m_NOct.cols(),
+        mesh->m_UVHalf.cols(), mesh->m_F.cols(), mesh->m_F16.cols()
+    };
+    const size_t sizes[7] = {
+        mesh->m_V.getByteSize(), mesh->m_N.getByteSize(), mesh->m_UV.getByteSize(),
+        mesh->m_NOct.getByteSize(), mesh->m_UVHalf.getByteSize(),
+        mesh->m_F.getByteSize(), mesh->m_F16.getByteSize()
+    };
+
+    SharedGeometryHeader header;
+    memset(&header, 0, sizeof(SharedGeometryHeader));
+    memcpy(header.magic, sharedGeometryMagic, 8);
+    header.version = sharedGeometryVersion;
+    header.keyLength = (uint32_t) key.length();
+
+    auto align = [](uint64_t offset) {
+        return (offset + sharedBufferAlignment - 1) / sharedBufferAlignment * sharedBufferAlignment;
+    };
+    uint64_t offset = align(sizeof(SharedGeometryHeader) + key.length());
+    for (int i=0; i<7; ++i) {
+        header.buffers[i].offset = offset;
+        header.buffers[i].rows = (uint32_t) rows[i];
+        header.buffers[i].cols = (uint32_t) cols[i];
+        offset = align(offset + sizes[i]);
+    }
+    header.fileSize = offset;
+    const BoundingBox3f &bbox = mesh->getBoundingBox();
+    for (int i=0; i<3; ++i) {
+        header.bbox[i] = bbox.min[i];
+        header.bbox[i+3] = bbox.max[i];
+    }
+
+    std::ofstream os(tempName, std::ios::binary);
+    if (os.fail())
+        throw NoriException("Unable to create shared geometry file \"%s\"!", tempName);
+
+    const char padding[sharedBufferAlignment] = { 0 };
+    os.write((const char *) &header, sizeof(SharedGeometryHeader));
+    os.write(key.data(), key.length());
+    uint64_t position = sizeof(SharedGeometryHeader) + key.length();
+    for (int i=0; i<7; ++i) {
+        os.write(padding, header.buffers[i].offset - position);
+        os.write((const char *) buffers[i], sizes[i]);
+        position = header.buffers[i].offset + sizes[i];
+    }
+    os.write(padding, header.fileSize - position);
+    os.close();
+
+    if (os.fail()) {
+        unlink(tempName.c_str());
+        throw NoriException("Unable to write shared geometry file \"%s\"!", tempName);
+    }
+
+    bool published = link(tempName.c_str(), filename.c_str()) == 0, replaced = false;
+    int error = errno;
+    if (!published && error == EEXIST && !sharedGeometryHasKey(filename, key)) {
+        /* The file holds a superseded version of the geometry (or, rarely,
+           a hash collision). Processes that mapped it keep their mapping. */
+        published = replaced = rename(tempName.c_str(), filename.c_str()) == 0;
+        error = errno;
+    }
+    unlink(tempName.c_str());
+    if (!published && error != EEXIST)
+        throw NoriException("Unable to create shared geometry file \"%s\": %s",
+                            filename, strerror(error));
+
+    if (published)
+        cout << (replaced ? "Replaced the shared geometry of \"" : "Published the geometry of \"")
+             << mesh->getName() << "\" (" << memString(header.fileSize) << " in \""
+             << filename << "\")" << endl;
+#endif
 }
 
 NORI_NAMESPACE_END
@@ -6,38 +6,106 @@
 
 #include <nori/mesh.h>
 #include <nori/timer.h>
+#include <nori/gzstream.h>
 #include <filesystem/resolver.h>
-#include <unordered_map>
 #include <fstream>
 
 NORI_NAMESPACE_BEGIN
 
 /**
  * \brief Loader for Wavefront OBJ triangle meshes
+ *
+ * Files ending in <tt>.gz</tt> are decompressed while they are parsed.
  */
 class WavefrontOBJ : public Mesh {
 public:
     WavefrontOBJ(const PropertyList &propList) {
-        typedef std::unordered_map<OBJVertex, uint32_t, OBJVertexHash> VertexMap;
-
         filesystem::path filename =
             getFileResolver()->resolve(propList.getString("filename"));
 
-        std::ifstream is(filename.str());
-        if (is.fail())
-            throw NoriException("Unable to open OBJ file \"%s\"!", filename);
         Transform trafo = propList.getTransform("toWorld", Transform());
 
+        /* Store normals and texture coordinates in compact form? */
+        m_compact = propList.getBoolean("compact", false);
+
+        /* Sort the triangles and vertices for better memory locality? */
+        m_reorder = propList.getBoolean("reorder", false);
+        std::string options = m_reorder ? "reorder," : "";
+
+        /* Weld vertices and remove degenerate and duplicate triangles? */
+        m_cleanup = propList.getBoolean("cleanup", false);
+        m_weldTolerance = propList.getFloat("weldTolerance", 0.0f);
+        if (m_cleanup)
+            options += tfm::format("cleanup=%g,", m_weldTolerance);
+
+        /* Build a chain of simplified meshes and choose one based on the
+           camera? The chosen level depends on the view, hence such meshes
+           don't share their geometry with other meshes. */
+        m_lodLevels = propList.getInteger("lodLevels", 1);
+        m_lodThreshold = propList.getFloat("lodThreshold", 1.0f);
+        bool lod = m_lodLevels > 1;
+
+        /* Cut out parts of the surface using an opacity mask? */
+        loadAlphaMask(propList);
+
+        m_name = filename.str();
+        if (propList.getBoolean("outOfCore", false)) {
+            if (lod)
+                throw NoriException("WavefrontOBJ: levels of detail are not "
+                                    "supported for out-of-core meshes!");
+            if (hasAlphaMask())
+                throw NoriException("WavefrontOBJ: opacity masks are not "
+                                    "supported for out-of-core meshes!");
+
+            /* Page the triangles from a cluster file, which is (re-)built
+               next to the OBJ file when it is missing or out of date */
+            m_clusterFilename = propList.getString("clusterFile", filename.str() + ".clusters");
+            m_clusterSize = (size_t) propList.getInteger("clusterSize", 64) * 1024;
+            m_geometryKey = GeometryCache::makeKey(filename, trafo, options + "outOfCore");
+            if (ClusterFile::isUpToDate(m_clusterFilename, m_geometryKey, filename.str())) {
+                m_clusters.reset(new ClusterFile(m_clusterFilename));
+                m_bbox = m_clusters->getBoundingBox();
+                cout << "Mapped \"" << m_clusterFilename << "\" (F="
+                     << m_clusters->getTriangleCount() << ", "
+                     << m_clusters->getClusterCount() << " clusters)" << endl;
+                return;
+            }
+        } else if (!lod && lookupGeometry(GeometryCache::makeKey(filename, trafo,
+                options + (m_compact ? "compact" : "")))) {
+            /* Share the buffers of an identical mesh that was loaded before */
+            cout << "Reusing the geometry of \"" << filename << "\" (V="
+                 << getVertexCount() << ", F=" << getTriangleCount() << ")" << endl;
+            return;
+        }
+
+        bool compressed = filename.extension() == "gz";
+        std::unique_ptr<std::istream> stream;
+        if (compressed) {
+            stream.reset(new GZipInputStream(filename.str()));
+        } else {
+            stream.reset(new std::ifstream(filename.str()));
+            if (stream->fail())
+                throw NoriException("Unable to open OBJ file \"%s\"!", filename);
+        }
+        std::istream &is = *stream;
+
         cout << "Loading \"" << filename << "\" .. ";
         cout.flush();
         Timer timer;
 
+        /* A quick first pass over the file determines the number of faces,
+           which is used to size the vertex deduplication table up front.
+           Closed triangle meshes have about half as many vertices as faces.
+           Compressed streams can't be rewound, the table grows instead. */
+        size_t faceCount = compressed ? 0 : countFaces(is);
+
         std::vector<Vector3f>   positions;
         std::vector<Vector2f>   texcoords;
         std::vector<Vector3f>   normals;
         std::vector<uint32_t>   indices;
         std::vector<OBJVertex>  vertices;
-        VertexMap vertexMap;
+        VertexMap vertexMap(vertices, faceCount / 2);
+        indices.reserve(3 * faceCount);
 
         std::string line_str;
         while (std::getline(is, line_str)) {
@@ -78,40 +146,34 @@ public:
                     nVertices = 6;
                 }
                 /* Convert to an indexed vertex list */
-                for (int i=0; i<nVertices; ++i) {
-                    const OBJVertex &v = verts[i];
-                    VertexMap::const_iterator it = vertexMap.find(v);
-                    if (it == vertexMap.end()) {
-                        vertexMap[v] = (uint32_t) vertices.size();
-                        indices.push_back((uint32_t) vertices.size());
-                        vertices.push_back(v);
-                    } else {
-                        indices.push_back(it->second);
-                    }
-                }
+                for (int i=0; i<nVertices; ++i)
+                    indices.push_back(vertexMap.insert(verts[i]));
             }
         }
 
-        m_F.resize(3, indices.size()/3);
-        memcpy(m_F.data(), indices.data(), sizeof(uint32_t)*indices.size());
+        MatrixXu F(3, indices.size()/3);
+        memcpy(F.data(), indices.data(), sizeof(uint32_t)*indices.size());
+        m_F = std::move(F);
 
-        m_V.resize(3, vertices.size());
+        MatrixXf V(3, vertices.size());
         for (uint32_t i=0; i<vertices.size(); ++i)
-            m_V.col(i) = positions.at(vertices[i].p-1);
+            V.col(i) = positions.at(vertices[i].p-1);
+        m_V = std::move(V);
 
         if (!normals.empty()) {
-            m_N.resize(3, vertices.size());
+            MatrixXf N(3, vertices.size());
             for (uint32_t i=0; i<vertices.size(); ++i)
-                m_N.col(i) = normals.at(vertices[i].n-1);
+                N.col(i) = normals.at(vertices[i].n-1);
+            m_N = std::move(N);
         }
 
         if (!texcoords.empty()) {
-            m_UV.resize(2, vertices.size());
+            MatrixXf UV(2, vertices.size());
             for (uint32_t i=0; i<vertices.size(); ++i)
-                m_UV.col(i) = texcoords.at(vertices[i].uv-1);
+                UV.col(i) = texcoords.at(vertices[i].uv-1);
+            m_UV = std::move(UV);
         }
 
-        m_name = filename.str();
         cout << "done. (V=" << m_V.cols() << ", F=" << m_F.cols() << ", took "
              << timer.elapsedString() << " and "
              << memString(m_F.size() * sizeof(uint32_t) +
@@ -151,12 +213,109 @@ protected:
     /// Hash function for OBJVertex
     struct OBJVertexHash {
         std::size_t operator()(const OBJVertex &v) const {
-            size_t hash = std::hash<uint32_t>()(v.p);
-            hash = hash * 37 + std::hash<uint32_t>()(v.uv);
-            hash = hash * 37 + std::hash<uint32_t>()(v.n);
-            return hash;
+            /* Combine the indices and scramble them using the
+               64-bit finalizer of MurmurHash3 */
+            uint64_t hash = (((uint64_t) v.p << 32) | v.uv) ^
+                            ((uint64_t) v.n * 0x9E3779B97F4A7C15ull);
+            hash ^= hash >> 33;
+            hash *= 0xFF51AFD7ED558CCDull;
+            hash ^= hash >> 33;
+            hash *= 0xC4CEB9FE1A85EC53ull;
+            hash ^= hash >> 33;
+            return (std::size_t) hash;
         }
     };
+
+    /**
+     * \brief Open addressing hash table that deduplicates OBJ vertices
+     *
+     * The table itself only stores 32-bit indices into the vertex list
+     * (using linear probing), which avoids the per-node allocations and
+     * pointer chasing of <tt>std::unordered_map</tt>. The capacity is a
+     * power of two, and the load factor is kept below 1/2.
+     */
+    class VertexMap {
+    public:
+        /// Create a table that can hold \c expected vertices without growing
+        VertexMap(std::vector<OBJVertex> &vertices, size_t expected)
+            : m_vertices(vertices) {
+            size_t capacity = 16;
+            while (capacity < 2 * expected)
+                capacity *= 2;
+            m_table.resize(capacity, (uint32_t) -1);
+        }
+
+        /**
+         * \brief Return the index of a vertex, appending it to the
+         * vertex list if it was not seen before
+         *
+         * This requires a single hash evaluation in both cases.
+         */
+        uint32_t insert(const OBJVertex &v) {
+            if (2 * (m_vertices.size() + 1) > m_table.size())
+                grow();
+
+            size_t mask = m_table.size() - 1,
+                   pos = OBJVertexHash()(v) & mask;
+
+            while (true) {
+                uint32_t index = m_table[pos];
+                if (index == (uint32_t) -1) {
+                    index = (uint32_t) m_vertices.size();
+                    m_table[pos] = index;
+                    m_vertices.push_back(v);
+                    return index;
+                } else if (m_vertices[index] == v) {
+                    return index;
+                }
+                pos = (pos + 1) & mask;
+            }
+        }
+
+    private:
+        /// Double the capacity and re-insert all entries
+        void grow() {
+            std::vector<uint32_t> table(m_table.size() * 2, (uint32_t) -1);
+            size_t mask = table.size() - 1;
+            for (uint32_t index : m_table) {
+                if (index == (uint32_t) -1)
+                    continue;
+                size_t pos = OBJVertexHash()(m_vertices[index]) & mask;
+                while (table[pos] != (uint32_t) -1)
+                    pos = (pos + 1) & mask;
+                table[pos] = index;
+            }
+            m_table.swap(table);
+        }
+
+        std::vector<OBJVertex> &m_vertices;
+        std::vector<uint32_t> m_table;
+    };
+
+    /**
+     * \brief Count the number of face ('f') statements in an OBJ file
+     *
+     * The stream is rewound to the beginning afterwards.
+     */
+    static size_t countFaces(std::istream &is) {
+        char buf[65536];
+        size_t count = 0;
+        int state = 1; /* 1: at line start, 2: seen 'f' at line start */
+
+        while (is.read(buf, sizeof(buf)) || is.gcount() > 0) {
+            std::streamsize size = is.gcount();
+            for (std::streamsize i = 0; i < size; ++i) {
+                char c = buf[i];
+                if (state == 2 && (c == ' ' || c == '\t'))
+                    count++;
+                state = c == '\n' ? 1 : (state == 1 && c == 'f' ? 2 : 0);
+            }
+        }
+
+        is.clear();
+        is.seekg(0);
+        return count;
+    }
 };
 
 NORI_REGISTER_CLASS(WavefrontOBJ, "obj");
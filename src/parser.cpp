@@ -6,9 +6,11 @@
 
 #include <nori/parser.h>
 #include <nori/proplist.h>
+#include <filesystem/resolver.h>
 #include <Eigen/Geometry>
 #include <pugixml.hpp>
 #include <fstream>
+#include <functional>
 #include <set>
 
 NORI_NAMESPACE_BEGIN
@@ -46,6 +48,7 @@ NoriObject *loadFromXML(const std::string &filename) {
         /* Object classes */
         EScene                = NoriObject::EScene,
         EMesh                 = NoriObject::EMesh,
+        EShape                = NoriObject::EShape,
         EBSDF                 = NoriObject::EBSDF,
         EPhaseFunction        = NoriObject::EPhaseFunction,
         EEmitter            = NoriObject::EEmitter,
@@ -78,6 +81,7 @@ NoriObject *loadFromXML(const std::string &filename) {
     std::map<std::string, ETag> tags;
     tags["scene"]      = EScene;
     tags["mesh"]       = EMesh;
+    tags["shape"]      = EShape;
     tags["bsdf"]       = EBSDF;
     tags["emitter"]  = EEmitter;
     tags["camera"]     = ECamera;
@@ -304,4 +308,24 @@ NoriObject *loadFromXML(const std::string &filename) {
     return parseTag(*doc.begin(), list, EInvalid);
 }
 
+std::vector<std::string> findReferencedFiles(const std::string &filename) {
+    pugi::xml_document doc;
+    pugi::xml_parse_result result = doc.load_file(filename.c_str());
+    if (!result)
+        throw NoriException("Error while parsing \"%s\": %s", filename, result.description());
+
+    std::vector<std::string> files;
+    std::function<void (const pugi::xml_node &)> visit = [&](const pugi::xml_node &node) {
+        if (strcmp(node.name(), "string") == 0) {
+            filesystem::path path = getFileResolver()->resolve(node.attribute("value").value());
+            if (path.is_file() && std::find(files.begin(), files.end(), path.str()) == files.end())
+                files.push_back(path.str());
+        }
+        for (const pugi::xml_node &child : node.children())
+            visit(child);
+    };
+    visit(doc);
+    return files;
+}
+
 NORI_NAMESPACE_END
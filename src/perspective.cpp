@@ -34,8 +34,6 @@ public:
         /* Near and far clipping planes in world-space units */
         m_nearClip = propList.getFloat("nearClip", 1e-4f);
         m_farClip = propList.getFloat("farClip", 1e4f);
-
-        m_rfilter = NULL;
     }
 
     void activate() {
@@ -69,8 +67,8 @@ public:
 
         /* If no reconstruction filter was assigned, instantiate a Gaussian filter */
         if (!m_rfilter)
-            m_rfilter = static_cast<ReconstructionFilter *>(
-                NoriObjectFactory::createInstance("gaussian", PropertyList()));
+            m_rfilter.reset(static_cast<ReconstructionFilter *>(
+                NoriObjectFactory::createInstance("gaussian", PropertyList())));
     }
 
     Color3f sampleRay(Ray3f &ray,
@@ -96,12 +94,70 @@ public:
         return Color3f(1.0f);
     }
 
+    float getProjectedSize(const BoundingBox3f &bbox) const {
+        /* Measure the bounding sphere of the box at its closest distance,
+           where a pixel covers the smallest area */
+        Point3f center = bbox.getCenter();
+        float radius = 0.5f * bbox.getExtents().norm();
+        float distance = (center - m_cameraToWorld * Point3f(0, 0, 0)).norm() - radius;
+        if (distance <= m_nearClip)
+            return std::numeric_limits<float>::infinity();
+
+        float pixelSize = 2 * distance * std::tan(degToRad(m_fov / 2.0f)) / m_outputSize.x();
+        return 2 * radius / pixelSize;
+    }
+
+    Camera *clone(const PropertyList &overrides) const {
+        PerspectiveCamera *camera = new PerspectiveCamera(*this);
+        camera->m_outputSize.x() = overrides.getInteger("width", m_outputSize.x());
+        camera->m_outputSize.y() = overrides.getInteger("height", m_outputSize.y());
+        camera->m_invOutputSize = camera->m_outputSize.cast<float>().cwiseInverse();
+        camera->m_cameraToWorld = overrides.getTransform("toWorld", m_cameraToWorld);
+
+        /* Move the camera like a <lookat> tag. The transformations that
+           precede the lookat in the scene (e.g. a mirroring <scale>) are
+           kept, and parameters that aren't given default to the current
+           view (keeping the viewing direction if only "origin" is given) */
+        if (overrides.has("origin") || overrides.has("target") || overrides.has("up")) {
+            const Eigen::Matrix4f &m = camera->m_cameraToWorld.getMatrix();
+            Point3f origin = m.block<3, 1>(0, 3);
+            Vector3f dir = m.block<3, 1>(0, 2).normalized(), up = m.block<3, 1>(0, 1);
+            Transform lookat = lookAt(origin, origin + dir, up);
+
+            Point3f newOrigin = overrides.getPoint("origin", origin);
+            Transform newLookat = lookAt(newOrigin, overrides.getPoint("target", newOrigin + dir),
+                                         overrides.getVector("up", up));
+            camera->m_cameraToWorld = newLookat * lookat.inverse() * camera->m_cameraToWorld;
+        }
+        camera->m_fov = overrides.getFloat("fov", m_fov);
+        camera->m_nearClip = overrides.getFloat("nearClip", m_nearClip);
+        camera->m_farClip = overrides.getFloat("farClip", m_farClip);
+        camera->activate();
+        return camera;
+    }
+
+    /// Build the transformation of a <lookat> tag (same convention as the parser)
+    static Transform lookAt(const Point3f &origin, const Point3f &target, const Vector3f &up) {
+        Vector3f dir = (target - origin).normalized();
+        Vector3f left = up.normalized().cross(dir);
+        if (!(left.squaredNorm() > 0) || !left.allFinite())
+            throw NoriException("PerspectiveCamera: the origin, target, and up vector don't "
+                                "define a camera orientation!");
+        left.normalize();
+        Vector3f newUp = dir.cross(left).normalized();
+
+        Eigen::Matrix4f trafo;
+        trafo << left, newUp, dir, origin,
+                  0, 0, 0, 1;
+        return Transform(trafo);
+    }
+
     void addChild(NoriObject *obj) {
         switch (obj->getClassType()) {
             case EReconstructionFilter:
                 if (m_rfilter)
                     throw NoriException("Camera: tried to register multiple reconstruction filters!");
-                m_rfilter = static_cast<ReconstructionFilter *>(obj);
+                m_rfilter.reset(static_cast<ReconstructionFilter *>(obj));
                 break;
 
             default:
@@ -10,6 +10,7 @@
 #include <nori/sampler.h>
 #include <nori/camera.h>
 #include <nori/emitter.h>
+#include <nori/mesh.h>
 
 NORI_NAMESPACE_BEGIN
 
@@ -18,6 +19,8 @@ Scene::Scene(const PropertyList &) {
 }
 
 Scene::~Scene() {
+    for (Shape *shape : m_children)
+        delete shape;
     delete m_accel;
     delete m_sampler;
     delete m_camera;
@@ -25,12 +28,16 @@ Scene::~Scene() {
 }
 
 void Scene::activate() {
-    m_accel->build();
-
     if (!m_integrator)
         throw NoriException("No integrator was specified!");
     if (!m_camera)
         throw NoriException("No camera was specified!");
+
+    /* Choose the level of detail of each mesh based on its size on the screen */
+    for (Mesh *mesh : m_meshes)
+        mesh->selectLevelOfDetail(m_camera);
+
+    m_accel->build();
     
     if (!m_sampler) {
         /* Create a default (independent) sampler */
@@ -45,10 +52,11 @@ void Scene::activate() {
 
 void Scene::addChild(NoriObject *obj) {
     switch (obj->getClassType()) {
-        case EMesh: {
-                Mesh *mesh = static_cast<Mesh *>(obj);
-                m_accel->addMesh(mesh);
-                m_meshes.push_back(mesh);
+        case EMesh:
+        case EShape: {
+                Shape *shape = static_cast<Shape *>(obj);
+                m_children.push_back(shape);
+                addShape(shape);
             }
             break;
         
@@ -83,13 +91,26 @@ void Scene::addChild(NoriObject *obj) {
     }
 }
 
+void Scene::addShape(Shape *shape) {
+    /* Compound shapes aren't intersected themselves, but their elements are */
+    if (shape->isCompound()) {
+        for (size_t i=0; Shape *element = shape->getElement(i); ++i)
+            addShape(element);
+        return;
+    }
+    m_accel->addShape(shape);
+    m_shapes.push_back(shape);
+    if (shape->getClassType() == EMesh)
+        m_meshes.push_back(static_cast<Mesh *>(shape));
+}
+
 std::string Scene::toString() const {
-    std::string meshes;
-    for (size_t i=0; i<m_meshes.size(); ++i) {
-        meshes += std::string("  ") + indent(m_meshes[i]->toString(), 2);
-        if (i + 1 < m_meshes.size())
-            meshes += ",";
-        meshes += "\n";
+    std::string shapes;
+    for (size_t i=0; i<m_shapes.size(); ++i) {
+        shapes += std::string("  ") + indent(m_shapes[i]->toString(), 2);
+        if (i + 1 < m_shapes.size())
+            shapes += ",";
+        shapes += "\n";
     }
 
     return tfm::format(
@@ -97,13 +118,13 @@ std::string Scene::toString() const {
         "  integrator = %s,\n"
         "  sampler = %s\n"
         "  camera = %s,\n"
-        "  meshes = {\n"
+        "  shapes = {\n"
         "  %s  }\n"
         "]",
         indent(m_integrator->toString()),
         indent(m_sampler->toString()),
         indent(m_camera->toString()),
-        indent(meshes, 2)
+        indent(shapes, 2)
     );
 }
 
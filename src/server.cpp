@@ -0,0 +1,337 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+*/
+
+#include <nori/server.h>
+#include <nori/socket.h>
+#include <nori/timer.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#if !defined(_WIN32)
+#  include <sys/socket.h>
+#  include <poll.h>
+#  include <unistd.h>
+#endif
+
+NORI_NAMESPACE_BEGIN
+
+namespace {
+    /// Connection of a client, which receives the replies about its jobs
+    class Client {
+    public:
+        Client(int fd) : m_fd(fd) { }
+
+        /// Close the connection once the client and all of its jobs are done
+        ~Client() {
+#if !defined(_WIN32)
+            close(m_fd);
+#endif
+        }
+
+        /// Send a line of text (failures are ignored, since the client may have left)
+        void reply(const std::string &line) {
+            std::string message = line;
+            std::replace(message.begin(), message.end(), '\n', ' ');
+            message += "\n";
+            std::lock_guard<std::mutex> lock(m_mutex);
+            sendAll(m_fd, message.data(), message.size());
+        }
+
+        /// Receive a line of text. Returns \c false once the connection is closed.
+        bool receive(std::string &line) {
+            size_t pos;
+            while ((pos = m_buffer.find('\n')) == std::string::npos) {
+                char data[1024];
+#if !defined(_WIN32)
+                ssize_t n = recv(m_fd, data, sizeof(data), 0);
+                if (n == -1 && errno == EINTR)
+                    continue;
+#else
+                int n = 0;
+#endif
+                if (n <= 0)
+                    return false;
+                m_buffer.append(data, (size_t) n);
+            }
+            line = m_buffer.substr(0, pos);
+            m_buffer.erase(0, pos + 1);
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            return true;
+        }
+
+        int getSocket() const { return m_fd; }
+
+        /// Has the client closed the connection?
+        bool isClosed() const { return m_closed; }
+
+        void setClosed() { m_closed = true; }
+
+    private:
+        int m_fd;
+        std::atomic<bool> m_closed { false };
+        std::mutex m_mutex;
+        std::string m_buffer; ///< Received data that doesn't form a complete line yet
+    };
+
+    /// A job along with the client that submitted it
+    struct QueuedJob {
+        RenderJob job;
+        std::shared_ptr<Client> client;
+    };
+
+    /// Priority queue of the submitted jobs
+    class JobQueue {
+    public:
+        /**
+         * \brief Queue a job and tell its client the number of jobs that
+         * will be rendered before it
+         *
+         * The reply is sent before the job can be started, so that it
+         * precedes all other replies about the job.
+         *
+         * \return \c false if the server is shutting down
+         */
+        bool push(const QueuedJob &job) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_shutdown)
+                return false;
+            size_t position = m_running ? 1 : 0;
+            for (const QueuedJob &other : m_jobs)
+                position += before(other.job, job.job) ? 1 : 0;
+            job.client->reply(tfm::format("queued %i %i", job.job.id, position));
+            m_jobs.push_back(job);
+            m_cond.notify_one();
+            return true;
+        }
+
+        /// Wait for the next job. Returns \c false after a shutdown.
+        bool pop(QueuedJob &job) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_running = false;
+            m_cond.wait(lock, [&] { return m_shutdown || !m_jobs.empty(); });
+            if (m_shutdown)
+                return false;
+            auto it = m_jobs.begin();
+            for (auto it2 = m_jobs.begin(); it2 != m_jobs.end(); ++it2) {
+                if (before(it2->job, it->job))
+                    it = it2;
+            }
+            job = *it;
+            m_jobs.erase(it);
+            m_running = true;
+            m_runningId = job.job.id;
+            return true;
+        }
+
+        /// Stop handing out jobs and return the ones that are still queued
+        std::vector<QueuedJob> shutdown() {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_shutdown = true;
+            m_cond.notify_all();
+            std::vector<QueuedJob> jobs;
+            jobs.swap(m_jobs);
+            return jobs;
+        }
+
+        bool isShutdown() {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_shutdown;
+        }
+
+        /// Return a status line (ID of the running job, and the number of queued jobs)
+        std::string status() {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return tfm::format("status %s %i", m_running ? std::to_string(m_runningId)
+                               : std::string("-"), m_jobs.size());
+        }
+
+    private:
+        /// Is job \c a rendered before job \c b?
+        static bool before(const RenderJob &a, const RenderJob &b) {
+            return a.priority > b.priority || (a.priority == b.priority && a.id < b.id);
+        }
+
+        std::mutex m_mutex;
+        std::condition_variable m_cond;
+        std::vector<QueuedJob> m_jobs;
+        bool m_running = false, m_shutdown = false;
+        uint32_t m_runningId = 0;
+    };
+
+    /// Parse the parameters of a "render" request
+    void parseRenderRequest(std::istringstream &is, RenderJob &job) {
+        std::string token;
+
+        while (is >> token) {
+            size_t eq = token.find('=');
+            if (eq == std::string::npos || eq == 0)
+                throw NoriException("expected a parameter of the form key=value instead of \"%s\"", token);
+            std::string key = token.substr(0, eq), value = token.substr(eq + 1);
+
+            if (key == "scene") {
+                job.scene = value;
+            } else if (key == "output") {
+                job.output = value;
+            } else if (key == "spp") {
+                int spp = toInt(value);
+                if (spp <= 0)
+                    throw NoriException("\"spp\" must be positive");
+                job.sampleCount = (uint32_t) spp;
+            } else if (key == "priority") {
+                job.priority = toInt(value);
+            } else if (key == "width" || key == "height") {
+                int size = toInt(value);
+                if (size <= 0)
+                    throw NoriException("\"%s\" must be positive", key);
+                job.camera.setInteger(key, size);
+                job.overrideCamera = true;
+            } else if (key == "fov") {
+                float fov = toFloat(value);
+                if (fov <= 0 || fov >= 180)
+                    throw NoriException("\"fov\" must be between 0 and 180 degrees");
+                job.camera.setFloat(key, fov);
+                job.overrideCamera = true;
+            } else if (key == "origin" || key == "target") {
+                job.camera.setPoint(key, Point3f(toVector3f(value)));
+                job.overrideCamera = true;
+            } else if (key == "up") {
+                job.camera.setVector(key, Vector3f(toVector3f(value)));
+                job.overrideCamera = true;
+            } else {
+                throw NoriException("unknown parameter \"%s\"", key);
+            }
+        }
+
+        if (job.scene.empty())
+            throw NoriException("the \"scene\" parameter is missing");
+    }
+};
+
+RenderServer::RenderServer(const std::string &path) : m_path(path) {
+#if defined(_WIN32)
+    throw NoriException("RenderServer: the render server is not supported on Windows!");
+#else
+    m_socket = openSocket("unix:" + path, true);
+#endif
+}
+
+RenderServer::~RenderServer() {
+#if !defined(_WIN32)
+    if (m_socket != -1) {
+        close(m_socket);
+        unlink(m_path.c_str());
+    }
+#endif
+}
+
+void RenderServer::run(const RenderFunction &renderFunction) {
+#if !defined(_WIN32)
+    JobQueue queue;
+    std::atomic<uint32_t> jobCount(0);
+
+    /// Connected clients along with the threads serving them
+    std::vector<std::pair<std::shared_ptr<Client>, std::thread>> connections;
+
+    /* Every connection is served by a separate thread */
+    auto serve = [&](std::shared_ptr<Client> client) {
+        std::string line;
+        while (client->receive(line)) {
+            std::istringstream is(line);
+            std::string command;
+            if (!(is >> command))
+                continue;
+
+            if (command == "render") {
+                QueuedJob queued;
+                queued.client = client;
+                try {
+                    parseRenderRequest(is, queued.job);
+                } catch (const std::exception &e) {
+                    client->reply(std::string("error ") + e.what());
+                    continue;
+                }
+                queued.job.id = ++jobCount;
+                if (!queue.push(queued))
+                    client->reply("error the server is shutting down");
+            } else if (command == "status") {
+                client->reply(queue.status());
+            } else if (command == "shutdown") {
+                for (const QueuedJob &queued : queue.shutdown())
+                    queued.client->reply(tfm::format("failed %i the server was shut down", queued.job.id));
+            } else {
+                client->reply(tfm::format("error unknown command \"%s\"", command));
+            }
+        }
+        client->setClosed();
+    };
+
+    /* Accept connections until the server shuts down */
+    std::thread acceptThread([&] {
+        while (!queue.isShutdown()) {
+            pollfd pfd = { m_socket, POLLIN, 0 };
+            if (poll(&pfd, 1, 100) <= 0)
+                continue;
+            int fd = acceptSocket(m_socket);
+            if (fd == -1)
+                continue;
+
+            /* Release the threads of clients that have left */
+            for (auto it = connections.begin(); it != connections.end(); ) {
+                if (it->first->isClosed()) {
+                    it->second.join();
+                    it = connections.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+
+            std::shared_ptr<Client> client = std::make_shared<Client>(fd);
+            connections.emplace_back(client, std::thread(serve, client));
+        }
+    });
+
+    /* Render the jobs on this thread */
+    QueuedJob queued;
+    while (queue.pop(queued)) {
+        const RenderJob &job = queued.job;
+        Client &client = *queued.client;
+        cout << "Job " << job.id << ": rendering \"" << job.scene << "\"" << endl;
+        client.reply(tfm::format("started %i", job.id));
+
+        Timer timer;
+        int lastPercent = -1;
+        try {
+            std::string output = renderFunction(job, [&](float progress) {
+                /* Only report changes */
+                int percent = (int) (progress * 100);
+                if (percent != lastPercent)
+                    client.reply(tfm::format("progress %i %i", job.id, percent));
+                lastPercent = percent;
+            });
+            client.reply(tfm::format("done %i %s %.3f", job.id, output, timer.elapsed() / 1000));
+        } catch (const std::exception &e) {
+            cerr << "Job " << job.id << " failed: " << e.what() << endl;
+            client.reply(tfm::format("failed %i %s", job.id, e.what()));
+        }
+        queued = QueuedJob();
+    }
+
+    /* Disconnect the clients, so that their threads finish */
+    acceptThread.join();
+    for (auto &connection : connections) {
+        ::shutdown(connection.first->getSocket(), SHUT_RDWR);
+        connection.second.join();
+    }
+#endif
+}
+
+NORI_NAMESPACE_END
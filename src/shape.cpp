@@ -0,0 +1,94 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+*/
+
+#include <nori/shape.h>
+#include <nori/bsdf.h>
+#include <nori/emitter.h>
+#include <nori/bitmap.h>
+#include <filesystem/resolver.h>
+
+NORI_NAMESPACE_BEGIN
+
+Shape::~Shape() {
+    delete m_bsdf;
+    delete m_emitter;
+}
+
+void Shape::activate() {
+    if (!m_bsdf) {
+        /* If no material was assigned, instantiate a diffuse BRDF */
+        m_bsdf = static_cast<BSDF *>(
+            NoriObjectFactory::createInstance("diffuse", PropertyList()));
+    }
+}
+
+void Shape::addChild(NoriObject *obj) {
+    switch (obj->getClassType()) {
+        case EBSDF:
+            if (m_bsdf)
+                throw NoriException(
+                    "Shape: tried to register multiple BSDF instances!");
+            m_bsdf = static_cast<BSDF *>(obj);
+            break;
+
+        case EEmitter: {
+                Emitter *emitter = static_cast<Emitter *>(obj);
+                if (m_emitter)
+                    throw NoriException(
+                        "Shape: tried to register multiple Emitter instances!");
+                m_emitter = emitter;
+            }
+            break;
+
+        default:
+            throw NoriException("Shape::addChild(<%s>) is not supported!",
+                                classTypeName(obj->getClassType()));
+    }
+}
+
+void Shape::loadAlphaMask(const PropertyList &propList) {
+    std::string name = propList.getString("alphaMask", "");
+    if (name.empty())
+        return;
+
+    filesystem::path filename = getFileResolver()->resolve(name);
+    float threshold = propList.getFloat("alphaThreshold", 0.5f);
+
+    Bitmap bitmap(filename.str());
+    if (bitmap.size() == 0)
+        throw NoriException("Shape: the opacity mask \"%s\" is empty!", filename);
+
+    m_alphaMaskSize = Vector2i((int) bitmap.cols(), (int) bitmap.rows());
+    m_alphaMask.resize(bitmap.size());
+    for (int y=0; y<bitmap.rows(); ++y)
+        for (int x=0; x<bitmap.cols(); ++x)
+            m_alphaMask[(size_t) y * bitmap.cols() + x] =
+                bitmap(y, x).getLuminance() < threshold ? 1 : 0;
+}
+
+std::string Intersection::toString() const {
+    if (!shape)
+        return "Intersection[invalid]";
+
+    return tfm::format(
+        "Intersection[\n"
+        "  p = %s,\n"
+        "  t = %f,\n"
+        "  uv = %s,\n"
+        "  shFrame = %s,\n"
+        "  geoFrame = %s,\n"
+        "  shape = %s\n"
+        "]",
+        p.toString(),
+        t,
+        uv.toString(),
+        indent(shFrame.toString()),
+        indent(geoFrame.toString()),
+        shape ? shape->toString() : std::string("null")
+    );
+}
+
+NORI_NAMESPACE_END
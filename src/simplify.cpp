@@ -0,0 +1,316 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+*/
+
+#include <nori/simplify.h>
+#include <Eigen/Geometry>
+#include <Eigen/LU>
+#include <unordered_map>
+
+NORI_NAMESPACE_BEGIN
+
+/// Weight of the planes that keep open boundaries in place
+static const double BoundaryWeight = 10.0;
+
+MeshSimplifier::Quadric::Quadric(const Vector3d &n, double d, double w) {
+    a[0] = n.x() * n.x(); a[1] = n.x() * n.y(); a[2] = n.x() * n.z(); a[3] = n.x() * d;
+    a[4] = n.y() * n.y(); a[5] = n.y() * n.z(); a[6] = n.y() * d;
+    a[7] = n.z() * n.z(); a[8] = n.z() * d;
+    a[9] = d * d;
+    for (int i=0; i<10; ++i)
+        a[i] *= w;
+    weight = w;
+}
+
+MeshSimplifier::Quadric &MeshSimplifier::Quadric::operator+=(const Quadric &q) {
+    for (int i=0; i<10; ++i)
+        a[i] += q.a[i];
+    weight += q.weight;
+    return *this;
+}
+
+double MeshSimplifier::Quadric::evaluate(const Vector3d &p) const {
+    double x = p.x(), y = p.y(), z = p.z();
+    return a[0]*x*x + 2*a[1]*x*y + 2*a[2]*x*z + 2*a[3]*x
+         + a[4]*y*y + 2*a[5]*y*z + 2*a[6]*y
+         + a[7]*z*z + 2*a[8]*z
+         + a[9];
+}
+
+MeshSimplifier::MeshSimplifier(const Mesh *mesh) {
+    const MeshBuffer<float> &V = mesh->getVertexPositions(),
+                            &N = mesh->getVertexNormals(),
+                            &UV = mesh->getVertexTexCoords();
+    const MeshBuffer<uint32_t> &F = mesh->getIndices<uint32_t>();
+    uint32_t vertexCount = (uint32_t) V.cols();
+    m_triangleCount = (uint32_t) F.cols();
+
+    m_position.resize(vertexCount);
+    for (uint32_t i=0; i<vertexCount; ++i)
+        m_position[i] = V.col(i).cast<double>();
+    if (N.size() > 0) {
+        m_normal.resize(vertexCount);
+        for (uint32_t i=0; i<vertexCount; ++i)
+            m_normal[i] = N.col(i);
+    }
+    if (UV.size() > 0) {
+        m_texcoord.resize(vertexCount);
+        for (uint32_t i=0; i<vertexCount; ++i)
+            m_texcoord[i] = UV.col(i);
+    }
+
+    m_quadric.resize(vertexCount);
+    m_version.resize(vertexCount, 0);
+    m_vertexFaces.resize(vertexCount);
+    m_faces.resize(m_triangleCount);
+    m_faceRemoved.resize(m_triangleCount, false);
+
+    /* Count the triangles adjacent to every edge */
+    auto edgeKey = [](uint32_t i, uint32_t j) {
+        return ((uint64_t) std::min(i, j) << 32) | std::max(i, j);
+    };
+    std::unordered_map<uint64_t, uint32_t> edges(3 * (size_t) m_triangleCount / 2);
+
+    for (uint32_t f=0; f<m_triangleCount; ++f) {
+        for (int k=0; k<3; ++k) {
+            m_faces[f][k] = F(k, f);
+            m_vertexFaces[F(k, f)].push_back(f);
+            edges[edgeKey(F(k, f), F((k+1) % 3, f))]++;
+        }
+    }
+
+    /* Accumulate the planes of the triangles and the boundary constraints */
+    for (uint32_t f=0; f<m_triangleCount; ++f) {
+        const std::array<uint32_t, 3> &idx = m_faces[f];
+        Vector3d n = (m_position[idx[1]] - m_position[idx[0]]).cross(
+                      m_position[idx[2]] - m_position[idx[0]]);
+        double length = n.norm();
+        if (length == 0)
+            continue;
+        n /= length;
+
+        Quadric q(n, -n.dot(m_position[idx[0]]), 1.0);
+        for (int k=0; k<3; ++k)
+            m_quadric[idx[k]] += q;
+
+        for (int k=0; k<3; ++k) {
+            uint32_t i = idx[k], j = idx[(k+1) % 3];
+            if (edges[edgeKey(i, j)] != 1)
+                continue;
+            Vector3d bn = (m_position[j] - m_position[i]).cross(n);
+            double bl = bn.norm();
+            if (bl == 0)
+                continue;
+            bn /= bl;
+            Quadric bq(bn, -bn.dot(m_position[i]), BoundaryWeight);
+            m_quadric[i] += bq;
+            m_quadric[j] += bq;
+        }
+    }
+
+    for (const auto &edge : edges)
+        addCollapse((uint32_t) (edge.first >> 32), (uint32_t) edge.first);
+}
+
+void MeshSimplifier::addCollapse(uint32_t v0, uint32_t v1) {
+    Quadric q = m_quadric[v0];
+    q += m_quadric[v1];
+
+    const Vector3d &p0 = m_position[v0], &p1 = m_position[v1];
+    Vector3d mid = 0.5 * (p0 + p1);
+
+    Collapse c;
+    c.v0 = v0; c.v1 = v1;
+    c.stamp0 = m_version[v0];
+    c.stamp1 = m_version[v1];
+
+    /* Minimize the quadric. Fall back to the endpoints and the midpoint
+       if the system is singular, or if the optimum is far from the edge */
+    Eigen::Matrix3d A;
+    A << q.a[0], q.a[1], q.a[2],
+         q.a[1], q.a[4], q.a[5],
+         q.a[2], q.a[5], q.a[7];
+    Vector3d b(-q.a[3], -q.a[6], -q.a[8]);
+
+    bool found = false;
+    if (std::abs(A.determinant()) > 1e-12 * std::pow(A.cwiseAbs().maxCoeff(), 3)) {
+        Vector3d x = A.inverse() * b;
+        if ((x - mid).norm() <= 2 * (p1 - p0).norm()) {
+            c.target = x;
+            c.cost = q.evaluate(x);
+            found = true;
+        }
+    }
+
+    if (!found) {
+        const Vector3d candidates[3] = { p0, p1, mid };
+        c.cost = std::numeric_limits<double>::infinity();
+        for (const Vector3d &p : candidates) {
+            double cost = q.evaluate(p);
+            if (cost < c.cost) {
+                c.cost = cost;
+                c.target = p;
+            }
+        }
+    }
+
+    c.cost = std::max(c.cost, 0.0);
+    m_queue.push(c);
+}
+
+void MeshSimplifier::getNeighbors(uint32_t v, std::vector<uint32_t> &result) const {
+    for (uint32_t f : m_vertexFaces[v]) {
+        if (m_faceRemoved[f])
+            continue;
+        for (uint32_t w : m_faces[f]) {
+            if (w != v && std::find(result.begin(), result.end(), w) == result.end())
+                result.push_back(w);
+        }
+    }
+}
+
+bool MeshSimplifier::isValid(const Collapse &c) const {
+    /* Link condition: the vertices may only share the neighbors
+       that lie on the triangles adjacent to the edge */
+    std::vector<uint32_t> n0, n1;
+    getNeighbors(c.v0, n0);
+    getNeighbors(c.v1, n1);
+
+    uint32_t shared = 0, common = 0;
+    for (uint32_t f : m_vertexFaces[c.v0]) {
+        if (!m_faceRemoved[f] && std::find(m_faces[f].begin(),
+                m_faces[f].end(), c.v1) != m_faces[f].end())
+            shared++;
+    }
+    for (uint32_t w : n0) {
+        if (std::find(n1.begin(), n1.end(), w) != n1.end())
+            common++;
+    }
+    if (shared == 0 || common > shared)
+        return false;
+
+    /* Reject collapses that flip or degenerate the remaining triangles */
+    for (uint32_t v : { c.v0, c.v1 }) {
+        for (uint32_t f : m_vertexFaces[v]) {
+            if (m_faceRemoved[f])
+                continue;
+            const std::array<uint32_t, 3> &idx = m_faces[f];
+            Vector3d p[3], q[3];
+            bool removed = false;
+            for (int k=0; k<3; ++k) {
+                p[k] = m_position[idx[k]];
+                q[k] = (idx[k] == c.v0 || idx[k] == c.v1) ? c.target : p[k];
+                if (idx[k] == (v == c.v0 ? c.v1 : c.v0))
+                    removed = true;
+            }
+            if (removed)
+                continue;
+            Vector3d before = (p[1] - p[0]).cross(p[2] - p[0]),
+                     after  = (q[1] - q[0]).cross(q[2] - q[0]);
+            if (after.dot(before) <= 1e-3 * before.norm() * after.norm())
+                return false;
+        }
+    }
+
+    return true;
+}
+
+void MeshSimplifier::perform(const Collapse &c) {
+    uint32_t v0 = c.v0, v1 = c.v1;
+
+    /* Interpolate the attributes at the projection onto the edge */
+    Vector3d d = m_position[v1] - m_position[v0];
+    double t = d.squaredNorm() > 0 ? (c.target - m_position[v0]).dot(d) / d.squaredNorm() : 0;
+    float tf = (float) std::min(std::max(t, 0.0), 1.0);
+    if (!m_normal.empty()) {
+        Normal3f n = (1 - tf) * m_normal[v0] + tf * m_normal[v1];
+        if (n.squaredNorm() > 0)
+            m_normal[v0] = n.normalized();
+    }
+    if (!m_texcoord.empty())
+        m_texcoord[v0] = (1 - tf) * m_texcoord[v0] + tf * m_texcoord[v1];
+
+    m_position[v0] = c.target;
+    m_quadric[v0] += m_quadric[v1];
+    m_error = std::max(m_error, (float) std::sqrt(c.cost / m_quadric[v0].weight));
+
+    /* Remove the triangles of the edge and reconnect the others */
+    for (uint32_t f : m_vertexFaces[v1]) {
+        if (m_faceRemoved[f])
+            continue;
+        std::array<uint32_t, 3> &idx = m_faces[f];
+        if (std::find(idx.begin(), idx.end(), v0) != idx.end()) {
+            m_faceRemoved[f] = true;
+            m_triangleCount--;
+        } else {
+            std::replace(idx.begin(), idx.end(), v1, v0);
+            m_vertexFaces[v0].push_back(f);
+        }
+    }
+    m_vertexFaces[v1].clear();
+    m_vertexFaces[v1].shrink_to_fit();
+
+    std::vector<uint32_t> &faces = m_vertexFaces[v0];
+    faces.erase(std::remove_if(faces.begin(), faces.end(),
+        [&](uint32_t f) { return m_faceRemoved[f]; }), faces.end());
+
+    /* Outdate all queued collapses involving either vertex */
+    m_version[v0]++;
+    m_version[v1]++;
+
+    std::vector<uint32_t> neighbors;
+    getNeighbors(v0, neighbors);
+    for (uint32_t w : neighbors)
+        addCollapse(v0, w);
+}
+
+void MeshSimplifier::simplify(uint32_t targetCount) {
+    while (m_triangleCount > targetCount && !m_queue.empty()) {
+        Collapse c = m_queue.top();
+        m_queue.pop();
+
+        if (c.stamp0 != m_version[c.v0] || c.stamp1 != m_version[c.v1])
+            continue;
+        if (!isValid(c))
+            continue;
+
+        perform(c);
+    }
+}
+
+void MeshSimplifier::extract(MatrixXf &V, MatrixXf &N, MatrixXf &UV, MatrixXu &F) const {
+    std::vector<uint32_t> newIndex(m_position.size(), (uint32_t) -1);
+    uint32_t vertexCount = 0;
+    F.resize(3, m_triangleCount);
+    for (uint32_t f=0, j=0; f<(uint32_t) m_faces.size(); ++f) {
+        if (m_faceRemoved[f])
+            continue;
+        for (int k=0; k<3; ++k) {
+            uint32_t &index = newIndex[m_faces[f][k]];
+            if (index == (uint32_t) -1)
+                index = vertexCount++;
+            F(k, j) = index;
+        }
+        j++;
+    }
+
+    V.resize(3, vertexCount);
+    if (!m_normal.empty())
+        N.resize(3, vertexCount);
+    if (!m_texcoord.empty())
+        UV.resize(2, vertexCount);
+    for (uint32_t i=0; i<(uint32_t) newIndex.size(); ++i) {
+        uint32_t index = newIndex[i];
+        if (index == (uint32_t) -1)
+            continue;
+        V.col(index) = m_position[i].cast<float>();
+        if (!m_normal.empty())
+            N.col(index) = m_normal[i];
+        if (!m_texcoord.empty())
+            UV.col(index) = m_texcoord[i];
+    }
+}
+
+NORI_NAMESPACE_END
@@ -0,0 +1,160 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+*/
+
+#include <nori/socket.h>
+
+#if !defined(_WIN32)
+#  include <sys/socket.h>
+#  include <sys/un.h>
+#  include <netinet/in.h>
+#  include <netinet/tcp.h>
+#  include <netdb.h>
+#  include <unistd.h>
+#endif
+
+NORI_NAMESPACE_BEGIN
+
+#if defined(_WIN32)
+int openSocket(const std::string &, bool) {
+    throw NoriException("openSocket(): sockets are not supported on Windows!");
+}
+
+int acceptSocket(int) { return -1; }
+
+bool sendAll(int, const void *, size_t) { return false; }
+
+bool recvAll(int, void *, size_t) { return false; }
+#else
+namespace {
+    /**
+     * Sending to a closed connection must not kill the process. Linux
+     * supports MSG_NOSIGNAL when sending, while other systems (e.g. macOS)
+     * provide SO_NOSIGPIPE to configure this for a socket.
+     */
+    void disableSigPipe(int fd) {
+#if !defined(MSG_NOSIGNAL) && defined(SO_NOSIGPIPE)
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(int));
+#endif
+    }
+};
+
+int openSocket(const std::string &address, bool server) {
+    if (address.compare(0, 5, "unix:") == 0) {
+        std::string path = address.substr(5);
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(sockaddr_un));
+        addr.sun_family = AF_UNIX;
+        if (path.empty() || path.length() >= sizeof(addr.sun_path))
+            throw NoriException("Invalid socket path \"%s\"!", path);
+        strcpy(addr.sun_path, path.c_str());
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd == -1)
+            throw NoriException("Unable to create a Unix-domain socket: %s", strerror(errno));
+        if (server) {
+            unlink(path.c_str());
+            if (bind(fd, (sockaddr *) &addr, sizeof(sockaddr_un)) != 0 || listen(fd, 128) != 0) {
+                close(fd);
+                throw NoriException("Unable to listen on \"%s\": %s", path, strerror(errno));
+            }
+        } else if (connect(fd, (sockaddr *) &addr, sizeof(sockaddr_un)) != 0) {
+            close(fd);
+            return -1;
+        }
+        disableSigPipe(fd);
+        return fd;
+    }
+
+    size_t colon = address.find_last_of(':');
+    if (colon == std::string::npos)
+        throw NoriException("Invalid address \"%s\" (expected host:port or unix:path)!", address);
+    std::string host = address.substr(0, colon), port = address.substr(colon + 1);
+
+    addrinfo hints, *result = nullptr;
+    memset(&hints, 0, sizeof(addrinfo));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = server ? AI_PASSIVE : 0;
+    int rv = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result);
+    if (rv != 0)
+        throw NoriException("Unable to resolve \"%s\": %s", address, gai_strerror(rv));
+
+    int fd = -1;
+    for (addrinfo *ai = result; ai && fd == -1; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd == -1)
+            continue;
+        int one = 1;
+        bool success;
+        if (server) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(int));
+            success = bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 128) == 0;
+        } else {
+            success = connect(fd, ai->ai_addr, ai->ai_addrlen) == 0;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(int));
+        }
+        if (!success) {
+            close(fd);
+            fd = -1;
+        } else {
+            disableSigPipe(fd);
+        }
+    }
+    freeaddrinfo(result);
+
+    if (fd == -1 && server)
+        throw NoriException("Unable to listen on \"%s\": %s", address, strerror(errno));
+    return fd;
+}
+
+int acceptSocket(int fd) {
+    int result;
+    do {
+        result = accept(fd, nullptr, nullptr);
+    } while (result == -1 && errno == EINTR);
+    if (result != -1)
+        disableSigPipe(result);
+    return result;
+}
+
+bool sendAll(int fd, const void *data, size_t size) {
+#if defined(MSG_NOSIGNAL)
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+#endif
+    const char *ptr = (const char *) data;
+    while (size > 0) {
+        ssize_t n = send(fd, ptr, size, flags);
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR)
+                continue;
+            return false;
+        }
+        ptr += n;
+        size -= (size_t) n;
+    }
+    return true;
+}
+
+bool recvAll(int fd, void *data, size_t size) {
+    char *ptr = (char *) data;
+    while (size > 0) {
+        ssize_t n = recv(fd, ptr, size, 0);
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR)
+                continue;
+            return false;
+        }
+        ptr += n;
+        size -= (size_t) n;
+    }
+    return true;
+}
+#endif
+
+NORI_NAMESPACE_END
@@ -0,0 +1,170 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+*/
+
+#include <nori/shape.h>
+#include <nori/bsdf.h>
+#include <nori/emitter.h>
+#include <Eigen/LU>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Analytic sphere
+ *
+ * The sphere is intersected by solving a quadratic equation instead of
+ * tessellating it into triangles. It consists of a single primitive.
+ *
+ * <pre>
+ * &lt;shape type="sphere"&gt;
+ *     &lt;point name="center" value="0,0,0"/&gt;
+ *     &lt;float name="radius" value="1"/&gt;
+ *     &lt;transform name="toWorld"&gt; ... &lt;/transform&gt;
+ * &lt;/shape&gt;
+ * </pre>
+ *
+ * The optional transformation may only contain rotations, translations
+ * and uniform scales, which keep the sphere a sphere. Texture coordinates
+ * are the spherical coordinates of the hit point in the rotated frame,
+ * which is also how an opacity mask (\c alphaMask) is looked up.
+ */
+class Sphere : public Shape {
+public:
+    Sphere(const PropertyList &propList) {
+        m_center = propList.getPoint("center", Point3f(0.0f));
+        m_radius = propList.getFloat("radius", 1.0f);
+        if (m_radius <= 0)
+            throw NoriException("Sphere: the radius must be positive!");
+
+        Transform trafo = propList.getTransform("toWorld", Transform());
+        Eigen::Matrix3f linear = trafo.getMatrix().topLeftCorner<3, 3>();
+        float scale = std::cbrt(std::abs(linear.determinant()));
+        if (!(scale > 0) || !(linear.transpose() * linear).isApprox(
+                Eigen::Matrix3f::Identity() * (scale * scale), 1e-4f) ||
+            trafo.getMatrix().row(3) != Eigen::RowVector4f(0, 0, 0, 1))
+            throw NoriException("Sphere: the \"toWorld\" transformation must be "
+                                "a similarity transform (rotation, translation and "
+                                "uniform scale)!");
+        m_center = trafo * m_center;
+        m_radius *= scale;
+        m_rotation = linear / scale;
+        loadAlphaMask(propList);
+
+        m_name = "sphere";
+        m_bbox = BoundingBox3f(
+            m_center - Vector3f(m_radius), m_center + Vector3f(m_radius));
+    }
+
+    uint32_t getPrimitiveCount() const { return 1; }
+
+    BoundingBox3f getBoundingBox(uint32_t) const { return m_bbox; }
+
+    Point3f getCentroid(uint32_t) const { return m_center; }
+
+    bool rayIntersect(uint32_t, const Ray3f &ray,
+                      float &u, float &v, float &t) const {
+        /* Solve the quadratic in double precision to avoid
+           cancellation for rays that start far away */
+        Vector3d o = (ray.o - m_center).cast<double>();
+        Vector3d d = ray.d.cast<double>();
+
+        double A = d.squaredNorm();
+        double B = 2 * d.dot(o);
+        double C = o.squaredNorm() - (double) m_radius * (double) m_radius;
+
+        double discrim = B * B - 4 * A * C;
+        if (discrim < 0)
+            return false;
+
+        double temp = -0.5 * (B + std::copysign(std::sqrt(discrim), B));
+        if (temp == 0)
+            return false;
+
+        double roots[2] = { temp / A, C / temp };
+        if (roots[0] > roots[1])
+            std::swap(roots[0], roots[1]);
+
+        /* The far side may be visible through cut-out parts of the near side */
+        for (double root : roots) {
+            if (root < ray.mint || root > ray.maxt)
+                continue;
+            Point2f uv(0.0f);
+            if (hasAlphaMask()) {
+                uv = getTexCoords((o + root * d).cast<float>());
+                if (isCutout(uv))
+                    continue;
+            }
+            t = (float) root;
+            u = uv.x();
+            v = uv.y();
+            return true;
+        }
+        return false;
+    }
+
+    /// Cut-out hits are already skipped by \ref rayIntersect()
+    bool isTransparent(uint32_t, float, float) const { return false; }
+
+    void setHitInformation(uint32_t, const Ray3f &ray, Intersection &its) const {
+        /* Reproject the hit point onto the surface to reduce error */
+        Vector3f local = ray(its.t) - m_center;
+        local *= m_radius / local.norm();
+        its.p = m_center + local;
+
+        Normal3f n(local / m_radius);
+        its.geoFrame = its.shFrame = Frame(n);
+        its.uv = getTexCoords(local);
+    }
+
+    float getSurfaceArea() const {
+        return 4 * M_PI * m_radius * m_radius;
+    }
+
+    void samplePosition(const Point2f &sample, Point3f &p,
+                        Normal3f &n, float &pdf) const {
+        float z = 1 - 2 * sample.x();
+        float r = std::sqrt(std::max(0.0f, 1 - z * z));
+        float sinPhi, cosPhi;
+        sincosf(2 * M_PI * sample.y(), &sinPhi, &cosPhi);
+
+        n = Normal3f(r * cosPhi, r * sinPhi, z);
+        p = m_center + m_radius * n;
+        pdf = 1.0f / getSurfaceArea();
+    }
+
+    std::string toString() const {
+        return tfm::format(
+            "Sphere[\n"
+            "  center = %s,\n"
+            "  radius = %f,\n"
+            "  bsdf = %s,\n"
+            "  emitter = %s\n"
+            "]",
+            m_center.toString(),
+            m_radius,
+            m_bsdf ? indent(m_bsdf->toString()) : std::string("null"),
+            m_emitter ? indent(m_emitter->toString()) : std::string("null")
+        );
+    }
+
+private:
+    /// Spherical coordinates of a direction from the center (in the rotated frame)
+    Point2f getTexCoords(const Vector3f &d) const {
+        Vector3f local = m_rotation.transpose() * d;
+        float phi = std::atan2(local.y(), local.x());
+        if (phi < 0)
+            phi += 2 * M_PI;
+        float theta = std::acos(clamp(local.z() / local.norm(), -1.0f, 1.0f));
+        return Point2f(phi * INV_TWOPI, theta * INV_PI);
+    }
+
+private:
+    Point3f m_center;
+    float m_radius;
+    Eigen::Matrix3f m_rotation; ///< Rotation of the object frame (its columns are the axes)
+};
+
+NORI_REGISTER_CLASS(Sphere, "sphere");
+NORI_NAMESPACE_END
@@ -0,0 +1,288 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+*/
+
+#include <nori/wavefront.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/sampler.h>
+#include <nori/block.h>
+#include <nori/bsdf.h>
+#include <nori/frame.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tuple>
+
+NORI_NAMESPACE_BEGIN
+
+/// Number of queue entries processed by a task of a stage
+#define NORI_WAVEFRONT_GRAIN 4096
+
+WavefrontIntegrator::WavefrontIntegrator(const PropertyList &propList) {
+    int waveSize = propList.getInteger("waveSize", 1 << 20);
+    if (waveSize <= 0)
+        throw NoriException("WavefrontIntegrator: the wave size must be positive!");
+    m_waveSize = (uint32_t) waveSize;
+}
+
+Color3f WavefrontIntegrator::Li(const Scene *, Sampler *, const Ray3f &) const {
+    throw NoriException("WavefrontIntegrator::Li(): wavefront integrators "
+                        "only support rendering entire images!");
+}
+
+void WavefrontIntegrator::render(const Scene *scene, const BlockGenerator &generator,
+                                 BlockAccumulator &accumulator, uint32_t pass,
+                                 uint32_t sampleCount, int blockBegin, int blockEnd) const {
+    const Camera *camera = scene->getCamera();
+    Vector2i outputSize = camera->getOutputSize();
+    int blockSize = generator.getBlockSize();
+
+    /* Each wave consists of consecutive blocks, and the paths of a block
+       are stored contiguously starting at 'first[i]' (relative to the wave) */
+    std::vector<uint32_t> first(blockEnd + 1);
+    uint32_t maxBlockPaths = (uint32_t) (blockSize * blockSize) * sampleCount;
+    uint32_t capacity = std::max(m_waveSize, maxBlockPaths);
+
+    Wavefront wf;
+    wf.paths.allocate(capacity);
+    wf.rays.allocate(capacity);
+    wf.nextRays.allocate(capacity);
+    wf.hits.allocate(capacity);
+    wf.shadowRays.allocate(capacity);
+
+    int waveBegin = blockBegin;
+    while (waveBegin < blockEnd) {
+        /* Gather as many blocks as fit into the wave */
+        int waveEnd = waveBegin;
+        first[waveBegin] = 0;
+        while (waveEnd < blockEnd) {
+            const Point2i &offset = generator.getBlockOffset(waveEnd);
+            Vector2i size = (outputSize - offset).cwiseMin(Vector2i::Constant(blockSize));
+            uint32_t end = first[waveEnd] + (uint32_t) size.prod() * sampleCount;
+            if (end > capacity)
+                break;
+            first[++waveEnd] = end;
+        }
+        uint32_t pathCount = first[waveEnd];
+
+        /* Stage 1: generate camera rays for all pixel samples of the wave */
+        wf.rays.size = pathCount;
+        tbb::parallel_for(tbb::blocked_range<int>(waveBegin, waveEnd),
+            [&](const tbb::blocked_range<int> &range) {
+                ImageBlock block(Vector2i(blockSize), nullptr);
+                std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
+
+                for (int i=range.begin(); i<range.end(); ++i) {
+                    const Point2i &offset = generator.getBlockOffset(i);
+                    Vector2i size = (outputSize - offset).cwiseMin(Vector2i::Constant(blockSize));
+                    block.setOffset(offset);
+                    block.setSize(size);
+                    sampler->prepare(block, pass);
+
+                    uint32_t index = first[i];
+                    for (int y=0; y<size.y(); ++y) {
+                        for (int x=0; x<size.x(); ++x) {
+                            uint64_t pixel = (uint64_t) (offset.y() + y) * outputSize.x() + offset.x() + x;
+                            for (uint32_t j=0; j<sampleCount; ++j, ++index) {
+                                Point2f pixelSample = Point2f((float) (x + offset.x()),
+                                    (float) (y + offset.y())) + sampler->next2D();
+                                Point2f apertureSample = sampler->next2D();
+
+                                Ray3f ray;
+                                Color3f value = camera->sampleRay(ray, pixelSample, apertureSample);
+
+                                PathStates &p = wf.paths;
+                                p.sx[index] = pixelSample.x();
+                                p.sy[index] = pixelSample.y();
+                                p.setThroughput(index, value);
+                                p.lr[index] = p.lg[index] = p.lb[index] = 0.f;
+                                p.depth[index] = 0;
+                                p.specular[index] = 0;
+                                p.random[index].seed(pixel * sampleCount + j, pass);
+                                wf.rays.set(index, ray, index);
+                            }
+                        }
+                    }
+                }
+            }
+        );
+
+        while (wf.rays.size > 0) {
+            /* Stage 2: closest-hit queries */
+            traceClosest(scene, wf);
+
+            /* Stage 3: shading, which produces shadow and continuation rays */
+            wf.nextRays.size = 0;
+            wf.shadowRays.size = 0;
+            shade(scene, wf);
+
+            /* Stage 4: shadow-ray queries */
+            traceShadow(scene, wf);
+
+            wf.rays.swap(wf.nextRays);
+        }
+
+        /* Stage 5: splat the finished paths into the blocks and merge them */
+        tbb::parallel_for(tbb::blocked_range<int>(waveBegin, waveEnd),
+            [&](const tbb::blocked_range<int> &range) {
+                ImageBlock block(Vector2i(blockSize), camera->getReconstructionFilter());
+
+                for (int i=range.begin(); i<range.end(); ++i) {
+                    const Point2i &offset = generator.getBlockOffset(i);
+                    block.setOffset(offset);
+                    block.setSize((outputSize - offset).cwiseMin(Vector2i::Constant(blockSize)));
+                    block.clear();
+
+                    const PathStates &p = wf.paths;
+                    for (uint32_t j=first[i]; j<first[i+1]; ++j)
+                        block.put(Point2f(p.sx[j], p.sy[j]), Color3f(p.lr[j], p.lg[j], p.lb[j]));
+
+                    accumulator.put(block);
+                }
+            }
+        );
+
+        waveBegin = waveEnd;
+    }
+}
+
+void WavefrontIntegrator::traceClosest(const Scene *scene, Wavefront &wf) const {
+    tbb::parallel_for(tbb::blocked_range<uint32_t>(0, wf.rays.size, NORI_WAVEFRONT_GRAIN),
+        [&](const tbb::blocked_range<uint32_t> &range) {
+            HitQueue &hits = wf.hits;
+            for (uint32_t i=range.begin(); i<range.end(); ++i) {
+                Intersection its;
+                if (!scene->rayIntersect(wf.rays.getRay(i), its)) {
+                    hits.shape[i] = nullptr;
+                    continue;
+                }
+                const Normal3f &n = its.shFrame.n;
+                hits.px[i] = its.p.x(); hits.py[i] = its.p.y(); hits.pz[i] = its.p.z();
+                hits.nx[i] = n.x(); hits.ny[i] = n.y(); hits.nz[i] = n.z();
+                hits.shape[i] = its.shape;
+            }
+        }
+    );
+}
+
+void WavefrontIntegrator::traceShadow(const Scene *scene, Wavefront &wf) const {
+    tbb::parallel_for(tbb::blocked_range<uint32_t>(0, wf.shadowRays.size, NORI_WAVEFRONT_GRAIN),
+        [&](const tbb::blocked_range<uint32_t> &range) {
+            const ShadowQueue &q = wf.shadowRays;
+            for (uint32_t i=range.begin(); i<range.end(); ++i) {
+                Ray3f ray = q.getRay(i);
+                ray.maxt = q.maxt[i];
+                if (!scene->rayIntersect(ray))
+                    wf.paths.addRadiance(q.path[i], Color3f(q.cr[i], q.cg[i], q.cb[i]));
+            }
+        }
+    );
+}
+
+/**
+ * \brief Wavefront path tracer for scenes lit by a uniform sky
+ *
+ * Emitters don't expose an interface to integrators yet, hence this
+ * integrator illuminates the scene using a constant "radiance" arriving
+ * from all directions. Every diffuse vertex sends one BSDF-sampled shadow
+ * ray towards the sky; escaping continuation rays only contribute after
+ * specular (non-diffuse) vertices, so the sky is never counted twice.
+ * Paths are terminated after "maxDepth" scattering events and by Russian
+ * roulette from the fourth one on.
+ */
+class WavefrontPathTracer : public WavefrontIntegrator {
+public:
+    WavefrontPathTracer(const PropertyList &propList) : WavefrontIntegrator(propList) {
+        m_radiance = propList.getColor("radiance", Color3f(1.0f));
+        m_maxDepth = propList.getInteger("maxDepth", 5);
+    }
+
+    std::string toString() const {
+        return tfm::format(
+            "WavefrontPathTracer[\n"
+            "  radiance = %s,\n"
+            "  maxDepth = %i,\n"
+            "  waveSize = %i\n"
+            "]", m_radiance.toString(), m_maxDepth, m_waveSize);
+    }
+
+protected:
+    void shade(const Scene *scene, Wavefront &wf) const {
+        tbb::parallel_for(tbb::blocked_range<uint32_t>(0, wf.rays.size, NORI_WAVEFRONT_GRAIN),
+            [&](const tbb::blocked_range<uint32_t> &range) {
+                /* Stage the output rays locally and then append them to the queues at once */
+                std::vector<std::pair<Ray3f, uint32_t>> next;
+                std::vector<std::tuple<Ray3f, Color3f, uint32_t>> shadow;
+                PathStates &p = wf.paths;
+                const HitQueue &hits = wf.hits;
+
+                for (uint32_t i=range.begin(); i<range.end(); ++i) {
+                    uint32_t index = wf.rays.path[i];
+                    Color3f throughput = p.getThroughput(index);
+
+                    if (!hits.shape[i]) {
+                        if (p.depth[index] == 0 || p.specular[index])
+                            p.addRadiance(index, throughput * m_radiance);
+                        continue;
+                    }
+
+                    const BSDF *bsdf = hits.shape[i]->getBSDF();
+                    if (!bsdf)
+                        continue;
+
+                    Point3f pos(hits.px[i], hits.py[i], hits.pz[i]);
+                    Frame frame(Vector3f(hits.nx[i], hits.ny[i], hits.nz[i]));
+                    Vector3f wi = frame.toLocal(-Vector3f(wf.rays.dx[i], wf.rays.dy[i], wf.rays.dz[i]));
+                    pcg32 &random = p.random[index];
+
+                    if (bsdf->isDiffuse()) {
+                        /* Shadow ray towards the sky */
+                        BSDFQueryRecord bRec(wi);
+                        Color3f weight = bsdf->sample(bRec, Point2f(random.nextFloat(), random.nextFloat()));
+                        if (!weight.isZero())
+                            shadow.emplace_back(Ray3f(pos, frame.toWorld(bRec.wo)),
+                                                throughput * weight * m_radiance, index);
+                    }
+
+                    if (p.depth[index] + 1 >= m_maxDepth)
+                        continue;
+
+                    /* Continue the path */
+                    BSDFQueryRecord bRec(wi);
+                    throughput *= bsdf->sample(bRec, Point2f(random.nextFloat(), random.nextFloat()));
+                    if (p.depth[index] >= 3) {
+                        float q = std::min(throughput.maxCoeff(), 0.99f);
+                        if (random.nextFloat() >= q)
+                            continue;
+                        throughput /= q;
+                    }
+                    if (throughput.isZero())
+                        continue;
+
+                    p.setThroughput(index, throughput);
+                    p.depth[index]++;
+                    p.specular[index] = !bsdf->isDiffuse();
+                    next.emplace_back(Ray3f(pos, frame.toWorld(bRec.wo)), index);
+                }
+
+                uint32_t base = wf.nextRays.reserve((uint32_t) next.size());
+                for (size_t j=0; j<next.size(); ++j)
+                    wf.nextRays.set(base + (uint32_t) j, next[j].first, next[j].second);
+
+                base = wf.shadowRays.reserve((uint32_t) shadow.size());
+                for (size_t j=0; j<shadow.size(); ++j)
+                    wf.shadowRays.set(base + (uint32_t) j, std::get<0>(shadow[j]),
+                                      std::get<1>(shadow[j]), std::get<2>(shadow[j]));
+            }
+        );
+    }
+
+private:
+    Color3f m_radiance;
+    int m_maxDepth;
+};
+
+NORI_REGISTER_CLASS(WavefrontPathTracer, "wavefront");
+NORI_NAMESPACE_END